@@ -5,8 +5,12 @@
 library flutter_blue_plus;
 
 import 'dart:async';
+import 'dart:ffi' as ffi;
 import 'dart:io';
+import 'dart:isolate';
+import 'dart:typed_data';
 
+import 'package:ffi/ffi.dart' show malloc;
 import 'package:flutter/services.dart';
 
 part 'src/bluetooth_characteristic.dart';
@@ -18,4 +22,5 @@ part 'src/bluetooth_service.dart';
 part 'src/bluetooth_utils.dart';
 part 'src/flutter_blue_plus.dart';
 part 'src/guid.dart';
+part 'src/native_snapshot.dart';
 part 'src/utils.dart';
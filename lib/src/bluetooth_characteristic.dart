@@ -37,6 +37,7 @@ class BluetoothCharacteristic {
   }
 
   /// Get Descriptors from known services
+  ///   - Windows: empty until [discoverDescriptors], if services were discovered with lazyDescriptors
   List<BluetoothDescriptor> get descriptors {
     return _bmchr != null ? _bmchr!.descriptors.map((d) => BluetoothDescriptor.fromProto(d)).toList() : [];
   }
@@ -56,13 +57,8 @@ class BluetoothCharacteristic {
   ///   - anytime `write()` is called
   ///   - anytime a notification arrives (if subscribed)
   ///   - and when first listened to, it re-emits the last value for convenience
-  Stream<List<int>> get lastValueStream => FlutterBluePlus._methodStream.stream
-      .where((m) => m.method == "OnCharacteristicReceived" || m.method == "OnCharacteristicWritten")
-      .map((m) => m.arguments)
-      .map((args) => BmCharacteristicData.fromMap(args))
-      .where((p) => p.remoteId == remoteId.toString())
-      .where((p) => p.serviceUuid == serviceUuid)
-      .where((p) => p.characteristicUuid == characteristicUuid)
+  Stream<List<int>> get lastValueStream => FlutterBluePlus._chrStream(_channelId)
+      .map((m) => m.arguments as BmCharacteristicData)
       .where((p) => p.success == true)
       .map((c) => c.value)
       .newStreamWithInitialValue(lastValue);
@@ -70,40 +66,105 @@ class BluetoothCharacteristic {
   /// this stream emits values:
   ///   - anytime `read()` is called
   ///   - anytime a notification arrives (if subscribed)
-  Stream<List<int>> get onValueReceived => FlutterBluePlus._methodStream.stream
+  Stream<List<int>> get onValueReceived => FlutterBluePlus._chrStream(_channelId)
       .where((m) => m.method == "OnCharacteristicReceived")
-      .map((m) => m.arguments)
-      .map((args) => BmCharacteristicData.fromMap(args))
-      .where((p) => p.remoteId == remoteId.toString())
-      .where((p) => p.serviceUuid == serviceUuid)
-      .where((p) => p.characteristicUuid == characteristicUuid)
+      .map((m) => m.arguments as BmCharacteristicData)
       .where((p) => p.success == true)
       .map((c) => c.value);
 
+  /// this stream emits the notifications decoded natively by the [PayloadLayout]
+  /// given to [setNotifyValue] (Windows only)
+  ///   - a Float32List, or an Int32List if [PayloadLayout.asInt32] is set
+  ///   - values read with [startPolling] are decoded too
+  Stream<List<num>> get onDecodedValueReceived => FlutterBluePlus._chrStream(_channelId)
+      .where((m) => m.method == "OnCharacteristicReceived")
+      .map((m) => m.arguments as BmCharacteristicData)
+      .where((p) => p.success == true && p.decoded != null)
+      .map((c) => c.decoded!);
+
+  /// this stream emits notifications with the time they were received natively (Windows only)
+  ///   - the timestamps are monotonic, comparable between characteristics & devices,
+  ///     and do not include the platform channel & isolate scheduling delay
+  ///   - see also [FlutterBluePlus.setAlignment]
+  Stream<TimestampedValue> get onTimestampedValueReceived => FlutterBluePlus._chrStream(_channelId)
+      .where((m) => m.method == "OnCharacteristicReceived")
+      .map((m) => m.arguments as BmCharacteristicData)
+      .where((p) => p.success == true && p.timestamp != null)
+      .map((c) => TimestampedValue._fromProto(c));
+
   /// return true if we're subscribed to this characteristic
   ///   -  you can subscribe using setNotifyValue(true)
   bool get isNotifying {
-    var cccd = descriptors._firstWhereOrNull((d) => d.descriptorUuid == cccdUuid);
-    if (cccd == null) {
-      return false;
-    }
-    var hasNotify = cccd.lastValue.isNotEmpty && (cccd.lastValue[0] & 0x01) > 0;
-    var hasIndicate = cccd.lastValue.isNotEmpty && (cccd.lastValue[0] & 0x02) > 0;
+    // read the cccd value directly, its descriptor may not be discovered yet (lazyDescriptors)
+    var cccd = FlutterBluePlus._lastDescs[remoteId]?["$serviceUuid:$characteristicUuid:$cccdUuid"] ?? [];
+    var hasNotify = cccd.isNotEmpty && (cccd[0] & 0x01) > 0;
+    var hasIndicate = cccd.isNotEmpty && (cccd[0] & 0x02) > 0;
     return hasNotify || hasIndicate;
   }
 
-  /// read a characteristic
-  Future<List<int>> read({int timeout = 15}) async {
+  /// Discover the descriptors, if services were discovered with lazyDescriptors (Windows only)
+  ///   - otherwise, returns the known [descriptors]
+  Future<List<BluetoothDescriptor>> discoverDescriptors() async {
+    BmBluetoothCharacteristic? bmchr = _bmchr;
+    if (bmchr == null || bmchr.descriptorsPending == false) {
+      return descriptors;
+    }
+
     // check connected
     if (device.isConnected == false) {
       throw FlutterBluePlusException(
-          ErrorPlatform.fbp, "readCharacteristic", FbpErrorCode.deviceIsDisconnected.index, "device is not connected");
+          ErrorPlatform.fbp, "discoverDescriptors", FbpErrorCode.deviceIsDisconnected.index, "device is not connected");
     }
 
     // Only allow a single ble operation to be underway at a time
     _Mutex mtx = _MutexFactory.getMutexForKey("global");
     await mtx.take();
 
+    try {
+      var request = BmDiscoverDescriptorsRequest(
+        remoteId: remoteId.str,
+        serviceUuid: serviceUuid,
+        characteristicUuid: characteristicUuid,
+      );
+
+      List<dynamic> out = await FlutterBluePlus._invokeMethod('discoverDescriptors', request.toMap());
+      bmchr.descriptors = out.map((d) => BmBluetoothDescriptor.fromMap(d)).toList();
+      bmchr.descriptorsPending = false;
+    } finally {
+      mtx.give();
+    }
+
+    return descriptors;
+  }
+
+  /// read a characteristic
+  ///   - concurrent reads of the same characteristic share a single read
+  ///   - [maxAge] Windows only. If the last read or notified value is at most this old,
+  ///     it is returned without reading the device again.
+  ///   - [priority] the order operations are issued in, see [OperationPriority].
+  ///     A read that joins one in flight keeps the priority of the first.
+  Future<List<int>> read(
+      {int timeout = 15, Duration? maxAge, OperationPriority priority = OperationPriority.interactive}) {
+    int channelId = _channelId;
+    if (FlutterBluePlus._inflightReads.containsKey(channelId) == false) {
+      FlutterBluePlus._inflightReads[channelId] =
+          _read(timeout, maxAge, priority).whenComplete(() => FlutterBluePlus._inflightReads.remove(channelId));
+    }
+    return FlutterBluePlus._inflightReads[channelId]!;
+  }
+
+  Future<List<int>> _read(int timeout, Duration? maxAge, OperationPriority priority) async {
+    // check connected
+    if (device.isConnected == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "readCharacteristic", FbpErrorCode.deviceIsDisconnected.index, "device is not connected");
+    }
+
+    // Only allow a single ble operation to be underway at a time.
+    // Windows queues them natively per device instead.
+    _Mutex? mtx = FlutterBluePlus._nativeQueue ? null : _MutexFactory.getMutexForKey("global");
+    await mtx?.take(priority);
+
     // return value
     List<int> responseValue = [];
 
@@ -113,27 +174,41 @@ class BluetoothCharacteristic {
         characteristicUuid: characteristicUuid,
         serviceUuid: serviceUuid,
         secondaryServiceUuid: null,
+        maxAge: maxAge?.inMilliseconds,
+        priority: priority.index,
       );
 
-      var responseStream = FlutterBluePlus._methodStream.stream
-          .where((m) => m.method == "OnCharacteristicReceived")
-          .map((m) => m.arguments)
-          .map((args) => BmCharacteristicData.fromMap(args))
-          .where((p) => p.remoteId == request.remoteId)
-          .where((p) => p.serviceUuid == request.serviceUuid)
-          .where((p) => p.characteristicUuid == request.characteristicUuid);
-
-      // Start listening now, before invokeMethod, to ensure we don't miss the response
-      Future<BmCharacteristicData> futureResponse = responseStream.first;
-
-      // invoke
-      await FlutterBluePlus._invokeMethod('readCharacteristic', request.toMap());
+      Future<BmCharacteristicData> futureResponse;
+      int operationId = 0;
+
+      if (FlutterBluePlus._deferredResults) {
+        // invoke, the response is the method result
+        var args = request.toMap();
+        operationId = FlutterBluePlus._addDeadline(args, Duration(seconds: timeout));
+        futureResponse = FlutterBluePlus._invokeMethodDeferred('readCharacteristic', "OnCharacteristicReceived", args)
+            .then((args) => BmCharacteristicData.fromMap(args));
+      } else {
+        var responseStream = FlutterBluePlus._methodStream.stream
+            .where((m) => m.method == "OnCharacteristicReceived")
+            .map((m) => m.arguments)
+            .map((args) => BmCharacteristicData.fromMap(args))
+            .where((p) => p.remoteId == request.remoteId)
+            .where((p) => p.serviceUuid == request.serviceUuid)
+            .where((p) => p.characteristicUuid == request.characteristicUuid);
+
+        // Start listening now, before invokeMethod, to ensure we don't miss the response
+        futureResponse = responseStream.first;
+
+        // invoke
+        await FlutterBluePlus._invokeMethod('readCharacteristic', request.toMap());
+      }
 
       // wait for response
       BmCharacteristicData response = await futureResponse
           .fbpEnsureAdapterIsOn("readCharacteristic")
           .fbpEnsureDeviceIsConnected(device, "readCharacteristic")
-          .fbpTimeout(timeout, "readCharacteristic");
+          .fbpTimeout(timeout, "readCharacteristic")
+          .fbpCancelOnTimeout(operationId);
 
       // failed?
       if (!response.success) {
@@ -143,7 +218,7 @@ class BluetoothCharacteristic {
       // set return value
       responseValue = response.value;
     } finally {
-      mtx.give();
+      mtx?.give();
     }
 
     return responseValue;
@@ -158,8 +233,13 @@ class BluetoothCharacteristic {
   ///         2. the peripheral device must support the 'long write' ble protocol.
   ///         3. Interrupted transfers can leave the characteristic in a partially written state
   ///         4. If the mtu is small, it is very very slow.
+  ///  - [priority]: the order operations are issued in, e.g. [OperationPriority.realtime]
+  ///       for control commands that must not wait behind bulk reads.
   Future<void> write(List<int> value,
-      {bool withoutResponse = false, bool allowLongWrite = false, int timeout = 15}) async {
+      {bool withoutResponse = false,
+      bool allowLongWrite = false,
+      int timeout = 15,
+      OperationPriority priority = OperationPriority.interactive}) async {
     //  check args
     if (withoutResponse && allowLongWrite) {
       throw ArgumentError("cannot longWrite withoutResponse, not allowed on iOS or Android");
@@ -171,9 +251,10 @@ class BluetoothCharacteristic {
           ErrorPlatform.fbp, "writeCharacteristic", FbpErrorCode.deviceIsDisconnected.index, "device is not connected");
     }
 
-    // Only allow a single ble operation to be underway at a time
-    _Mutex mtx = _MutexFactory.getMutexForKey("global");
-    await mtx.take();
+    // Only allow a single ble operation to be underway at a time.
+    // Windows queues them natively per device instead.
+    _Mutex? mtx = FlutterBluePlus._nativeQueue ? null : _MutexFactory.getMutexForKey("global");
+    await mtx?.take(priority);
 
     try {
       final writeType = withoutResponse ? BmWriteType.withoutResponse : BmWriteType.withResponse;
@@ -186,21 +267,33 @@ class BluetoothCharacteristic {
         writeType: writeType,
         allowLongWrite: allowLongWrite,
         value: value,
+        priority: priority.index,
       );
 
-      var responseStream = FlutterBluePlus._methodStream.stream
-          .where((m) => m.method == "OnCharacteristicWritten")
-          .map((m) => m.arguments)
-          .map((args) => BmCharacteristicData.fromMap(args))
-          .where((p) => p.remoteId == request.remoteId)
-          .where((p) => p.serviceUuid == request.serviceUuid)
-          .where((p) => p.characteristicUuid == request.characteristicUuid);
-
-      // Start listening now, before invokeMethod, to ensure we don't miss the response
-      Future<BmCharacteristicData> futureResponse = responseStream.first;
-
-      // invoke
-      await FlutterBluePlus._invokeMethod('writeCharacteristic', request.toMap());
+      Future<BmCharacteristicData> futureResponse;
+      int operationId = 0;
+
+      if (FlutterBluePlus._deferredResults) {
+        // invoke, the response is the method result
+        var args = request.toMap();
+        operationId = FlutterBluePlus._addDeadline(args, Duration(seconds: timeout));
+        futureResponse = FlutterBluePlus._invokeMethodDeferred('writeCharacteristic', "OnCharacteristicWritten", args)
+            .then((args) => BmCharacteristicData.fromMap(args));
+      } else {
+        var responseStream = FlutterBluePlus._methodStream.stream
+            .where((m) => m.method == "OnCharacteristicWritten")
+            .map((m) => m.arguments)
+            .map((args) => BmCharacteristicData.fromMap(args))
+            .where((p) => p.remoteId == request.remoteId)
+            .where((p) => p.serviceUuid == request.serviceUuid)
+            .where((p) => p.characteristicUuid == request.characteristicUuid);
+
+        // Start listening now, before invokeMethod, to ensure we don't miss the response
+        futureResponse = responseStream.first;
+
+        // invoke
+        await FlutterBluePlus._invokeMethod('writeCharacteristic', request.toMap());
+      }
 
       // wait for response so that we can:
       //  1. check for success (writeWithResponse)
@@ -208,7 +301,8 @@ class BluetoothCharacteristic {
       BmCharacteristicData response = await futureResponse
           .fbpEnsureAdapterIsOn("writeCharacteristic")
           .fbpEnsureDeviceIsConnected(device, "writeCharacteristic")
-          .fbpTimeout(timeout, "writeCharacteristic");
+          .fbpTimeout(timeout, "writeCharacteristic")
+          .fbpCancelOnTimeout(operationId);
 
       // failed?
       if (!response.success) {
@@ -217,7 +311,7 @@ class BluetoothCharacteristic {
 
       return Future.value();
     } finally {
-      mtx.give();
+      mtx?.give();
     }
   }
 
@@ -225,7 +319,18 @@ class BluetoothCharacteristic {
   ///   - If a characteristic supports both notifications and indications,
   ///     we use notifications. This is a limitation of CoreBluetooth on iOS.
   ///   - [forceIndications] Android Only. force indications to be used instead of notifications.
-  Future<bool> setNotifyValue(bool notify, {int timeout = 15, bool forceIndications = false}) async {
+  ///   - [payloadLayout] Windows only. Decode each notification natively, see [onDecodedValueReceived]
+  ///   - [nativePort] Windows only. Post each notification straight to this port, e.g. of a worker
+  ///     isolate, from the native bluetooth thread. They skip the platform channel & the UI isolate,
+  ///     and are not delivered to [lastValueStream] or [onValueReceived]. Each message is a
+  ///     Uint8List, or the Float32List / Int32List of the [payloadLayout], that dart owns without a copy.
+  ///   - [priority] the order operations are issued in, see [OperationPriority]
+  Future<bool> setNotifyValue(bool notify,
+      {int timeout = 15,
+      bool forceIndications = false,
+      PayloadLayout? payloadLayout,
+      SendPort? nativePort,
+      OperationPriority priority = OperationPriority.interactive}) async {
     // check connected
     if (device.isConnected == false) {
       throw FlutterBluePlusException(
@@ -236,10 +341,22 @@ class BluetoothCharacteristic {
     if (Platform.isMacOS || Platform.isIOS) {
       assert(forceIndications == false, "iOS & macOS do not support forcing indications");
     }
+    if (payloadLayout != null && Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "setNotifyValue", FbpErrorCode.windowsOnly.index, "payloadLayout is windows-only");
+    }
+    if (nativePort != null) {
+      if (Platform.isWindows == false) {
+        throw FlutterBluePlusException(
+            ErrorPlatform.fbp, "setNotifyValue", FbpErrorCode.windowsOnly.index, "nativePort is windows-only");
+      }
+      FlutterBluePlus._initDartApiDL();
+    }
 
-    // Only allow a single ble operation to be underway at a time
-    _Mutex mtx = _MutexFactory.getMutexForKey("global");
-    await mtx.take();
+    // Only allow a single ble operation to be underway at a time.
+    // Windows queues them natively per device instead.
+    _Mutex? mtx = FlutterBluePlus._nativeQueue ? null : _MutexFactory.getMutexForKey("global");
+    await mtx?.take(priority);
 
     try {
       var request = BmSetNotifyValueRequest(
@@ -249,31 +366,48 @@ class BluetoothCharacteristic {
         characteristicUuid: characteristicUuid,
         forceIndications: forceIndications,
         enable: notify,
+        channelId: _channelId,
+        payloadLayout: payloadLayout,
+        nativePort: nativePort?.nativePort,
+        priority: priority.index,
       );
 
-      // Notifications & Indications are configured by writing to the
-      // Client Characteristic Configuration Descriptor (CCCD)
-      Stream<BmDescriptorData> responseStream = FlutterBluePlus._methodStream.stream
-          .where((m) => m.method == "OnDescriptorWritten")
-          .map((m) => m.arguments)
-          .map((args) => BmDescriptorData.fromMap(args))
-          .where((p) => p.remoteId == request.remoteId)
-          .where((p) => p.serviceUuid == request.serviceUuid)
-          .where((p) => p.characteristicUuid == request.characteristicUuid)
-          .where((p) => p.descriptorUuid == cccdUuid);
-
-      // Start listening now, before invokeMethod, to ensure we don't miss the response
-      Future<BmDescriptorData> futureResponse = responseStream.first;
-
-      // invoke
-      bool hasCCCD = await FlutterBluePlus._invokeMethod('setNotifyValue', request.toMap());
+      Future<BmDescriptorData> futureResponse;
+      bool hasCCCD = true;
+      int operationId = 0;
+
+      if (FlutterBluePlus._deferredResults) {
+        // invoke, the CCCD write response is the method result
+        var args = request.toMap();
+        operationId = FlutterBluePlus._addDeadline(args, Duration(seconds: timeout));
+        futureResponse = FlutterBluePlus._invokeMethodDeferred('setNotifyValue', "OnDescriptorWritten", args)
+            .then((args) => BmDescriptorData.fromMap(args));
+      } else {
+        // Notifications & Indications are configured by writing to the
+        // Client Characteristic Configuration Descriptor (CCCD)
+        Stream<BmDescriptorData> responseStream = FlutterBluePlus._methodStream.stream
+            .where((m) => m.method == "OnDescriptorWritten")
+            .map((m) => m.arguments)
+            .map((args) => BmDescriptorData.fromMap(args))
+            .where((p) => p.remoteId == request.remoteId)
+            .where((p) => p.serviceUuid == request.serviceUuid)
+            .where((p) => p.characteristicUuid == request.characteristicUuid)
+            .where((p) => p.descriptorUuid == cccdUuid);
+
+        // Start listening now, before invokeMethod, to ensure we don't miss the response
+        futureResponse = responseStream.first;
+
+        // invoke
+        hasCCCD = await FlutterBluePlus._invokeMethod('setNotifyValue', request.toMap());
+      }
 
       // wait for CCCD descriptor to be written?
       if (hasCCCD) {
         BmDescriptorData response = await futureResponse
             .fbpEnsureAdapterIsOn("setNotifyValue")
             .fbpEnsureDeviceIsConnected(device, "setNotifyValue")
-            .fbpTimeout(timeout, "setNotifyValue");
+            .fbpTimeout(timeout, "setNotifyValue")
+            .fbpCancelOnTimeout(operationId);
 
         // failed?
         if (!response.success) {
@@ -281,12 +415,76 @@ class BluetoothCharacteristic {
         }
       }
     } finally {
-      mtx.give();
+      mtx?.give();
     }
 
     return true;
   }
 
+  /// Read this characteristic periodically, natively (Windows only)
+  ///   - for characteristics that do not support notifications
+  ///   - values are delivered like notifications, to [lastValueStream] and [onValueReceived]
+  ///   - [interval] the time between reads
+  ///   - [jitter] each interval is randomly lengthened or shortened by up to this much
+  ///   - [onlyOnChange] only deliver values that differ from the last known value
+  ///   - polls are staggered across characteristics & devices, to avoid bursts
+  ///   - polling stops on disconnect, or when startPolling is called again
+  Future<void> startPolling({
+    required Duration interval,
+    Duration jitter = Duration.zero,
+    bool onlyOnChange = false,
+  }) async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(ErrorPlatform.fbp, "startPolling", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    // check args
+    if (interval <= Duration.zero) {
+      throw ArgumentError("interval must be positive");
+    }
+    if (jitter < Duration.zero || jitter >= interval) {
+      throw ArgumentError("jitter must be between 0 and interval");
+    }
+
+    // check connected
+    if (device.isConnected == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "startPolling", FbpErrorCode.deviceIsDisconnected.index, "device is not connected");
+    }
+
+    var request = BmStartPollingRequest(
+      remoteId: remoteId.str,
+      serviceUuid: serviceUuid,
+      characteristicUuid: characteristicUuid,
+      interval: interval.inMilliseconds,
+      jitter: jitter.inMilliseconds,
+      onlyOnChange: onlyOnChange,
+      channelId: _channelId,
+    );
+
+    await FlutterBluePlus._invokeMethod('startPolling', request.toMap());
+  }
+
+  /// Stop reading this characteristic periodically (Windows only)
+  Future<void> stopPolling() async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(ErrorPlatform.fbp, "stopPolling", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    var request = BmStopPollingRequest(
+      remoteId: remoteId.str,
+      serviceUuid: serviceUuid,
+      characteristicUuid: characteristicUuid,
+    );
+
+    await FlutterBluePlus._invokeMethod('stopPolling', request.toMap());
+  }
+
+  /// used to route events to this characteristic's streams
+  int get _channelId => FlutterBluePlus._chrChannelId(remoteId, serviceUuid, characteristicUuid);
+
   /// look through known services
   BmBluetoothCharacteristic? get _bmchr {
     if (FlutterBluePlus._knownServices[remoteId] != null) {
@@ -378,3 +576,85 @@ class CharacteristicProperties {
         '}';
   }
 }
+
+/// The type of a [PayloadField]
+enum PayloadFieldType {
+  uint8, // 0
+  int8, // 1
+  uint16, // 2
+  int16, // 3
+  uint32, // 4
+  int32, // 5
+  float32, // 6
+}
+
+/// A field of a [PayloadLayout]. It is decoded as raw * [scale] + [offset].
+class PayloadField {
+  final PayloadFieldType type;
+  final double scale;
+  final double offset;
+
+  const PayloadField(this.type, {this.scale = 1.0, this.offset = 0.0});
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['type'] = type.index;
+    data['scale'] = scale;
+    data['offset'] = offset;
+    return data;
+  }
+}
+
+/// Notifications that are packed records of fixed size fields (Windows only)
+///   - e.g. 20 x int16 accelerometer samples:
+///     `PayloadLayout([PayloadField(PayloadFieldType.int16, scale: 1 / 16384)], repeat: 20)`
+///   - [repeat] records per notification. 0 = as many as the notification holds.
+///   - [asInt32] decode to an Int32List, rounding each value, instead of a Float32List
+/// The records are decoded one after the other into a single flat list.
+class PayloadLayout {
+  final List<PayloadField> fields;
+  final Endian endian;
+  final int repeat;
+  final bool asInt32;
+
+  const PayloadLayout(this.fields, {this.endian = Endian.little, this.repeat = 0, this.asInt32 = false});
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['fields'] = fields.map((f) => f.toMap()).toList();
+    data['big_endian'] = endian == Endian.big;
+    data['repeat'] = repeat;
+    data['as_int32'] = asInt32;
+    return data;
+  }
+}
+
+/// A notification & when it was received natively (Windows only)
+class TimestampedValue {
+  final BluetoothCharacteristic characteristic;
+  final List<int> value;
+  final List<num>? decoded;
+
+  /// monotonic, since an arbitrary point in time (e.g. boot). Only differences are meaningful.
+  final Duration timestamp;
+
+  TimestampedValue._fromProto(BmCharacteristicData p)
+      : characteristic = BluetoothCharacteristic(
+            remoteId: DeviceIdentifier(p.remoteId),
+            serviceUuid: p.serviceUuid,
+            secondaryServiceUuid: p.secondaryServiceUuid,
+            characteristicUuid: p.characteristicUuid),
+        value = p.value,
+        decoded = p.decoded,
+        timestamp = Duration(microseconds: p.timestamp ?? 0);
+
+  @override
+  String toString() {
+    return 'TimestampedValue{'
+        'characteristic: ${characteristic.uuid}, '
+        'remoteId: ${characteristic.remoteId}, '
+        'value: $value, '
+        'timestamp: $timestamp'
+        '}';
+  }
+}
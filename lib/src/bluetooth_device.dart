@@ -89,10 +89,15 @@ class BluetoothDevice {
   ///        because it relies on the internal scheduling of background scans.
   ///      - autoconnect is disabled when you manually call disconnect
   ///   [mtu] Android only. Request a larger mtu right after connection, if set.
+  ///   [windowsReconnect] Windows only. Reconnect natively whenever the link drops.
+  ///      - the gatt cache, subscriptions & `lastValueStream` listeners are kept,
+  ///        so `connectionState` only briefly reports disconnected
+  ///      - calling disconnect stops reconnecting
   Future<void> connect({
     Duration? timeout = const Duration(seconds: 35),
     bool autoConnect = false,
     int? mtu = 512,
+    WindowsReconnectPolicy? windowsReconnect,
   }) async {
     // make sure no one else is calling disconnect
     _Mutex dmtx = _MutexFactory.getMutexForKey("disconnect");
@@ -106,19 +111,23 @@ class BluetoothDevice {
       var request = BmConnectRequest(
         remoteId: remoteId.str,
         autoConnect: autoConnect,
+        windowsReconnectAttempts: windowsReconnect?.maxAttempts ?? 0,
+        windowsReconnectDelay: windowsReconnect?.initialDelay.inMilliseconds ?? 0,
+        windowsReconnectMaxDelay: windowsReconnect?.maxDelay.inMilliseconds ?? 0,
       );
 
-      var responseStream = FlutterBluePlus._methodStream.stream
+      var responseStream = FlutterBluePlus._deviceStream(remoteId)
           .where((m) => m.method == "OnConnectionStateChanged")
           .map((m) => m.arguments)
-          .map((args) => BmConnectionStateResponse.fromMap(args))
-          .where((p) => p.remoteId == remoteId.str);
+          .map((args) => BmConnectionStateResponse.fromMap(args));
 
       // Start listening now, before invokeMethod, to ensure we don't miss the response
       Future<BmConnectionStateResponse> futureState = responseStream.first;
 
       // invoke
-      bool changed = await FlutterBluePlus._invokeMethod('connect', request.toMap());
+      var args = request.toMap();
+      int operationId = FlutterBluePlus._addDeadline(args, timeout);
+      bool changed = await FlutterBluePlus._invokeMethod('connect', args);
 
       // we return the disconnect mutex now so that this
       // connection attempt can be canceled by calling disconnect
@@ -131,7 +140,8 @@ class BluetoothDevice {
             .fbpTimeout(timeout.inSeconds, "connect")
             .catchError((e) async {
           if (e is FlutterBluePlusException && e.code == FbpErrorCode.timeout.index) {
-            await FlutterBluePlus._invokeMethod('disconnect', remoteId.str); // cancel connection attempt
+            await FlutterBluePlus._cancelOperation(operationId); // cancel connection attempt
+            await FlutterBluePlus._invokeMethod('disconnect', remoteId.str);
           }
           throw e;
         });
@@ -177,11 +187,10 @@ class BluetoothDevice {
     }
 
     try {
-      var responseStream = FlutterBluePlus._methodStream.stream
+      var responseStream = FlutterBluePlus._deviceStream(remoteId)
           .where((m) => m.method == "OnConnectionStateChanged")
           .map((m) => m.arguments)
           .map((args) => BmConnectionStateResponse.fromMap(args))
-          .where((p) => p.remoteId == remoteId.str)
           .where((p) => p.connectionState == BmConnectionStateEnum.disconnected);
 
       // Start listening now, before invokeMethod, to ensure we don't miss the response
@@ -203,13 +212,32 @@ class BluetoothDevice {
   }
 
   /// Discover services, characteristics, and descriptors of the remote device
-  Future<List<BluetoothService>> discoverServices({int timeout = 15}) async {
+  ///   - [withServices] Windows only. Only discover these services, and return only them.
+  ///     Services discovered earlier stay known.
+  ///   - [lazyDescriptors] Windows only. Skip descriptors, until [BluetoothCharacteristic.discoverDescriptors]
+  Future<List<BluetoothService>> discoverServices({
+    int timeout = 15,
+    List<Guid> withServices = const [],
+    bool lazyDescriptors = false,
+  }) async {
     // check connected
     if (isConnected == false) {
       throw FlutterBluePlusException(
           ErrorPlatform.fbp, "discoverServices", FbpErrorCode.deviceIsDisconnected.index, "device is not connected");
     }
 
+    // check windows
+    if ((withServices.isNotEmpty || lazyDescriptors) && Platform.isWindows == false) {
+      throw FlutterBluePlusException(ErrorPlatform.fbp, "discoverServices", FbpErrorCode.windowsOnly.index,
+          "withServices & lazyDescriptors are windows-only");
+    }
+
+    var request = BmDiscoverServicesRequest(
+      remoteId: remoteId.str,
+      withServices: withServices,
+      lazyDescriptors: lazyDescriptors,
+    );
+
     // Only allow a single ble operation to be underway at a time
     _Mutex mtx = _MutexFactory.getMutexForKey("global");
     await mtx.take();
@@ -217,23 +245,34 @@ class BluetoothDevice {
     List<BluetoothService> result = [];
 
     try {
-      var responseStream = FlutterBluePlus._methodStream.stream
-          .where((m) => m.method == "OnDiscoveredServices")
-          .map((m) => m.arguments)
-          .map((args) => BmDiscoverServicesResult.fromMap(args))
-          .where((p) => p.remoteId == remoteId.str);
-
-      // Start listening now, before invokeMethod, to ensure we don't miss the response
-      Future<BmDiscoverServicesResult> futureResponse = responseStream.first;
-
-      // invoke
-      await FlutterBluePlus._invokeMethod('discoverServices', remoteId.str);
+      Future<BmDiscoverServicesResult> futureResponse;
+      int operationId = 0;
+
+      if (FlutterBluePlus._deferredResults) {
+        // invoke, the response is the method result
+        var args = request.toMap();
+        operationId = FlutterBluePlus._addDeadline(args, Duration(seconds: timeout));
+        futureResponse = FlutterBluePlus._invokeMethodDeferred('discoverServices', "OnDiscoveredServices", args)
+            .then((args) => BmDiscoverServicesResult.fromMap(args));
+      } else {
+        var responseStream = FlutterBluePlus._deviceStream(remoteId)
+            .where((m) => m.method == "OnDiscoveredServices")
+            .map((m) => m.arguments)
+            .map((args) => BmDiscoverServicesResult.fromMap(args));
+
+        // Start listening now, before invokeMethod, to ensure we don't miss the response
+        futureResponse = responseStream.first;
+
+        // invoke
+        await FlutterBluePlus._invokeMethod('discoverServices', Platform.isWindows ? request.toMap() : remoteId.str);
+      }
 
       // wait for response
       BmDiscoverServicesResult response = await futureResponse
           .fbpEnsureAdapterIsOn("discoverServices")
           .fbpEnsureDeviceIsConnected(this, "discoverServices")
-          .fbpTimeout(timeout, "discoverServices");
+          .fbpTimeout(timeout, "discoverServices")
+          .fbpCancelOnTimeout(operationId);
 
       // failed?
       if (!response.success) {
@@ -275,11 +314,10 @@ class BluetoothDevice {
     if (FlutterBluePlus._connectionStates[remoteId] != null) {
       initialValue = _bmToConnectionState(FlutterBluePlus._connectionStates[remoteId]!.connectionState);
     }
-    return FlutterBluePlus._methodStream.stream
+    return FlutterBluePlus._deviceStream(remoteId)
         .where((m) => m.method == "OnConnectionStateChanged")
         .map((m) => m.arguments)
         .map((args) => BmConnectionStateResponse.fromMap(args))
-        .where((p) => p.remoteId == remoteId.str)
         .map((p) => _bmToConnectionState(p.connectionState))
         .newStreamWithInitialValue(initialValue);
   }
@@ -296,24 +334,31 @@ class BluetoothDevice {
   Stream<int> get mtu {
     // get initial value from our cache
     int initialValue = FlutterBluePlus._mtuValues[remoteId]?.mtu ?? 23;
-    return FlutterBluePlus._methodStream.stream
+    return FlutterBluePlus._deviceStream(remoteId)
         .where((m) => m.method == "OnMtuChanged")
         .map((m) => m.arguments)
         .map((args) => BmMtuChangedResponse.fromMap(args))
-        .where((p) => p.remoteId == remoteId.str)
         .map((p) => p.mtu)
         .newStreamWithInitialValue(initialValue);
   }
 
+  /// Emits whenever the connection interval, latency, timeout or phy changes (Windows only)
+  ///   - requires Windows 11
+  Stream<ConnectionParameters> get connectionParameters {
+    return FlutterBluePlus._deviceStream(remoteId)
+        .where((m) => m.method == "OnConnectionParametersChanged")
+        .map((m) => m.arguments)
+        .map((args) => ConnectionParameters._fromProto(BmConnectionParameters.fromMap(args)));
+  }
+
   /// Services Reset Stream
   ///  - uses the GAP Services Changed characteristic (0x2A05)
   ///  - you must re-call discoverServices()
   Stream<void> get onServicesReset {
-    return FlutterBluePlus._methodStream.stream
+    return FlutterBluePlus._deviceStream(remoteId)
         .where((m) => m.method == "OnServicesReset")
         .map((m) => m.arguments)
         .map((args) => BmBluetoothDevice.fromMap(args))
-        .where((p) => p.remoteId == remoteId.str)
         .map((m) => null);
   }
 
@@ -332,11 +377,10 @@ class BluetoothDevice {
     int rssi = 0;
 
     try {
-      var responseStream = FlutterBluePlus._methodStream.stream
+      var responseStream = FlutterBluePlus._deviceStream(remoteId)
           .where((m) => m.method == "OnReadRssi")
           .map((m) => m.arguments)
-          .map((args) => BmReadRssiResult.fromMap(args))
-          .where((p) => (p.remoteId == remoteId.str));
+          .map((args) => BmReadRssiResult.fromMap(args));
 
       // Start listening now, before invokeMethod, to ensure we don't miss the response
       Future<BmReadRssiResult> futureResponse = responseStream.first;
@@ -388,11 +432,10 @@ class BluetoothDevice {
         mtu: desiredMtu,
       );
 
-      var responseStream = FlutterBluePlus._methodStream.stream
+      var responseStream = FlutterBluePlus._deviceStream(remoteId)
           .where((m) => m.method == "OnMtuChanged")
           .map((m) => m.arguments)
           .map((args) => BmMtuChangedResponse.fromMap(args))
-          .where((p) => p.remoteId == remoteId.str)
           .map((p) => p.mtu);
 
       // Start listening now, before invokeMethod, to ensure we don't miss the response
@@ -413,12 +456,77 @@ class BluetoothDevice {
     return mtu;
   }
 
-  /// Request connection priority update (Android only)
+  /// Run several gatt operations in a single call
+  ///   - returns one result per operation, in the same order
+  ///   - a failed operation does not stop the others
+  ///   - on Windows the whole batch runs natively. Operations on the same characteristic
+  ///     run in order, operations on different characteristics run in parallel.
+  ///   - on other platforms the operations run one after another
+  ///   - [priority] the order operations are issued in, see [OperationPriority].
+  ///     On Windows the whole batch is one operation of the device's queue.
+  Future<List<BluetoothBatchResult>> performBatch(List<BluetoothBatchOperation> operations,
+      {int timeout = 30, OperationPriority priority = OperationPriority.interactive}) async {
+    // check connected
+    if (isConnected == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "performBatch", FbpErrorCode.deviceIsDisconnected.index, "device is not connected");
+    }
+
+    // no native batches
+    if (Platform.isWindows == false) {
+      List<BluetoothBatchResult> results = [];
+      for (var op in operations) {
+        results.add(await op._runAlone(timeout, priority));
+      }
+      return results;
+    }
+
+    // Windows queues the batch natively per device, as a single operation
+    var request = BmBatchRequest(
+      remoteId: remoteId.str,
+      operations: operations.map((o) => o._toBm()).toList(),
+      priority: priority.index,
+    );
+
+    // invoke, the response is the method result
+    var args = request.toMap();
+    int operationId = FlutterBluePlus._addDeadline(args, Duration(seconds: timeout));
+    BmBatchResponse response = await FlutterBluePlus._invokeMethodDeferred('performBatch', null, args)
+        .then((args) => BmBatchResponse.fromMap(args))
+        .fbpEnsureAdapterIsOn("performBatch")
+        .fbpEnsureDeviceIsConnected(this, "performBatch")
+        .fbpTimeout(timeout, "performBatch")
+        .fbpCancelOnTimeout(operationId);
+
+    List<BluetoothBatchResult> results = [];
+    for (int i = 0; i < operations.length; i++) {
+      var op = operations[i];
+      var r = response.results[i];
+
+      // update caches & streams, as if the operation was sent alone
+      await FlutterBluePlus._methodCallHandler(MethodCall(op._responseMethod, r));
+
+      results.add(BluetoothBatchResult._(
+        operation: op,
+        success: r['success'] != 0,
+        value: _hexDecode(r['value']),
+        errorCode: r['error_code'],
+        errorString: r['error_string'],
+      ));
+    }
+
+    return results;
+  }
+
+  /// Request connection priority update (Android & Windows)
+  ///   - Windows: [ConnectionPriority.high] is ThroughputOptimized, [ConnectionPriority.lowPower] is PowerOptimized.
+  ///     The request applies until the next one, or until disconnection.
+  ///     The parameters actually chosen are reported on [connectionParameters].
   Future<void> requestConnectionPriority({required ConnectionPriority connectionPriorityRequest}) async {
-    // check android
-    if (Platform.isAndroid == false) {
+    // check android & windows
+    if (Platform.isAndroid == false && Platform.isWindows == false) {
       throw FlutterBluePlusException(
-          ErrorPlatform.fbp, "requestConnectionPriority", FbpErrorCode.androidOnly.index, "android-only");
+          ErrorPlatform.fbp, "requestConnectionPriority", FbpErrorCode.androidAndWindowsOnly.index, "android & windows only");
     }
 
     // check connected
@@ -441,6 +549,7 @@ class BluetoothDevice {
   ///   - [txPhy] bitwise OR of all allowed phys for Rx, e.g. (Phy.le2m.mask | Phy.leCoded.mask)
   ///   - [option] preferred coding to use when transmitting on Phy.leCoded
   /// Please note that this is just a recommendation given to the system.
+  /// Windows always picks the phy itself, the phy in use is reported on [connectionParameters].
   Future<void> setPreferredPhy({
     required int txPhy,
     required int rxPhy,
@@ -469,6 +578,25 @@ class BluetoothDevice {
     await FlutterBluePlus._invokeMethod('setPreferredPhy', request.toMap());
   }
 
+  /// The connection interval, latency, timeout & phy in use (Windows only)
+  ///   - requires Windows 11
+  Future<ConnectionParameters> getConnectionParameters() async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "getConnectionParameters", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    // check connected
+    if (isConnected == false) {
+      throw FlutterBluePlusException(ErrorPlatform.fbp, "getConnectionParameters",
+          FbpErrorCode.deviceIsDisconnected.index, "device is not connected");
+    }
+
+    return await FlutterBluePlus._invokeMethod('getConnectionParameters', remoteId.str)
+        .then((args) => ConnectionParameters._fromProto(BmConnectionParameters.fromMap(args)));
+  }
+
   /// Force the bonding popup to show now (Android Only)
   /// Note! calling this is usually not necessary!! The platform does it automatically.
   Future<void> createBond({int timeout = 90}) async {
@@ -488,11 +616,10 @@ class BluetoothDevice {
     await mtx.take();
 
     try {
-      var responseStream = FlutterBluePlus._methodStream.stream
+      var responseStream = FlutterBluePlus._deviceStream(remoteId)
           .where((m) => m.method == "OnBondStateChanged")
           .map((m) => m.arguments)
           .map((args) => BmBondStateResponse.fromMap(args))
-          .where((p) => p.remoteId == remoteId.str)
           .where((p) => p.bondState != BmBondStateEnum.bonding);
 
       // Start listening now, before invokeMethod, to ensure we don't miss the response
@@ -531,11 +658,10 @@ class BluetoothDevice {
     await mtx.take();
 
     try {
-      var responseStream = FlutterBluePlus._methodStream.stream
+      var responseStream = FlutterBluePlus._deviceStream(remoteId)
           .where((m) => m.method == "OnBondStateChanged")
           .map((m) => m.arguments)
           .map((args) => BmBondStateResponse.fromMap(args))
-          .where((p) => p.remoteId == remoteId.str)
           .where((p) => p.bondState != BmBondStateEnum.bonding);
 
       // Start listening now, before invokeMethod, to ensure we don't miss the response
@@ -591,21 +717,19 @@ class BluetoothDevice {
     if (FlutterBluePlus._bondStates[remoteId] != null) {
       // we prefer to use the cached bond state, if available
       BluetoothBondState initialValue = _bmToBondState(FlutterBluePlus._bondStates[remoteId]!.bondState);
-      yield* FlutterBluePlus._methodStream.stream
+      yield* FlutterBluePlus._deviceStream(remoteId)
           .where((m) => m.method == "OnBondStateChanged")
           .map((m) => m.arguments)
           .map((args) => BmBondStateResponse.fromMap(args))
-          .where((p) => p.remoteId == remoteId.str)
           .map((p) => _bmToBondState(p.bondState))
           .newStreamWithInitialValue(initialValue);
     } else {
       // start listening now so we do not miss any changes
       // while we are getting the inital bond state
-      var buffer = _BufferStream.listen(FlutterBluePlus._methodStream.stream
+      var buffer = _BufferStream.listen(FlutterBluePlus._deviceStream(remoteId)
           .where((m) => m.method == "OnBondStateChanged")
           .map((m) => m.arguments)
           .map((args) => BmBondStateResponse.fromMap(args))
-          .where((p) => p.remoteId == remoteId.str)
           .map((p) => _bmToBondState(p.bondState)));
 
       // must get the initial state from the system.
@@ -684,3 +808,152 @@ class BluetoothDevice {
     yield [];
   }
 }
+
+/// An operation of [BluetoothDevice.performBatch]
+class BluetoothBatchOperation {
+  final BmBatchOperationType _type;
+  final BluetoothCharacteristic characteristic;
+  final List<int> value;
+  final bool withoutResponse;
+  final bool enable;
+
+  BluetoothBatchOperation.read(this.characteristic)
+      : _type = BmBatchOperationType.read,
+        value = const [],
+        withoutResponse = false,
+        enable = false;
+
+  BluetoothBatchOperation.write(this.characteristic, this.value, {this.withoutResponse = false})
+      : _type = BmBatchOperationType.write,
+        enable = false;
+
+  BluetoothBatchOperation.setNotifyValue(this.characteristic, this.enable)
+      : _type = BmBatchOperationType.setNotifyValue,
+        value = const [],
+        withoutResponse = false;
+
+  BmBatchOperation _toBm() {
+    return BmBatchOperation(
+      type: _type,
+      serviceUuid: characteristic.serviceUuid,
+      characteristicUuid: characteristic.characteristicUuid,
+      value: value,
+      writeType: withoutResponse ? BmWriteType.withoutResponse : BmWriteType.withResponse,
+      enable: enable,
+      channelId: characteristic._channelId,
+    );
+  }
+
+  // the event this operation sends when it is not batched
+  String get _responseMethod {
+    if (_type == BmBatchOperationType.read) {
+      return "OnCharacteristicReceived";
+    } else if (_type == BmBatchOperationType.write) {
+      return "OnCharacteristicWritten";
+    } else {
+      return "OnDescriptorWritten";
+    }
+  }
+
+  // run without batching, on platforms that do not support it
+  Future<BluetoothBatchResult> _runAlone(int timeout, OperationPriority priority) async {
+    List<int> out = [];
+    try {
+      switch (_type) {
+        case BmBatchOperationType.read:
+          out = await characteristic.read(timeout: timeout, priority: priority);
+          break;
+        case BmBatchOperationType.write:
+          await characteristic.write(value, withoutResponse: withoutResponse, timeout: timeout, priority: priority);
+          out = value;
+          break;
+        case BmBatchOperationType.setNotifyValue:
+          await characteristic.setNotifyValue(enable, timeout: timeout, priority: priority);
+          break;
+      }
+    } on FlutterBluePlusException catch (e) {
+      return BluetoothBatchResult._(
+          operation: this, success: false, value: [], errorCode: e.code ?? 0, errorString: e.description ?? "");
+    }
+    return BluetoothBatchResult._(operation: this, success: true, value: out, errorCode: 0, errorString: "success");
+  }
+}
+
+/// The result of a [BluetoothBatchOperation]
+class BluetoothBatchResult {
+  final BluetoothBatchOperation operation;
+  final bool success;
+
+  /// the value read or written
+  final List<int> value;
+
+  final int errorCode;
+  final String errorString;
+
+  BluetoothBatchResult._({
+    required this.operation,
+    required this.success,
+    required this.value,
+    required this.errorCode,
+    required this.errorString,
+  });
+
+  @override
+  String toString() {
+    return 'BluetoothBatchResult{'
+        'characteristic: ${operation.characteristic.characteristicUuid}, '
+        'success: $success, '
+        'value: $value, '
+        'errorCode: $errorCode, '
+        'errorString: $errorString'
+        '}';
+  }
+}
+
+/// How [BluetoothDevice.connect] reconnects on Windows after the link drops
+///   - the delay between attempts starts at [initialDelay], and doubles up to [maxDelay]
+///   - after [maxAttempts] failed attempts the device is disconnected
+class WindowsReconnectPolicy {
+  final int maxAttempts;
+  final Duration initialDelay;
+  final Duration maxDelay;
+
+  const WindowsReconnectPolicy({
+    this.maxAttempts = 5,
+    this.initialDelay = const Duration(milliseconds: 50),
+    this.maxDelay = const Duration(seconds: 2),
+  });
+}
+
+/// The parameters of an established connection
+class ConnectionParameters {
+  /// time between two connection events
+  final Duration interval;
+
+  /// connection events the peripheral may skip
+  final int latency;
+
+  /// supervision timeout, after which the link is considered lost
+  final Duration linkTimeout;
+
+  final Phy txPhy;
+  final Phy rxPhy;
+
+  ConnectionParameters._fromProto(BmConnectionParameters p)
+      : interval = Duration(microseconds: p.connectionInterval * 1250),
+        latency = p.connectionLatency,
+        linkTimeout = Duration(milliseconds: p.linkTimeout * 10),
+        txPhy = Phy.values[p.txPhy],
+        rxPhy = Phy.values[p.rxPhy];
+
+  @override
+  String toString() {
+    return 'ConnectionParameters{'
+        'interval: $interval, '
+        'latency: $latency, '
+        'linkTimeout: $linkTimeout, '
+        'txPhy: $txPhy, '
+        'rxPhy: $rxPhy'
+        '}';
+  }
+}
@@ -67,6 +67,9 @@ class BmScanSettings {
   final int continuousDivisor;
   final int androidScanMode;
   final bool androidUsesFineLocation;
+  final int windowsScanMode;
+  final int windowsScanWindow;
+  final int windowsScanInterval;
 
   BmScanSettings({
     required this.withServices,
@@ -79,6 +82,9 @@ class BmScanSettings {
     required this.continuousDivisor,
     required this.androidScanMode,
     required this.androidUsesFineLocation,
+    required this.windowsScanMode,
+    required this.windowsScanWindow,
+    required this.windowsScanInterval,
   });
 
   Map<dynamic, dynamic> toMap() {
@@ -93,6 +99,9 @@ class BmScanSettings {
     data['continuous_divisor'] = continuousDivisor;
     data['android_scan_mode'] = androidScanMode;
     data['android_uses_fine_location'] = androidUsesFineLocation;
+    data['windows_scan_mode'] = windowsScanMode;
+    data['windows_scan_window'] = windowsScanWindow;
+    data['windows_scan_interval'] = windowsScanInterval;
     return data;
   }
 }
@@ -107,6 +116,7 @@ class BmScanAdvertisement {
   final Map<Guid, List<int>> serviceData;
   final List<Guid> serviceUuids;
   final int rssi;
+  final int? timestamp; // microseconds since epoch, when received (windows)
 
   BmScanAdvertisement({
     required this.remoteId,
@@ -118,6 +128,7 @@ class BmScanAdvertisement {
     required this.serviceData,
     required this.serviceUuids,
     required this.rssi,
+    this.timestamp,
   });
 
   factory BmScanAdvertisement.fromMap(Map<dynamic, dynamic> json) {
@@ -154,6 +165,7 @@ class BmScanAdvertisement {
       serviceData: serviceData,
       serviceUuids: serviceUuids,
       rssi: json['rssi'] != null ? json['rssi'] : 0,
+      timestamp: json['timestamp'],
     );
   }
 }
@@ -191,16 +203,74 @@ class BmScanResponse {
 class BmConnectRequest {
   String remoteId;
   bool autoConnect;
+  int windowsReconnectAttempts;
+  int windowsReconnectDelay; // milliseconds
+  int windowsReconnectMaxDelay; // milliseconds
 
   BmConnectRequest({
     required this.remoteId,
     required this.autoConnect,
+    this.windowsReconnectAttempts = 0,
+    this.windowsReconnectDelay = 0,
+    this.windowsReconnectMaxDelay = 0,
   });
 
   Map<dynamic, dynamic> toMap() {
     final Map<dynamic, dynamic> data = {};
     data['remote_id'] = remoteId;
     data['auto_connect'] = autoConnect ? 1 : 0;
+    data['windows_reconnect_attempts'] = windowsReconnectAttempts;
+    data['windows_reconnect_delay'] = windowsReconnectDelay;
+    data['windows_reconnect_max_delay'] = windowsReconnectMaxDelay;
+    return data;
+  }
+}
+
+class BmAutoConnectRequest {
+  List<String> remoteIds;
+  List<Guid> withServices;
+  int windowsReconnectAttempts;
+  int windowsReconnectDelay; // milliseconds
+  int windowsReconnectMaxDelay; // milliseconds
+
+  BmAutoConnectRequest({
+    required this.remoteIds,
+    required this.withServices,
+    this.windowsReconnectAttempts = 0,
+    this.windowsReconnectDelay = 0,
+    this.windowsReconnectMaxDelay = 0,
+  });
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['remote_ids'] = remoteIds;
+    data['service_uuids'] = withServices.map((s) => s.str128).toList();
+    data['windows_reconnect_attempts'] = windowsReconnectAttempts;
+    data['windows_reconnect_delay'] = windowsReconnectDelay;
+    data['windows_reconnect_max_delay'] = windowsReconnectMaxDelay;
+    return data;
+  }
+}
+
+class BmFlowControlRequest {
+  int stream;
+  int policy;
+  int credits;
+  int backlog;
+
+  BmFlowControlRequest({
+    required this.stream,
+    required this.policy,
+    required this.credits,
+    required this.backlog,
+  });
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['stream'] = stream;
+    data['policy'] = policy;
+    data['credits'] = credits;
+    data['backlog'] = backlog;
     return data;
   }
 }
@@ -297,6 +367,7 @@ class BmBluetoothCharacteristic {
   final Guid? secondaryServiceUuid;
   final Guid characteristicUuid;
   List<BmBluetoothDescriptor> descriptors;
+  bool descriptorsPending; // windows: discovered lazily, see discoverDescriptors
   BmCharacteristicProperties properties;
 
   BmBluetoothCharacteristic({
@@ -305,6 +376,7 @@ class BmBluetoothCharacteristic {
     required this.secondaryServiceUuid,
     required this.characteristicUuid,
     required this.descriptors,
+    this.descriptorsPending = false,
     required this.properties,
   });
 
@@ -321,6 +393,7 @@ class BmBluetoothCharacteristic {
       secondaryServiceUuid: json['secondary_service_uuid'] != null ? Guid(json['secondary_service_uuid']) : null,
       characteristicUuid: Guid(json['characteristic_uuid']),
       descriptors: descs,
+      descriptorsPending: json['descriptors_pending'] == true,
       properties: BmCharacteristicProperties.fromMap(json['properties']),
     );
   }
@@ -418,17 +491,61 @@ class BmDiscoverServicesResult {
   }
 }
 
+class BmDiscoverServicesRequest {
+  final String remoteId;
+  final List<Guid> withServices;
+  final bool lazyDescriptors;
+
+  BmDiscoverServicesRequest({
+    required this.remoteId,
+    required this.withServices,
+    required this.lazyDescriptors,
+  });
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['remote_id'] = remoteId;
+    data['service_uuids'] = withServices.map((s) => s.str128).toList();
+    data['lazy_descriptors'] = lazyDescriptors;
+    return data;
+  }
+}
+
+class BmDiscoverDescriptorsRequest {
+  final String remoteId;
+  final Guid serviceUuid;
+  final Guid characteristicUuid;
+
+  BmDiscoverDescriptorsRequest({
+    required this.remoteId,
+    required this.serviceUuid,
+    required this.characteristicUuid,
+  });
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['remote_id'] = remoteId;
+    data['service_uuid'] = serviceUuid.str;
+    data['characteristic_uuid'] = characteristicUuid.str;
+    return data;
+  }
+}
+
 class BmReadCharacteristicRequest {
   final String remoteId;
   final Guid serviceUuid;
   final Guid? secondaryServiceUuid;
   final Guid characteristicUuid;
+  final int? maxAge; // milliseconds
+  final int priority;
 
   BmReadCharacteristicRequest({
     required this.remoteId,
     required this.serviceUuid,
     this.secondaryServiceUuid,
     required this.characteristicUuid,
+    this.maxAge,
+    this.priority = 1,
   });
 
   Map<dynamic, dynamic> toMap() {
@@ -437,6 +554,60 @@ class BmReadCharacteristicRequest {
     data['service_uuid'] = serviceUuid.str;
     data['secondary_service_uuid'] = secondaryServiceUuid?.str;
     data['characteristic_uuid'] = characteristicUuid.str;
+    data['max_age'] = maxAge;
+    data['priority'] = priority;
+    return data;
+  }
+}
+
+class BmStartPollingRequest {
+  final String remoteId;
+  final Guid serviceUuid;
+  final Guid characteristicUuid;
+  final int interval; // milliseconds
+  final int jitter; // milliseconds
+  final bool onlyOnChange;
+  final int? channelId;
+
+  BmStartPollingRequest({
+    required this.remoteId,
+    required this.serviceUuid,
+    required this.characteristicUuid,
+    required this.interval,
+    required this.jitter,
+    required this.onlyOnChange,
+    this.channelId,
+  });
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['remote_id'] = remoteId;
+    data['service_uuid'] = serviceUuid.str;
+    data['characteristic_uuid'] = characteristicUuid.str;
+    data['interval'] = interval;
+    data['jitter'] = jitter;
+    data['only_on_change'] = onlyOnChange;
+    data['channel_id'] = channelId;
+    return data;
+  }
+}
+
+class BmStopPollingRequest {
+  final String remoteId;
+  final Guid serviceUuid;
+  final Guid characteristicUuid;
+
+  BmStopPollingRequest({
+    required this.remoteId,
+    required this.serviceUuid,
+    required this.characteristicUuid,
+  });
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['remote_id'] = remoteId;
+    data['service_uuid'] = serviceUuid.str;
+    data['characteristic_uuid'] = characteristicUuid.str;
     return data;
   }
 }
@@ -450,6 +621,8 @@ class BmCharacteristicData {
   final bool success;
   final int errorCode;
   final String errorString;
+  final List<num>? decoded; // Float32List or Int32List, see PayloadLayout
+  final int? timestamp; // monotonic microseconds, when received (windows)
 
   BmCharacteristicData({
     required this.remoteId,
@@ -460,6 +633,8 @@ class BmCharacteristicData {
     required this.success,
     required this.errorCode,
     required this.errorString,
+    this.decoded,
+    this.timestamp,
   });
 
   factory BmCharacteristicData.fromMap(Map<dynamic, dynamic> json) {
@@ -472,6 +647,8 @@ class BmCharacteristicData {
       success: json['success'] != 0,
       errorCode: json['error_code'],
       errorString: json['error_string'],
+      decoded: json['decoded'],
+      timestamp: json['timestamp'],
     );
   }
 }
@@ -515,6 +692,7 @@ class BmWriteCharacteristicRequest {
   final BmWriteType writeType;
   final bool allowLongWrite;
   final List<int> value;
+  final int priority;
 
   BmWriteCharacteristicRequest({
     required this.remoteId,
@@ -524,6 +702,7 @@ class BmWriteCharacteristicRequest {
     required this.writeType,
     required this.allowLongWrite,
     required this.value,
+    this.priority = 1,
   });
 
   Map<dynamic, dynamic> toMap() {
@@ -535,6 +714,7 @@ class BmWriteCharacteristicRequest {
     data['write_type'] = writeType.index;
     data['allow_long_write'] = allowLongWrite ? 1 : 0;
     data['value'] = _hexEncode(value);
+    data['priority'] = priority;
     return data;
   }
 }
@@ -613,6 +793,10 @@ class BmSetNotifyValueRequest {
   final Guid characteristicUuid;
   final bool forceIndications;
   final bool enable;
+  final int? channelId;
+  final PayloadLayout? payloadLayout;
+  final int? nativePort;
+  final int priority;
 
   BmSetNotifyValueRequest({
     required this.remoteId,
@@ -621,6 +805,10 @@ class BmSetNotifyValueRequest {
     required this.characteristicUuid,
     required this.forceIndications,
     required this.enable,
+    this.channelId,
+    this.payloadLayout,
+    this.nativePort,
+    this.priority = 1,
   });
 
   Map<dynamic, dynamic> toMap() {
@@ -631,6 +819,10 @@ class BmSetNotifyValueRequest {
     data['characteristic_uuid'] = characteristicUuid.str;
     data['force_indications'] = forceIndications;
     data['enable'] = enable;
+    data['channel_id'] = channelId;
+    data['payload_layout'] = payloadLayout?.toMap();
+    data['native_port'] = nativePort;
+    data['priority'] = priority;
     return data;
   }
 }
@@ -799,6 +991,35 @@ class BmPreferredPhy {
   }
 }
 
+class BmConnectionParameters {
+  final String remoteId;
+  final int connectionInterval; // 1.25 ms units
+  final int connectionLatency; // connection events
+  final int linkTimeout; // 10 ms units
+  final int txPhy; // Phy index
+  final int rxPhy; // Phy index
+
+  BmConnectionParameters({
+    required this.remoteId,
+    required this.connectionInterval,
+    required this.connectionLatency,
+    required this.linkTimeout,
+    required this.txPhy,
+    required this.rxPhy,
+  });
+
+  factory BmConnectionParameters.fromMap(Map<dynamic, dynamic> json) {
+    return BmConnectionParameters(
+      remoteId: json['remote_id'],
+      connectionInterval: json['connection_interval'],
+      connectionLatency: json['connection_latency'],
+      linkTimeout: json['link_timeout'],
+      txPhy: json['tx_phy'],
+      rxPhy: json['rx_phy'],
+    );
+  }
+}
+
 enum BmBondStateEnum {
   none, // 0
   bonding, // 1
@@ -839,3 +1060,81 @@ class BmTurnOnResponse {
     );
   }
 }
+
+enum BmBatchOperationType {
+  read,
+  write,
+  setNotifyValue,
+}
+
+class BmBatchOperation {
+  final BmBatchOperationType type;
+  final Guid serviceUuid;
+  final Guid characteristicUuid;
+  final List<int> value;
+  final BmWriteType writeType;
+  final bool enable;
+  final int? channelId;
+
+  BmBatchOperation({
+    required this.type,
+    required this.serviceUuid,
+    required this.characteristicUuid,
+    this.value = const [],
+    this.writeType = BmWriteType.withResponse,
+    this.enable = false,
+    this.channelId,
+  });
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['type'] = type.index;
+    data['service_uuid'] = serviceUuid.str;
+    data['characteristic_uuid'] = characteristicUuid.str;
+    data['value'] = _hexEncode(value);
+    data['write_type'] = writeType.index;
+    data['enable'] = enable;
+    data['channel_id'] = channelId;
+    return data;
+  }
+}
+
+class BmBatchRequest {
+  final String remoteId;
+  final List<BmBatchOperation> operations;
+  final int priority;
+
+  BmBatchRequest({
+    required this.remoteId,
+    required this.operations,
+    this.priority = 1,
+  });
+
+  Map<dynamic, dynamic> toMap() {
+    final Map<dynamic, dynamic> data = {};
+    data['remote_id'] = remoteId;
+    data['operations'] = operations.map((o) => o.toMap()).toList();
+    data['priority'] = priority;
+    return data;
+  }
+}
+
+class BmBatchResponse {
+  final String remoteId;
+
+  // one per operation, in the same format as the event the operation
+  // would have sent on its own: BmCharacteristicData or BmDescriptorData
+  final List<Map<dynamic, dynamic>> results;
+
+  BmBatchResponse({
+    required this.remoteId,
+    required this.results,
+  });
+
+  factory BmBatchResponse.fromMap(Map<dynamic, dynamic> json) {
+    return BmBatchResponse(
+      remoteId: json['remote_id'],
+      results: (json['results'] as List<dynamic>).map((r) => r as Map<dynamic, dynamic>).toList(),
+    );
+  }
+}
@@ -29,6 +29,18 @@ class FlutterBluePlus {
   static final Map<DeviceIdentifier, Map<String, List<int>>> _lastDescs = {};
   static final Map<DeviceIdentifier, List<StreamSubscription>> _subscriptions = {};
 
+  /// per-device & per-characteristic event routing
+  ///   - each event is only delivered to the listeners of its own device or characteristic,
+  ///     instead of every listener filtering every event
+  // ignore: close_sinks
+  static final Map<DeviceIdentifier, StreamController<MethodCall>> _deviceEvents = {};
+  // ignore: close_sinks
+  static final Map<int, StreamController<MethodCall>> _chrEvents = {};
+  static final Map<String, int> _chrChannelIds = {};
+
+  /// reads in flight, by characteristic routing id. Concurrent reads share them.
+  static final Map<int, Future<List<int>>> _inflightReads = {};
+
   /// stream used for the isScanning public api
   static final _isScanning = _StreamControllerReEmit<bool>(initialValue: false);
 
@@ -44,6 +56,14 @@ class FlutterBluePlus {
   /// the last known adapter state
   static BmAdapterStateEnum? _adapterStateNow;
 
+  /// notifications aligned in time across devices, see [setAlignment]
+  // ignore: close_sinks
+  static final StreamController<List<TimestampedValue>> _alignedBatches = StreamController.broadcast();
+
+  /// flow control: the credit window of each stream, and the events handled since the last grant
+  static final Map<int, int> _flowWindows = {};
+  static final Map<int, int> _flowProcessed = {};
+
   /// FlutterBluePlus log level
   static LogLevel _logLevel = LogLevel.debug;
   static bool _logColor = true;
@@ -172,7 +192,8 @@ class FlutterBluePlus {
     return response.devices.map((d) => BluetoothDevice.fromProto(d)).toList();
   }
 
-  /// Retrieve a list of bonded devices (Android only)
+  /// Retrieve a list of bonded devices (Android & Windows)
+  ///   - Windows: paired devices are enumerated on the first call, then kept current natively
   static Future<List<BluetoothDevice>> get bondedDevices async {
     BmDevicesList response = await _invokeMethod('getBondedDevices').then((args) => BmDevicesList.fromMap(args));
     for (BmBluetoothDevice device in response.devices) {
@@ -183,6 +204,35 @@ class FlutterBluePlus {
     return response.devices.map((d) => BluetoothDevice.fromProto(d)).toList();
   }
 
+  /// Connect to devices natively, as soon as they are seen while scanning (Windows only)
+  ///   - [remoteIds] connect to these devices
+  ///   - [withServices] connect to any device advertising one of these services
+  ///   - [windowsReconnect] reconnect natively whenever the link drops, as in [BluetoothDevice.connect]
+  /// Matching happens in the native advertisement callback, so the connection starts
+  /// without a round trip through dart. A scan must be running, see [startScan].
+  /// Connections are reported on [BluetoothDevice.connectionState]. Pass empty lists to stop.
+  static Future<void> setAutoConnect({
+    List<DeviceIdentifier> remoteIds = const [],
+    List<Guid> withServices = const [],
+    WindowsReconnectPolicy? windowsReconnect,
+  }) async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "setAutoConnect", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    var request = BmAutoConnectRequest(
+      remoteIds: remoteIds.map((r) => r.str).toList(),
+      withServices: withServices,
+      windowsReconnectAttempts: windowsReconnect?.maxAttempts ?? 0,
+      windowsReconnectDelay: windowsReconnect?.initialDelay.inMilliseconds ?? 0,
+      windowsReconnectMaxDelay: windowsReconnect?.maxDelay.inMilliseconds ?? 0,
+    );
+
+    await _invokeMethod('setAutoConnect', request.toMap());
+  }
+
   /// Start a scan, and return a stream of results
   ///   - [withServices] filter by advertised services
   ///   - [withRemoteIds] filter for known remoteIds (iOS: 128-bit guid, android: 48-bit mac address)
@@ -201,6 +251,11 @@ class FlutterBluePlus {
   ///          If false, we deduplicate the advertisements, and return a list of devices.
   ///   - [androidScanMode] choose the android scan mode to use when scanning
   ///   - [androidUsesFineLocation] request ACCESS_FINE_LOCATION permission at runtime
+  ///   - [windowsScanMode] choose the windows scan mode. Passive scanning does not send scan requests,
+  ///          so scan response data (often the device name) is not received, but it uses less radio & cpu.
+  ///          In active mode, scan responses are merged into the device's next advertisement.
+  ///   - [windowsScanWindow] & [windowsScanInterval] (windows only) duty cycle the scan. The watcher runs
+  ///          for [windowsScanWindow] out of every [windowsScanInterval]. If null, we scan continuously.
   static Future<void> startScan({
     List<Guid> withServices = const [],
     List<String> withRemoteIds = const [],
@@ -215,9 +270,14 @@ class FlutterBluePlus {
     bool oneByOne = false,
     AndroidScanMode androidScanMode = AndroidScanMode.lowLatency,
     bool androidUsesFineLocation = false,
+    WindowsScanMode windowsScanMode = WindowsScanMode.active,
+    Duration? windowsScanWindow,
+    Duration? windowsScanInterval,
   }) async {
     // check args
     assert(removeIfGone == null || continuousUpdates, "removeIfGone requires continuousUpdates");
+    assert((windowsScanWindow == null) == (windowsScanInterval == null), "windowsScanWindow requires windowsScanInterval");
+    assert(windowsScanWindow == null || windowsScanWindow < windowsScanInterval!, "window must be < interval");
     assert(removeIfGone == null || !oneByOne, "removeIfGone is not compatible with oneByOne");
     assert(continuousDivisor >= 1, "divisor must be >= 1");
 
@@ -240,7 +300,10 @@ class FlutterBluePlus {
         continuousUpdates: continuousUpdates,
         continuousDivisor: continuousDivisor,
         androidScanMode: androidScanMode.value,
-        androidUsesFineLocation: androidUsesFineLocation);
+        androidUsesFineLocation: androidUsesFineLocation,
+        windowsScanMode: windowsScanMode.value,
+        windowsScanWindow: windowsScanWindow?.inMilliseconds ?? 0,
+        windowsScanInterval: windowsScanInterval?.inMilliseconds ?? 0);
 
     Stream<BmScanResponse> responseStream = FlutterBluePlus._methodStream.stream
         .where((m) => m.method == "OnScanResponse")
@@ -338,6 +401,140 @@ class FlutterBluePlus {
     await _invokeMethod('setLogLevel', level.index);
   }
 
+  /// The most recent native trace events, oldest first (Windows only)
+  ///   - the plugin records them into a fixed size in-memory ring, whatever the log level,
+  ///     so they are cheap enough to leave on in production
+  static Future<List<NativeTraceEvent>> getNativeTrace() async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "getNativeTrace", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    Map<dynamic, dynamic> out = await _invokeMethod('getNativeTrace');
+    int recordSize = out['record_size'];
+    Uint8List records = out['records'];
+
+    // int64 timestamp (ns), uint32 event, uint32 thread, uint64 arg0, uint64 arg1
+    ByteData data = ByteData.sublistView(records);
+    List<NativeTraceEvent> events = [];
+    for (int offset = 0; offset + recordSize <= records.length; offset += recordSize) {
+      events.add(NativeTraceEvent._(
+        timestamp: Duration(microseconds: data.getInt64(offset, Endian.little) ~/ 1000),
+        event: data.getUint32(offset + 8, Endian.little),
+        arg0: data.getUint64(offset + 16, Endian.little),
+        arg1: data.getUint64(offset + 24, Endian.little),
+      ));
+    }
+    return events;
+  }
+
+  /// Record a span for every native operation & callback (Windows only)
+  ///   - e.g. method call dispatch, each awaited WinRT call, watcher & notification callbacks
+  ///   - export them with [getNativeTraceJson]
+  static Future<void> setNativeTracing(bool enabled) async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "setNativeTracing", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    await _invokeMethod('setNativeTracing', enabled);
+  }
+
+  /// The native trace, as Chrome trace event JSON (Windows only)
+  ///   - open it in chrome://tracing or ui.perfetto.dev
+  ///   - timestamps are in microseconds of the monotonic clock also used by the flutter timeline
+  static Future<String> getNativeTraceJson() async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "getNativeTraceJson", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    return await _invokeMethod('getNativeTraceJson');
+  }
+
+  /// Live counters of the native resources the plugin holds (Windows only)
+  ///   - connected_devices, open_devices, devices_opened, devices_closed
+  ///   - open_services, cached_characteristics, subscriptions
+  ///   - pending_operations, pending_reads
+  ///   - cached_value_bytes, write_buffer_bytes, trace_bytes
+  ///   - alignment_buffered, alignment_capacity, see [setAlignment]
+  /// On a long running session, open_devices should stay equal to connected_devices.
+  static Future<Map<String, int>> getNativeStats() async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "getNativeStats", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    Map<dynamic, dynamic> out = await _invokeMethod('getNativeStats');
+    return out.map((key, value) => MapEntry(key as String, value as int));
+  }
+
+  /// Limit how fast native events are pushed to dart (Windows only)
+  ///   - [stream] the notifications of all characteristics, or the scan results
+  ///   - [policy] what the native side does with events while dart has no credits left
+  ///   - [credits] how many events may be in flight. FBP grants more as it handles them.
+  ///   - [backlog] how many events [FlowPolicy.dropOldest], [FlowPolicy.conflate] & [FlowPolicy.block] keep natively
+  /// Dropped & conflated events are counted in [getNativeStats], e.g. notify_dropped, scan_conflated.
+  /// The responses to [BluetoothCharacteristic.read] are never flow controlled.
+  static Future<void> setFlowControl(FlowStream stream, FlowPolicy policy, {int credits = 64, int backlog = 256}) async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "setFlowControl", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    var request = BmFlowControlRequest(
+      stream: stream.index,
+      policy: policy.index,
+      credits: credits,
+      backlog: backlog,
+    );
+
+    _flowWindows[stream.index] = credits;
+    _flowProcessed[stream.index] = 0;
+
+    await _invokeMethod('setFlowControl', request.toMap());
+  }
+
+  /// Deliver the notifications of all devices in the order they were received (Windows only)
+  ///   - the native side holds each notification back for [window], then sends those that
+  ///     are due as one batch, sorted by their native timestamp
+  ///   - so notifications of different devices that arrive up to [window] late are still in order
+  ///   - each batch is emitted on [alignedBatches], and each of its notifications as usual,
+  ///     e.g. on [BluetoothCharacteristic.onValueReceived]
+  ///   - [Duration.zero] turns alignment off, and sends what is held back
+  ///   - [capacity] how many notifications are held back at most. A full buffer drops its oldest.
+  /// Each batch spends one credit of [FlowStream.notifications], see [setFlowControl].
+  /// [getNativeStats] reports alignment_buffered & alignment_capacity, drops count as notify_dropped.
+  static Future<void> setAlignment(Duration window, {int capacity = 4096}) async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "setAlignment", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    await _invokeMethod('setAlignment', {'window': window.inMilliseconds, 'capacity': capacity});
+  }
+
+  /// the batches of notifications sorted by timestamp, see [setAlignment]
+  static Stream<List<TimestampedValue>> get alignedBatches => _alignedBatches.stream;
+
+  /// What the bluetooth adapter supports (Windows only)
+  ///   - read once, when the plugin starts
+  static Future<AdapterCapabilities> getAdapterCapabilities() async {
+    // check windows
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(
+          ErrorPlatform.fbp, "getAdapterCapabilities", FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+
+    return await _invokeMethod('getAdapterCapabilities').then((args) => AdapterCapabilities.fromMap(args));
+  }
+
   /// Request Bluetooth PHY support
   static Future<PhySupport> getPhySupport() async {
     // check android
@@ -349,6 +546,21 @@ class FlutterBluePlus {
     return await _invokeMethod('getPhySupport').then((args) => PhySupport.fromMap(args));
   }
 
+  /// lets the windows plugin post to SendPorts, see [BluetoothCharacteristic.setNotifyValue]
+  static bool _dartApiInitialized = false;
+  static void _initDartApiDL() {
+    if (_dartApiInitialized) {
+      return;
+    }
+    var init = _windowsPlugin.lookupFunction<ffi.IntPtr Function(ffi.Pointer<ffi.Void>), int Function(ffi.Pointer<ffi.Void>)>(
+        'FlutterBluePlusInitDartApiDL');
+    if (init(ffi.NativeApi.initializeApiDLData) != 0) {
+      throw FlutterBluePlusException(ErrorPlatform.fbp, "setNotifyValue", FbpErrorCode.nativePortUnavailable.index,
+          "the plugin was built without dart_api_dl");
+    }
+    _dartApiInitialized = true;
+  }
+
   static Future<dynamic> _initFlutterBluePlus() async {
     if (_initialized) {
       return;
@@ -360,6 +572,7 @@ class FlutterBluePlus {
     _methods.setMethodCallHandler(_methodCallHandler);
 
     // hot restart
+    //   - also turns off flow control natively
     if ((await _methods.invokeMethod('flutterHotRestart')) != 0) {
       await Future.delayed(Duration(milliseconds: 50));
       while ((await _methods.invokeMethod('connectedCount')) != 0) {
@@ -378,6 +591,20 @@ class FlutterBluePlus {
       print("[FBP] $func result: $result");
     }
 
+    // aligned notifications: handle each in time order, then the batch
+    if (call.method == "OnCharacteristicBatch") {
+      List<TimestampedValue> batch = [];
+      for (var event in call.arguments['events']) {
+        await _methodCallHandler(MethodCall("OnCharacteristicReceived", event));
+        batch.add(TimestampedValue._fromProto(BmCharacteristicData.fromMap(event)));
+      }
+      _alignedBatches.add(batch);
+      if (call.arguments['flow_stream'] != null) {
+        _grantCredits(call.arguments['flow_stream']);
+      }
+      return;
+    }
+
     // android only
     if (call.method == "OnDetachedFromEngine") {
       _stopScan(invokePlatform: false);
@@ -397,7 +624,9 @@ class FlutterBluePlus {
       BmConnectionStateResponse r = BmConnectionStateResponse.fromMap(call.arguments);
       var remoteId = DeviceIdentifier(r.remoteId);
       _connectionStates[remoteId] = r;
-      if (r.connectionState == BmConnectionStateEnum.disconnected) {
+      // while windows reconnects natively, subscriptions & caches stay valid
+      bool reconnecting = call.arguments['reconnecting'] == true;
+      if (r.connectionState == BmConnectionStateEnum.disconnected && reconnecting == false) {
         // cancel subscriptions
         _subscriptions[remoteId]?.forEach((s) => s.cancel());
         _subscriptions.remove(remoteId);
@@ -438,6 +667,12 @@ class FlutterBluePlus {
     if (call.method == "OnDiscoveredServices") {
       BmDiscoverServicesResult r = BmDiscoverServicesResult.fromMap(call.arguments);
       if (r.success == true) {
+        // a targeted discovery only has some services, keep the others
+        var known = _knownServices[DeviceIdentifier(r.remoteId)];
+        if (call.arguments['partial'] == true && known != null) {
+          var uuids = r.services.map((s) => s.serviceUuid).toSet();
+          r.services.insertAll(0, known.services.where((s) => uuids.contains(s.serviceUuid) == false));
+        }
         _knownServices[DeviceIdentifier(r.remoteId)] = r;
       }
     }
@@ -453,11 +688,15 @@ class FlutterBluePlus {
     // keep track of characteristic values
     if (call.method == "OnCharacteristicReceived" || call.method == "OnCharacteristicWritten") {
       BmCharacteristicData r = BmCharacteristicData.fromMap(call.arguments);
+      DeviceIdentifier d = DeviceIdentifier(r.remoteId);
       if (r.success == true) {
-        DeviceIdentifier d = DeviceIdentifier(r.remoteId);
         _lastChrs[d] ??= {};
-        _lastChrs[DeviceIdentifier(r.remoteId)]!["${r.serviceUuid}:${r.characteristicUuid}"] = r.value;
+        _lastChrs[d]!["${r.serviceUuid}:${r.characteristicUuid}"] = r.value;
       }
+      // route to the characteristic's listeners. Notifications are tagged
+      // with the channel id we gave the platform in setNotifyValue.
+      int channelId = call.arguments['channel_id'] ?? _chrChannelId(d, r.serviceUuid, r.characteristicUuid);
+      _chrEvents[channelId]?.add(MethodCall(call.method, r));
     }
 
     // keep track of descriptor values
@@ -470,7 +709,48 @@ class FlutterBluePlus {
       }
     }
 
+    // route to the device's listeners
+    if (call.arguments is Map && call.arguments['remote_id'] != null) {
+      _deviceEvents[DeviceIdentifier(call.arguments['remote_id'])]?.add(call);
+    }
+
     _methodStream.add(call);
+
+    // give back credits once half the window is handled
+    if (call.arguments is Map && call.arguments['flow_stream'] != null) {
+      _grantCredits(call.arguments['flow_stream']);
+    }
+  }
+
+  /// flow control: an event of a flow controlled stream was handled
+  static void _grantCredits(int stream) {
+    int window = _flowWindows[stream] ?? 0;
+    int processed = (_flowProcessed[stream] ?? 0) + 1;
+    if (processed * 2 >= window) {
+      processed = 0;
+      _methods.invokeMethod('grantCredits', {'stream': stream, 'credits': window < 2 ? 1 : window ~/ 2});
+    }
+    _flowProcessed[stream] = processed;
+  }
+
+  /// the events of a single device
+  static Stream<MethodCall> _deviceStream(DeviceIdentifier remoteId) {
+    _deviceEvents[remoteId] ??= StreamController.broadcast();
+    return _deviceEvents[remoteId]!.stream;
+  }
+
+  /// the routing id of a characteristic
+  /// ids are never reused, and [NativeSnapshot] only tracks the first 127
+  static int _chrChannelId(DeviceIdentifier remoteId, Guid serviceUuid, Guid characteristicUuid) {
+    String key = "${remoteId.str.toLowerCase()}:$serviceUuid:$characteristicUuid";
+    return _chrChannelIds.putIfAbsent(key, () => _chrChannelIds.length + 1);
+  }
+
+  /// OnCharacteristicReceived & OnCharacteristicWritten events of a single characteristic
+  ///   - the arguments are already decoded to BmCharacteristicData
+  static Stream<MethodCall> _chrStream(int channelId) {
+    _chrEvents[channelId] ??= StreamController.broadcast();
+    return _chrEvents[channelId]!.stream;
   }
 
   /// invoke a platform method
@@ -513,6 +793,77 @@ class FlutterBluePlus {
     return out;
   }
 
+  /// ids of native operations, so they can be canceled
+  static int _nextOperationId = 1;
+
+  /// give a native operation an id & a deadline, after which the platform cancels it.
+  ///   - returns the operation id, or 0 if the platform does not support canceling
+  static int _addDeadline(Map<dynamic, dynamic> arguments, Duration? timeout) {
+    if (Platform.isWindows == false) {
+      return 0;
+    }
+    int operationId = _nextOperationId++;
+    arguments['operation_id'] = operationId;
+    arguments['timeout'] = timeout != null ? timeout.inMilliseconds : 0;
+    return operationId;
+  }
+
+  /// cancel a native operation, releasing the platform resources it holds
+  static Future<void> _cancelOperation(int operationId) async {
+    if (operationId != 0) {
+      await _invokeMethod('cancelOperation', operationId);
+    }
+  }
+
+  /// Windows returns the response of gatt operations as the method result,
+  /// instead of as a separate event that we must find in `_methodStream`
+  static bool get _deferredResults => Platform.isWindows;
+
+  /// Windows queues reads, writes & setNotifyValue natively, per device & by priority,
+  /// instead of behind the "global" mutex
+  static bool get _nativeQueue => Platform.isWindows;
+
+  /// invoke a platform method, and wait for its deferred result
+  ///   - the result is also handled as a [responseMethod] event, so caches & streams stay up to date
+  static Future<dynamic> _invokeMethodDeferred(String method, String? responseMethod, Map<dynamic, dynamic> arguments) async {
+    arguments['deferred_result'] = true;
+
+    Future<dynamic> futureOut;
+
+    // we only hold the mutex while sending. Otherwise a slow gatt operation
+    // would block every other invocation (e.g. disconnect) until it completes.
+    _Mutex mtx = _MutexFactory.getMutexForKey("invokeMethod");
+    await mtx.take();
+
+    try {
+      // initialize
+      _initFlutterBluePlus();
+
+      // log args
+      if (logLevel == LogLevel.verbose) {
+        String func = '<$method>';
+        String args = arguments.toString();
+        func = _logColor ? _black(func) : func;
+        args = _logColor ? _magenta(args) : args;
+        print("[FBP] $func args: $args");
+      }
+
+      // invoke
+      futureOut = _methods.invokeMethod(method, arguments);
+    } finally {
+      mtx.give();
+    }
+
+    dynamic out = await futureOut;
+
+    // update caches & streams, as if the response was an event
+    if (responseMethod != null) {
+      await _methodCallHandler(MethodCall(responseMethod, out));
+    }
+
+    return out;
+  }
+
   /// Turn off Bluetooth (Android only),
   @Deprecated('Deprecated in Android SDK 33 with no replacement')
   static Future<void> turnOff({int timeout = 10}) async {
@@ -561,6 +912,31 @@ enum LogLevel {
   verbose, //5
 }
 
+/// The order gatt operations are issued in, see [BluetoothCharacteristic.write]
+///   - operations of the same priority keep their order
+///   - an operation in progress is never interrupted
+// keep in sync with OpPriority in flutter_blue_plus_plugin.cpp
+enum OperationPriority {
+  realtime, // 0: control commands, e.g. stopping a motor
+  interactive, // 1: default
+  bulk, // 2: log downloads, background reads
+}
+
+/// What the native side does with events while dart has no credits left
+enum FlowPolicy {
+  none, // 0: no flow control
+  dropOldest, // 1: keep the newest events, up to the backlog
+  dropNewest, // 2: drop events until dart grants credits
+  conflate, // 3: keep only the newest event of each characteristic / device
+  block, // 4: hold events until dart grants credits, dropping them after 1 second
+}
+
+/// The native event streams that support flow control
+enum FlowStream {
+  notifications, // 0: OnCharacteristicReceived & OnCharacteristicBatch
+  scanResults, // 1: OnScanResponse
+}
+
 class AndroidScanMode {
   const AndroidScanMode(this.value);
   static const lowPower = AndroidScanMode(0);
@@ -570,6 +946,59 @@ class AndroidScanMode {
   final int value;
 }
 
+class WindowsScanMode {
+  const WindowsScanMode(this.value);
+  static const passive = WindowsScanMode(0);
+  static const active = WindowsScanMode(1);
+  final int value;
+}
+
+// keep in sync with TraceEvent in flutter_blue_plus_plugin.cpp
+const List<String> _nativeTraceEventNames = [
+  "none",
+  "methodCall",
+  "connected",
+  "disconnected",
+  "reconnected",
+  "read",
+  "write",
+  "notify",
+  "poll",
+  "scanResult",
+  "canceled",
+  "span",
+];
+
+/// An event of [FlutterBluePlus.getNativeTrace]
+class NativeTraceEvent {
+  /// monotonic clock, with an arbitrary origin
+  final Duration timestamp;
+  final int event;
+
+  /// meaning depends on the event, usually the device address first
+  final int arg0;
+  final int arg1;
+
+  NativeTraceEvent._({
+    required this.timestamp,
+    required this.event,
+    required this.arg0,
+    required this.arg1,
+  });
+
+  String get name => event < _nativeTraceEventNames.length ? _nativeTraceEventNames[event] : "unknown";
+
+  @override
+  String toString() {
+    return 'NativeTraceEvent{'
+        'timestamp: $timestamp, '
+        'name: $name, '
+        'arg0: 0x${arg0.toRadixString(16)}, '
+        'arg1: 0x${arg1.toRadixString(16)}'
+        '}';
+  }
+}
+
 class MsdFilter {
   int manufacturerId;
 
@@ -644,7 +1073,7 @@ class ScanResult {
       : device = BluetoothDevice.fromId(p.remoteId),
         advertisementData = AdvertisementData.fromProto(p),
         rssi = p.rssi,
-        timeStamp = DateTime.now();
+        timeStamp = p.timestamp != null ? DateTime.fromMicrosecondsSinceEpoch(p.timestamp!) : DateTime.now();
 
   @override
   bool operator ==(Object other) =>
@@ -722,6 +1151,41 @@ class PhySupport {
   }
 }
 
+class AdapterCapabilities {
+  /// Bluetooth Low Energy
+  final bool lowEnergy;
+
+  /// Can connect to peripherals
+  final bool centralRole;
+
+  /// Can act as a peripheral
+  final bool peripheralRole;
+
+  /// Bluetooth 5 extended advertising
+  final bool extendedAdvertising;
+
+  /// Largest advertisement payload, in bytes (0 = unknown)
+  final int maxAdvertisementDataLength;
+
+  AdapterCapabilities({
+    required this.lowEnergy,
+    required this.centralRole,
+    required this.peripheralRole,
+    required this.extendedAdvertising,
+    required this.maxAdvertisementDataLength,
+  });
+
+  factory AdapterCapabilities.fromMap(Map<dynamic, dynamic> json) {
+    return AdapterCapabilities(
+      lowEnergy: json['low_energy'],
+      centralRole: json['central_role'],
+      peripheralRole: json['peripheral_role'],
+      extendedAdvertising: json['extended_advertising'],
+      maxAdvertisementDataLength: json['max_advertisement_data_length'],
+    );
+  }
+}
+
 enum ErrorPlatform {
   fbp,
   android,
@@ -748,7 +1212,11 @@ enum FbpErrorCode {
   characteristicNotFound,
   adapterIsOff,
   connectionCanceled,
-  userRejected
+  userRejected,
+  windowsOnly,
+  nativePortUnavailable,
+  androidAndWindowsOnly,
+  nativeSnapshotFull,
 }
 
 class FlutterBluePlusException implements Exception {
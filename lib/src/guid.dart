@@ -8,29 +8,56 @@ part of flutter_blue_plus;
 class Guid {
   final List<int> bytes;
 
-  Guid.empty() : bytes = List.filled(16, 0);
+  // the 128-bit uuid as two 64-bit halves, so == and hashCode are cheap.
+  // 16-bit & 32-bit uuids are expanded with the bluetooth base uuid.
+  final int _msb;
+  final int _lsb;
 
-  Guid.fromBytes(this.bytes) : assert(_checkLen(bytes.length), 'GUID must be 16, 32, or 128 bit.');
+  Guid.empty() : this.fromBytes(Uint8List(16));
 
-  Guid.fromString(String input) : bytes = _fromString(input);
+  Guid.fromBytes(this.bytes)
+      : assert(_checkLen(bytes.length), 'GUID must be 16, 32, or 128 bit.'),
+        _msb = _msbOf(bytes),
+        _lsb = _lsbOf(bytes);
 
-  Guid(String input) : bytes = _fromString(input);
+  Guid.fromString(String input) : this.fromBytes(_fromString(input));
+
+  Guid(String input) : this.fromBytes(_fromString(input));
+
+  // 0000xxxx-0000-1000-8000-00805f9b34fb
+  static const int _baseMsb = 0x1000;
+  static const int _baseLsb = -0x7fffff7fa064cb05; // 0x800000805f9b34fb
 
   static List<int> _fromString(String input) {
     if (input.isEmpty) {
-      return List.filled(16, 0);
+      return Uint8List(16);
     }
 
-    input = input.replaceAll('-', '');
+    // decode the hex digits, skipping dashes
+    Uint8List bytes = Uint8List(16);
+    int digits = 0;
+    for (int i = 0; i < input.length; i++) {
+      int c = input.codeUnitAt(i);
+      if (c == 0x2D) {
+        continue; // '-'
+      }
+      int d = _hexDigit(c);
+      if (d < 0) {
+        throw FormatException("GUID not hex format: $input");
+      }
+      if (digits < 32) {
+        bytes[digits >> 1] |= digits.isEven ? d << 4 : d;
+      }
+      digits++;
+    }
 
-    List<int>? bytes = _tryHexDecode(input);
-    if (bytes == null) {
+    if (digits.isOdd) {
       throw FormatException("GUID not hex format: $input");
     }
 
-    _checkLen(bytes.length);
+    _checkLen(digits ~/ 2);
 
-    return bytes;
+    return digits == 32 ? bytes : Uint8List.fromList(bytes.sublist(0, digits ~/ 2));
   }
 
   static bool _checkLen(int len) {
@@ -40,49 +67,52 @@ class Guid {
     return true;
   }
 
-  // 128-bit representation
-  String get str128 {
-    if (bytes.length == 2) {
-      // 16-bit uuid
-      return '0000${_hexEncode(bytes)}-0000-1000-8000-00805f9b34fb'.toLowerCase();
+  static int _int64(List<int> b, int offset) {
+    int v = 0;
+    for (int i = offset; i < offset + 8; i++) {
+      v = (v << 8) | (b[i] & 0xFF);
     }
-    if (bytes.length == 4) {
-      // 32-bit uuid
-      return '${_hexEncode(bytes)}-0000-1000-8000-00805f9b34fb'.toLowerCase();
-    }
-    // 128-bit uuid
-    String one = _hexEncode(bytes.sublist(0, 4));
-    String two = _hexEncode(bytes.sublist(4, 6));
-    String three = _hexEncode(bytes.sublist(6, 8));
-    String four = _hexEncode(bytes.sublist(8, 10));
-    String five = _hexEncode(bytes.sublist(10, 16));
-    return "$one-$two-$three-$four-$five".toLowerCase();
+    return v;
   }
 
-  // shortest representation
-  String get str {
-    bool starts = str128.startsWith('0000');
-    bool ends = str128.contains('-0000-1000-8000-00805f9b34fb');
-    if (starts && ends) {
-      // 16-bit
-      return str128.substring(4, 8);
+  static int _msbOf(List<int> b) {
+    if (b.length == 2) {
+      return ((b[0] & 0xFF) << 40) | ((b[1] & 0xFF) << 32) | _baseMsb;
     }
-    if (ends) {
-      // 32-bit
-      return str128.substring(0, 8);
+    if (b.length == 4) {
+      return ((b[0] & 0xFF) << 56) | ((b[1] & 0xFF) << 48) | ((b[2] & 0xFF) << 40) | ((b[3] & 0xFF) << 32) | _baseMsb;
     }
-    // 128-bit
-    return str128;
+    return _int64(b, 0);
+  }
+
+  static int _lsbOf(List<int> b) => b.length == 16 ? _int64(b, 8) : _baseLsb;
+
+  static String _hex(int v, int shift, int digits) {
+    int mask = (1 << (digits * 4)) - 1;
+    return ((v >> shift) & mask).toRadixString(16).padLeft(digits, '0');
   }
 
+  bool get _isBase => _lsb == _baseLsb && (_msb & 0xFFFFFFFF) == _baseMsb;
+
+  // 128-bit representation
+  late final String str128 = "${_hex(_msb, 32, 8)}-${_hex(_msb, 16, 4)}-${_hex(_msb, 0, 4)}-"
+      "${_hex(_lsb, 48, 4)}-${_hex(_lsb, 32, 4)}${_hex(_lsb, 0, 8)}";
+
+  // shortest representation
+  late final String str = !_isBase
+      ? str128 // 128-bit
+      : ((_msb >> 48) & 0xFFFF) == 0
+          ? _hex(_msb, 32, 4) // 16-bit
+          : _hex(_msb, 32, 8); // 32-bit
+
   @override
   String toString() => str;
 
   @override
-  operator ==(other) => other is Guid && hashCode == other.hashCode;
+  operator ==(other) => other is Guid && _msb == other._msb && _lsb == other._lsb;
 
   @override
-  int get hashCode => str128.hashCode;
+  int get hashCode => Object.hash(_msb, _lsb);
 
   @Deprecated('use str128 instead')
   String get uuid128 => str128;
@@ -0,0 +1,104 @@
+// Copyright 2017-2023, Charles Weinberger & Paul DeMarco.
+// All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+part of flutter_blue_plus;
+
+/// the windows plugin dll, for the functions it exports to dart:ffi
+final ffi.DynamicLibrary _windowsPlugin = ffi.DynamicLibrary.open('flutter_blue_plus_plugin.dll');
+
+/// Counters of [NativeSnapshot.counter]
+// keep in sync with SnapshotCounter in flutter_blue_plus_plugin.cpp
+enum NativeCounter {
+  notifications, // 0
+  scanResults, // 1
+  connects, // 2
+  disconnects, // 3
+}
+
+/// Synchronous reads of native state (Windows only)
+///   - no platform channel round trip, so they are cheap enough to call every frame
+///   - they never block: the native side keeps lock-free snapshots
+///   - [lastValue] covers notified & polled values, including those sent to a nativePort
+///   - the native tables are fixed: beyond 32 devices or 127 characteristics, they throw
+///     [FbpErrorCode.nativeSnapshotFull]
+class NativeSnapshot {
+  static final int Function() _adapterState =
+      _windowsPlugin.lookupFunction<ffi.Int32 Function(), int Function()>('FlutterBluePlusAdapterState');
+  static final int Function() _connectedCount =
+      _windowsPlugin.lookupFunction<ffi.Int32 Function(), int Function()>('FlutterBluePlusConnectedCount');
+  static final int Function(int) _isConnected =
+      _windowsPlugin.lookupFunction<ffi.Int32 Function(ffi.Uint64), int Function(int)>('FlutterBluePlusIsConnected');
+  static final int Function(int) _mtu =
+      _windowsPlugin.lookupFunction<ffi.Int32 Function(ffi.Uint64), int Function(int)>('FlutterBluePlusMtu');
+  static final int Function(int, ffi.Pointer<ffi.Uint8>, int) _lastValue = _windowsPlugin.lookupFunction<
+      ffi.Int32 Function(ffi.Int32, ffi.Pointer<ffi.Uint8>, ffi.Int32),
+      int Function(int, ffi.Pointer<ffi.Uint8>, int)>('FlutterBluePlusLastValue');
+  static final int Function(int) _counter =
+      _windowsPlugin.lookupFunction<ffi.Int64 Function(ffi.Int32), int Function(int)>('FlutterBluePlusCounter');
+
+  static void _checkWindows(String function) {
+    if (Platform.isWindows == false) {
+      throw FlutterBluePlusException(ErrorPlatform.fbp, function, FbpErrorCode.windowsOnly.index, "windows-only");
+    }
+  }
+
+  /// windows remote ids are 48-bit mac addresses, e.g. 06:E5:28:3B:FD:E0
+  static int _address(DeviceIdentifier remoteId) => int.parse(remoteId.str.replaceAll(':', ''), radix: 16);
+
+  /// values are truncated to this many bytes natively
+  static const int _maxValueLength = 512;
+
+  /// lastValue copies into this, one buffer per isolate, never freed
+  static final ffi.Pointer<ffi.Uint8> _valueBuffer = malloc<ffi.Uint8>(_maxValueLength);
+
+  /// the native side returns -2 for devices & channel ids beyond its fixed tables
+  static const int _overflow = -2;
+
+  static int _checkOverflow(String function, int value) {
+    if (value == _overflow) {
+      throw FlutterBluePlusException(ErrorPlatform.fbp, function, FbpErrorCode.nativeSnapshotFull.index,
+          "beyond the native snapshot (32 devices, 127 characteristics)");
+    }
+    return value;
+  }
+
+  static BluetoothAdapterState get adapterState {
+    _checkWindows("adapterState");
+    return _bmToAdapterState(BmAdapterStateEnum.values[_adapterState()]);
+  }
+
+  static int get connectedCount {
+    _checkWindows("connectedCount");
+    return _connectedCount();
+  }
+
+  /// false while windows reconnects natively
+  static bool isConnected(DeviceIdentifier remoteId) {
+    _checkWindows("isConnected");
+    return _checkOverflow("isConnected", _isConnected(_address(remoteId))) == 1;
+  }
+
+  /// the negotiated mtu, or 0 if not connected
+  static int mtu(DeviceIdentifier remoteId) {
+    _checkWindows("mtu");
+    return _checkOverflow("mtu", _mtu(_address(remoteId)));
+  }
+
+  /// the last notified or polled value, or null if there is none.
+  /// Values longer than 512 bytes are truncated.
+  static List<int>? lastValue(BluetoothCharacteristic characteristic) {
+    _checkWindows("lastValue");
+    int length = _checkOverflow("lastValue", _lastValue(characteristic._channelId, _valueBuffer, _maxValueLength));
+    if (length < 0) {
+      return null;
+    }
+    // copy, the buffer is reused by the next read
+    return Uint8List.fromList(_valueBuffer.asTypedList(length < _maxValueLength ? length : _maxValueLength));
+  }
+
+  static int counter(NativeCounter counter) {
+    _checkWindows("counter");
+    return _counter(counter.index);
+  }
+}
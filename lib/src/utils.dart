@@ -1,28 +1,44 @@
 part of flutter_blue_plus;
 
+// '00' to 'ff', so encoding is a lookup per byte
+final List<String> _hexBytes = List.generate(256, (i) => i.toRadixString(16).padLeft(2, '0'), growable: false);
+
 String _hexEncode(List<int> numbers) {
-  return numbers.map((n) => (n & 0xFF).toRadixString(16).padLeft(2, '0')).join();
+  StringBuffer sb = StringBuffer();
+  for (int n in numbers) {
+    sb.write(_hexBytes[n & 0xFF]);
+  }
+  return sb.toString();
+}
+
+// value of a hex digit code unit, or -1
+int _hexDigit(int c) {
+  if (c >= 0x30 && c <= 0x39) return c - 0x30; // 0-9
+  if (c >= 0x61 && c <= 0x66) return c - 0x57; // a-f
+  if (c >= 0x41 && c <= 0x46) return c - 0x37; // A-F
+  return -1;
 }
 
 List<int>? _tryHexDecode(String hex) {
-  List<int> numbers = [];
-  for (int i = 0; i < hex.length; i += 2) {
-    String hexPart = hex.substring(i, i + 2);
-    int? num = int.tryParse(hexPart, radix: 16);
-    if (num == null) {
+  if (hex.length.isOdd) {
+    return null;
+  }
+  List<int> numbers = List.filled(hex.length ~/ 2, 0, growable: true);
+  for (int i = 0; i < numbers.length; i++) {
+    int hi = _hexDigit(hex.codeUnitAt(i * 2));
+    int lo = _hexDigit(hex.codeUnitAt(i * 2 + 1));
+    if (hi < 0 || lo < 0) {
       return null;
     }
-    numbers.add(num);
+    numbers[i] = (hi << 4) | lo;
   }
   return numbers;
 }
 
 List<int> _hexDecode(String hex) {
-  List<int> numbers = [];
-  for (int i = 0; i < hex.length; i += 2) {
-    String hexPart = hex.substring(i, i + 2);
-    int num = int.parse(hexPart, radix: 16);
-    numbers.add(num);
+  List<int>? numbers = _tryHexDecode(hex);
+  if (numbers == null) {
+    throw FormatException("not hex format: $hex");
   }
   return numbers;
 }
@@ -73,6 +89,16 @@ extension FutureTimeout<T> on Future<T> {
     });
   }
 
+  /// cancel the native operation if we stop waiting for it
+  Future<T> fbpCancelOnTimeout(int operationId) {
+    return this.catchError((e) async {
+      if (e is FlutterBluePlusException && e.code == FbpErrorCode.timeout.index) {
+        await FlutterBluePlus._cancelOperation(operationId);
+      }
+      throw e;
+    });
+  }
+
   Future<T> fbpEnsureDeviceIsConnected(BluetoothDevice device, String function) {
     // Create a completer to represent the result of this extended Future.
     var completer = Completer<T>();
@@ -319,23 +345,30 @@ Stream<T> _mergeStreams<T>(List<Stream<T>> streams) {
 // dart is single threaded, but still has task switching.
 // this mutex lets a single task through at a time.
 class _Mutex {
-  final StreamController _controller = StreamController.broadcast();
-  int execute = 0;
-  int issued = 0;
-
-  Future<bool> take() async {
-    int mine = issued;
-    issued++;
-    // tasks are executed in the same order they call take()
-    while (mine != execute) {
-      await _controller.stream.first; // wait
+  bool _taken = false;
+
+  // waiting tasks of each OperationPriority, in the order they called take()
+  final List<List<Completer<void>>> _waiting = List.generate(OperationPriority.values.length, (_) => []);
+
+  // tasks are executed in priority order, then in the order they call take()
+  Future<bool> take([OperationPriority priority = OperationPriority.interactive]) async {
+    if (_taken) {
+      var turn = Completer<void>();
+      _waiting[priority.index].add(turn);
+      await turn.future; // wait
     }
+    _taken = true;
     return true;
   }
 
   bool give() {
-    execute++;
-    _controller.add(null); // release waiting tasks
+    for (var lane in _waiting) {
+      if (lane.isNotEmpty) {
+        lane.removeAt(0).complete(); // hand over, still taken
+        return false;
+      }
+    }
+    _taken = false;
     return false;
   }
 }
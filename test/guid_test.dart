@@ -0,0 +1,88 @@
+// Copyright 2017-2023, Charles Weinberger & Paul DeMarco.
+// All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+import 'package:flutter_blue_plus/flutter_blue_plus.dart';
+import 'package:flutter_test/flutter_test.dart';
+
+// the hex values of the platform messages are decoded by _hexDecode
+BmCharacteristicData _characteristicData(String value) => BmCharacteristicData.fromMap({
+      'remote_id': '06:E5:28:3B:FD:E0',
+      'service_uuid': '180d',
+      'secondary_service_uuid': null,
+      'characteristic_uuid': '2a37',
+      'value': value,
+      'success': 1,
+      'error_code': 0,
+      'error_string': 'success',
+    });
+
+void main() {
+  group('Guid', () {
+    const String short16 = '180d';
+    const String short32 = '0000180d';
+    const String long128 = '0000180d-0000-1000-8000-00805f9b34fb';
+
+    test('16-bit, 32-bit & 128-bit forms are equal', () {
+      expect(Guid(short16), Guid(short32));
+      expect(Guid(short16), Guid(long128));
+      expect(Guid(short32), Guid(long128));
+    });
+
+    test('16-bit, 32-bit & 128-bit forms hash equal', () {
+      expect(Guid(short16).hashCode, Guid(short32).hashCode);
+      expect(Guid(short16).hashCode, Guid(long128).hashCode);
+      expect({Guid(short16), Guid(short32), Guid(long128)}.length, 1);
+    });
+
+    test('parses any case, with or without dashes', () {
+      expect(Guid('0000180D-0000-1000-8000-00805F9B34FB'), Guid(long128));
+      expect(Guid('0000180d00001000800000805f9b34fb'), Guid(long128));
+    });
+
+    test('formats the shortest & 128-bit representations', () {
+      expect(Guid(long128).str, short16);
+      expect(Guid(short16).str128, long128);
+      expect(Guid('1234180d').str, '1234180d');
+      expect(Guid('6e400001-b5a3-f393-e0a9-e50e24dcca9e').str, '6e400001-b5a3-f393-e0a9-e50e24dcca9e');
+    });
+
+    test('different uuids are not equal', () {
+      expect(Guid('180d') == Guid('180f'), isFalse);
+      expect(Guid('6e400001-b5a3-f393-e0a9-e50e24dcca9e') == Guid('6e400002-b5a3-f393-e0a9-e50e24dcca9e'), isFalse);
+    });
+
+    test('rejects malformed uuids', () {
+      expect(() => Guid('180'), throwsFormatException);
+      expect(() => Guid('18 0d'), throwsFormatException);
+      expect(() => Guid('180d18'), throwsFormatException);
+    });
+  });
+
+  group('hex', () {
+    test('decodes any case', () {
+      expect(_characteristicData('').value, isEmpty);
+      expect(_characteristicData('00ff7f80').value, [0x00, 0xff, 0x7f, 0x80]);
+      expect(_characteristicData('ABcd').value, [0xab, 0xcd]);
+    });
+
+    test('rejects malformed hex', () {
+      expect(() => _characteristicData('abc'), throwsFormatException);
+      expect(() => _characteristicData('zz'), throwsFormatException);
+    });
+
+    test('encodes & decodes every byte', () {
+      List<int> bytes = List.generate(256, (i) => i);
+      String hex = BmWriteCharacteristicRequest(
+        remoteId: '06:E5:28:3B:FD:E0',
+        serviceUuid: Guid('180d'),
+        secondaryServiceUuid: null,
+        characteristicUuid: Guid('2a37'),
+        writeType: BmWriteType.withResponse,
+        allowLongWrite: false,
+        value: bytes,
+      ).toMap()['value'];
+      expect(_characteristicData(hex).value, bytes);
+    });
+  });
+}
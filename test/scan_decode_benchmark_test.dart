@@ -0,0 +1,64 @@
+// Copyright 2017-2023, Charles Weinberger & Paul DeMarco.
+// All rights reserved. Use of this source code is governed by a
+// BSD-style license that can be found in the LICENSE file.
+
+// Decoding throughput of scan results, the busiest platform message.
+// Runs with the other tests, or alone: flutter test --tags benchmark
+@Tags(['benchmark'])
+library scan_decode_benchmark_test;
+
+import 'package:flutter_blue_plus/flutter_blue_plus.dart';
+import 'package:flutter_test/flutter_test.dart';
+
+// an advertisement as the windows plugin sends it: a beacon with a name,
+// manufacturer data, service data & both forms of service uuids
+Map<dynamic, dynamic> _advertisement(int i) => {
+      'remote_id': 'C4:7C:8D:6A:${(i >> 8 & 0xff).toRadixString(16).padLeft(2, '0')}:${(i & 0xff).toRadixString(16).padLeft(2, '0')}',
+      'platform_name': 'Flower care',
+      'adv_name': 'Flower care',
+      'connectable': 1,
+      'tx_power_level': -4,
+      'manufacturer_data': {0x004c: '0215fda50693a4e24fb1afcfc6eb0764782527114cb9c5'},
+      'service_data': {'fe95': '71209800a764aa6b8d7cc40d0910020301'},
+      'service_uuids': ['180d', '0000fe95-0000-1000-8000-00805f9b34fb', '6e400001-b5a3-f393-e0a9-e50e24dcca9e'],
+      'rssi': -67,
+      'timestamp': 1700000000000000 + i,
+    };
+
+void main() {
+  test('decodes scan responses', () {
+    // distinct maps, so no decode is served by a cache of the previous one
+    const int count = 1000;
+    const int rounds = 50;
+    final responses = List.generate(count, (i) => {'advertisements': [_advertisement(i)]});
+
+    BmScanResponse decode(Map<dynamic, dynamic> m) => BmScanResponse.fromMap(m);
+
+    // warm up, so the jit has compiled the decoders
+    for (var m in responses) {
+      decode(m);
+    }
+
+    int decoded = 0;
+    final watch = Stopwatch()..start();
+    for (int r = 0; r < rounds; r++) {
+      for (var m in responses) {
+        decoded += decode(m).advertisements.length;
+      }
+    }
+    watch.stop();
+
+    final perSecond = decoded * 1000000 ~/ (watch.elapsedMicroseconds == 0 ? 1 : watch.elapsedMicroseconds);
+    // ignore: avoid_print
+    print('BmScanResponse.fromMap: $decoded decoded in ${watch.elapsedMilliseconds} ms, $perSecond per second');
+
+    // and decoded correctly
+    final adv = decode(responses[1]).advertisements.single;
+    expect(decoded, count * rounds);
+    expect(adv.remoteId, 'C4:7C:8D:6A:00:01');
+    expect(adv.manufacturerData[0x004c]!.length, 23);
+    expect(adv.serviceData[Guid('fe95')]!.first, 0x71);
+    expect(adv.serviceUuids, [Guid('180d'), Guid('fe95'), Guid('6e400001-b5a3-f393-e0a9-e50e24dcca9e')]);
+    expect(adv.rssi, -67);
+  });
+}
@@ -9,6 +9,20 @@
 #include <winrt/Windows.Devices.Bluetooth.h>
 #include <winrt/Windows.Devices.Bluetooth.Advertisement.h>
 #include <winrt/Windows.Devices.Bluetooth.GenericAttributeProfile.h>
+#include <winrt/Windows.Devices.Enumeration.h>
+
+// connection parameters & phy need the Windows 11 SDK (10.0.22000) or later
+#if defined(NTDDI_WIN10_CO)
+#define FBP_CONNECTION_PARAMETERS 1
+#else
+#define FBP_CONNECTION_PARAMETERS 0
+#endif
+
+// notifications posted straight to a dart isolate. CMake defines this when it
+// finds dart_api_dl.c in the Dart SDK that ships with Flutter.
+#if FBP_DART_API_DL
+#include "dart_api_dl.h"
+#endif
 
 // For getPlatformVersion; remove unless needed for your plugin implementation.
 #include <flutter/method_channel.h>
@@ -19,13 +33,23 @@
 #include <flutter/standard_method_codec.h>
 #include <flutter/standard_message_codec.h>
 
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <chrono>
+#include <cmath>
+#include <random>
 #include <sstream>
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <string>
+#include <type_traits>
 
 #define GUID_FORMAT "%08x-%04hx-%04hx-%02hhx%02hhx-%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx"
 #define GUID_ARG(guid) guid.Data1, guid.Data2, guid.Data3, guid.Data4[0], guid.Data4[1], guid.Data4[2], guid.Data4[3], guid.Data4[4], guid.Data4[5], guid.Data4[6], guid.Data4[7]
@@ -39,37 +63,95 @@ namespace {
     using namespace winrt::Windows::Devices::Bluetooth;
     using namespace winrt::Windows::Devices::Bluetooth::Advertisement;
     using namespace winrt::Windows::Devices::Bluetooth::GenericAttributeProfile;
+    using namespace winrt::Windows::Devices::Enumeration;
 
     using flutter::EncodableValue;
     using flutter::EncodableMap;
     using flutter::EncodableList;
 
+    using MethodResultPtr = std::unique_ptr<flutter::MethodResult<EncodableValue>>;
+
     union uint16_t_union {
         uint16_t uint16;
         byte bytes[sizeof(uint16_t)];
     };
 
-    std::vector<uint8_t> to_bytevc(IBuffer buffer) {
-        auto reader = DataReader::FromBuffer(buffer);
-        auto result = std::vector<uint8_t>(reader.UnconsumedBufferLength());
-        reader.ReadBytes(result);
-        return result;
+    // IBuffer::data() points at the buffer's own memory, so this is a single copy
+    std::vector<uint8_t> to_bytevc(IBuffer const& buffer) {
+        auto data = buffer.data();
+        return std::vector<uint8_t>(data, data + buffer.Length());
     }
 
-    IBuffer from_bytevc(std::vector<uint8_t> bytes) {
-        auto writer = DataWriter();
-        writer.WriteBytes(bytes);
-        return writer.DetachBuffer();
+    std::string to_hexstring(const uint8_t* data, size_t length) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex(length * 2, '0');
+        for (size_t i = 0; i < length; i++) {
+            hex[i * 2] = digits[data[i] >> 4];
+            hex[i * 2 + 1] = digits[data[i] & 0x0F];
+        }
+        return hex;
+    }
+
+    std::string to_hexstring(std::vector<uint8_t> const& bytes) {
+        return to_hexstring(bytes.data(), bytes.size());
     }
 
-    std::string to_hexstring(std::vector<uint8_t> bytes) {
-        auto ss = std::stringstream();
-        for (auto b : bytes)
-            ss << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(b);
-        return ss.str();
+    std::string to_hexstring(IBuffer const& buffer) {
+        return to_hexstring(buffer.data(), buffer.Length());
     }
 
-    std::vector<uint8_t> hex_to_bytes(std::string hex) {
+    // writes reuse their buffers instead of allocating one per write.
+    // a buffer is filled in place, and returns to the pool when its write completes.
+    class BufferPool {
+    public:
+        Buffer Acquire(std::vector<uint8_t> const& bytes) {
+            auto length = (uint32_t)bytes.size();
+            Buffer buffer{ nullptr };
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = 0; i < pool.size(); i++) {
+                    if (pool[i].Capacity() >= length) {
+                        buffer = pool[i];
+                        pool[i] = pool.back();
+                        pool.pop_back();
+                        break;
+                    }
+                }
+            }
+            if (!buffer) {
+                buffer = Buffer(length > minCapacity ? length : minCapacity);
+            }
+            if (length > 0) {
+                std::memcpy(buffer.data(), bytes.data(), length);
+            }
+            buffer.Length(length);
+            return buffer;
+        }
+
+        void Release(Buffer const& buffer) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pool.size() < maxPooled) {
+                pool.push_back(buffer);
+            }
+        }
+
+        size_t PooledBytes() {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t bytes = 0;
+            for (auto const& buffer : pool) {
+                bytes += buffer.Capacity();
+            }
+            return bytes;
+        }
+
+    private:
+        static constexpr uint32_t minCapacity = 512; // largest attribute value
+        static constexpr size_t maxPooled = 16;
+        std::mutex mutex;
+        std::vector<Buffer> pool;
+    };
+
+    std::vector<uint8_t> hex_to_bytes(const std::string& hex) {
         std::vector<uint8_t> bytes;
         for (unsigned int i = 0; i < hex.length(); i += 2) {
             std::string bytestring = hex.substr(i, 2);
@@ -85,16 +167,121 @@ namespace {
         return std::string{ chars };
     }
 
-    std::string remove_string(std::string text, std::string targetText) {
-        text.erase(remove_if(text.begin(), text.end(),
-                                 [&targetText](const char &c) {
-                                     return targetText.find(c) != std::string::npos;
-                                 }),
-                   text.end());
+    // Method call arguments are decoded by reference, without copying the map.
+    // A missing or mistyped argument throws ArgumentError, which HandleMethodCall
+    // returns as an error result, instead of crashing on std::bad_variant_access.
+    struct ArgumentError {
+        std::string message;
+    };
+
+    template <typename T>
+    const T& argumentAs(const EncodableValue* value, const char* name) {
+        auto typed = value ? std::get_if<T>(value) : nullptr;
+        if (typed == nullptr) {
+            throw ArgumentError{ std::string("invalid argument: ") + name };
+        }
+        return *typed;
+    }
+
+    template <typename T>
+    const T& requiredArg(const EncodableMap& args, const char* key) {
+        auto it = args.find(EncodableValue(key));
+        if (it == args.end()) {
+            throw ArgumentError{ std::string("missing argument: ") + key };
+        }
+        return argumentAs<T>(&it->second, key);
+    }
+
+    // "0000180d-0000-1000-8000-00805f9b34fb"
+    winrt::guid parseGuid(const std::string& uuid) {
+        try {
+            return winrt::guid(uuid);
+        } catch (std::invalid_argument const&) {
+            throw ArgumentError{ "invalid uuid: " + uuid };
+        }
+    }
+
+    // dart sends 16-bit & 32-bit uuids in their short form, e.g. "180d"
+    winrt::guid parseUuid(const std::string& uuid) {
+        if (uuid.size() == 4) {
+            return parseGuid("0000" + uuid + "-0000-1000-8000-00805f9b34fb");
+        }
+        if (uuid.size() == 8) {
+            return parseGuid(uuid + "-0000-1000-8000-00805f9b34fb");
+        }
+        return parseGuid(uuid);
+    }
+
+    // "d9:da:10:8a:32:3a" to 0xd9da108a323a
+    uint64_t parseRemoteId(const std::string& remoteId) {
+        uint64_t address = 0;
+        int digits = 0;
+        for (char c : remoteId) {
+            int nibble;
+            if (c == ':') {
+                continue;
+            } else if (c >= '0' && c <= '9') {
+                nibble = c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                nibble = c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                nibble = c - 'A' + 10;
+            } else {
+                throw ArgumentError{ "invalid remote_id: " + remoteId };
+            }
+            address = (address << 4) | (uint64_t)nibble;
+            digits++;
+        }
+        if (digits == 0 || digits > 12) {
+            throw ArgumentError{ "invalid remote_id: " + remoteId };
+        }
+        return address;
+    }
+
+    int32_t optionalInt32(const EncodableMap& args, const char* key, int32_t defaultValue) {
+        auto it = args.find(EncodableValue(key));
+        if (it != args.end() && std::holds_alternative<int32_t>(it->second)) {
+            return std::get<int32_t>(it->second);
+        }
+        return defaultValue;
+    }
+
+    // priority classes of a device's operation queue, see OpQueue
+    // keep in sync with OperationPriority in flutter_blue_plus.dart
+    enum OpPriority {
+        PRIORITY_REALTIME = 0,
+        PRIORITY_INTERACTIVE = 1,
+        PRIORITY_BULK = 2,
+        PRIORITY_COUNT
+    };
+
+    int32_t parsePriority(const EncodableMap& args) {
+        auto priority = optionalInt32(args, "priority", PRIORITY_INTERACTIVE);
+        return priority >= 0 && priority < PRIORITY_COUNT ? priority : PRIORITY_INTERACTIVE;
+    }
 
-        return text;
+    // true if dart asked for the response of this call as its method result
+    bool isDeferredResult(const EncodableMap& args) {
+        auto it = args.find(EncodableValue("deferred_result"));
+        return it != args.end() && std::holds_alternative<bool>(it->second) && std::get<bool>(it->second);
     }
 
+    // the arguments of every method that addresses a single characteristic
+    struct CharacteristicArgs {
+        const EncodableMap& map;
+        const std::string& remoteId;
+        uint64_t bluetoothAddress;
+        const std::string& serviceUuid;
+        const std::string& characteristicUuid;
+
+        explicit CharacteristicArgs(const EncodableValue* arguments)
+            : map(argumentAs<EncodableMap>(arguments, "arguments")),
+              remoteId(requiredArg<std::string>(map, "remote_id")),
+              bluetoothAddress(parseRemoteId(remoteId)),
+              serviceUuid(requiredArg<std::string>(map, "service_uuid")),
+              characteristicUuid(requiredArg<std::string>(map, "characteristic_uuid")) {}
+    };
+
     int to_bmAdapterState(RadioState state) {
         switch (state) {
             case RadioState::Disabled:
@@ -141,6 +328,58 @@ namespace {
         return ret.str();
     }
 
+    // a BmBluetoothDescriptor
+    EncodableMap to_bmDescriptor(uint64_t bluetoothAddress, GattCharacteristic const& c, GattDescriptor const& d) {
+        return EncodableMap{
+            {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+            {"service_uuid", EncodableValue(to_uuidstr(c.Service().Uuid()))},
+            {"secondary_service_uuid", EncodableValue()},
+            {"characteristic_uuid", EncodableValue(to_uuidstr(c.Uuid()))},
+            {"descriptor_uuid", EncodableValue(to_uuidstr(d.Uuid()))},
+        };
+    }
+
+    // "aa:bb:cc:dd:ee:ff", requested from device enumeration so the device need not be opened
+    constexpr wchar_t deviceAddressProperty[] = L"System.Devices.Aep.DeviceAddress";
+
+    // a BmBluetoothDevice, or an empty map if the device has no usable address
+    EncodableMap to_bmBluetoothDevice(DeviceInformation const& info) {
+        auto address = winrt::unbox_value_or<winrt::hstring>(info.Properties().TryLookup(deviceAddressProperty), L"");
+        try {
+            auto bluetoothAddress = parseRemoteId(winrt::to_string(address));
+            return EncodableMap{
+                {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                {"platform_name", winrt::to_string(info.Name())},
+            };
+        } catch (const ArgumentError&) {
+            return EncodableMap{};
+        }
+    }
+
+#if FBP_CONNECTION_PARAMETERS
+    // Phy enum index, as used by dart: le1m = 0, le2m = 1, leCoded = 2
+    int32_t to_bmPhy(BluetoothLEConnectionPhyInfo const& info) {
+        if (info.IsCodedPhy()) {
+            return 2;
+        }
+        return info.IsUncoded2MPhy() ? 1 : 0;
+    }
+
+    // a BmConnectionParameters. interval in 1.25 ms units, link timeout in 10 ms units
+    EncodableMap to_bmConnectionParameters(BluetoothLEDevice const& device) {
+        auto parameters = device.GetConnectionParameters();
+        auto phy = device.GetConnectionPhy();
+        return EncodableMap{
+            {"remote_id", winrt::to_string(formatBluetoothAddress(device.BluetoothAddress()))},
+            {"connection_interval", EncodableValue((int32_t)parameters.ConnectionInterval())},
+            {"connection_latency", EncodableValue((int32_t)parameters.ConnectionLatency())},
+            {"link_timeout", EncodableValue((int32_t)parameters.LinkTimeout())},
+            {"tx_phy", EncodableValue(to_bmPhy(phy.TransmitInfo()))},
+            {"rx_phy", EncodableValue(to_bmPhy(phy.ReceiveInfo()))},
+        };
+    }
+#endif
+
     enum LogLevel {
         LNONE = 0,
         LERROR = 1,
@@ -150,770 +389,3907 @@ namespace {
         LVERBOSE = 5
     };
 
-    struct BluetoothDeviceAgent {
-        BluetoothLEDevice device;
-        winrt::event_token connnectionStatusChangedToken;
-        std::map<std::string, GattDeviceService> gattServices;
-        std::map<std::string, GattCharacteristic> gattCharacteristics;
-        std::map<std::string, winrt::event_token> valueChangedTokens;
-
-        BluetoothDeviceAgent(BluetoothLEDevice device, winrt::event_token connnectionStatusChangedToken)
-            : device(device),
-            connnectionStatusChangedToken(connnectionStatusChangedToken) {}
+    // The message is only built if the level is enabled.
+    // Only usable inside FlutterBluePlusPlugin, which owns logLevel.
+    #define FBP_LOG(level, message) \
+        do { \
+            if ((level) <= logLevel) { \
+                FBPLog((level), (message)); \
+            } \
+        } while (0)
+
+    // events of the binary trace ring. Keep in sync with _nativeTraceEventNames in dart.
+    enum TraceEvent : uint32_t {
+        TMETHOD_CALL = 1, // arg0: first 8 chars of the method name
+        TCONNECTED = 2, // arg0: address
+        TDISCONNECTED = 3, // arg0: address
+        TRECONNECTED = 4, // arg0: address, arg1: attempts
+        TREAD = 5, // arg0: address, arg1: handle << 32 | gatt status << 16 | length
+        TWRITE = 6, // arg0: address, arg1: handle << 32 | gatt status << 16 | length
+        TNOTIFY = 7, // arg0: address, arg1: handle << 32 | length
+        TPOLL = 8, // arg0: address, arg1: handle << 32 | length
+        TSCAN_RESULT = 9, // arg0: address, arg1: rssi
+        TCANCELED = 10, // arg0: operation id
+        TSPAN = 11, // arg0: span name (const char*), arg1: duration in ns. Only in tracing mode.
+    };
 
-        ~BluetoothDeviceAgent() {
-            device = nullptr;
+    // Fixed size binary trace records, written from any thread without locks.
+    // It always records, whatever the log level, and is dumped on demand by 'getNativeTrace'.
+    // Each slot has a sequence number that is odd while it is being written,
+    // so the reader can skip slots that are torn, or overwritten while reading.
+    class TraceRing {
+    public:
+        static constexpr uint64_t capacity = 4096; // power of 2
+
+        // the dumped format, little endian
+        struct PackedRecord {
+            int64_t timestamp; // steady clock, nanoseconds. For spans, the start.
+            uint32_t event;
+            uint32_t thread;
+            uint64_t arg0;
+            uint64_t arg1;
+        };
+
+        // tracing mode: also record a TSPAN for every native operation & callback
+        std::atomic<bool> spans{ false };
+
+        static int64_t Now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
         }
 
-        IAsyncOperation<GattDeviceService> GetServiceAsync(std::string service) {
-            if (gattServices.count(service) == 0) {
-                auto serviceResult = co_await device.GetGattServicesAsync();
-                if (serviceResult.Status() != GattCommunicationStatus::Success)
-                    co_return nullptr;
+        void Record(TraceEvent event, uint64_t arg0 = 0, uint64_t arg1 = 0) {
+            Write(Now(), event, arg0, arg1);
+        }
 
-                for (auto s : serviceResult.Services()) {
-                    std::string uuid = to_uuidstr(s.Uuid());
-                    if (service.size() == 4) {
-                        uuid = uuid.substr(4, 4);
-                    }
+        void RecordSpan(const char* name, int64_t start, int64_t end) {
+            Write(start, TSPAN, (uint64_t)(uintptr_t)name, (uint64_t)(end - start));
+        }
 
-                    if (uuid == service) {
-                        gattServices.insert(std::make_pair(service, s));
-                    }
+        // the records, oldest first
+        std::vector<PackedRecord> Snapshot() {
+            uint64_t end = next.load(std::memory_order_acquire);
+            uint64_t begin = end > capacity ? end - capacity : 0;
+
+            std::vector<PackedRecord> out;
+            out.reserve((size_t)(end - begin));
+            for (uint64_t index = begin; index < end; index++) {
+                auto& slot = slots[index & (capacity - 1)];
+                uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+                if (sequence != index * 2 + 2) {
+                    continue; // being written, or already overwritten
                 }
+                PackedRecord record{
+                    slot.timestamp.load(std::memory_order_relaxed),
+                    slot.event.load(std::memory_order_relaxed),
+                    slot.thread.load(std::memory_order_relaxed),
+                    slot.arg0.load(std::memory_order_relaxed),
+                    slot.arg1.load(std::memory_order_relaxed)
+                };
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+                    continue; // overwritten while we read it
+                }
+                out.push_back(record);
             }
-            co_return gattServices.at(service);
+            return out;
         }
 
-        IAsyncOperation<GattCharacteristic> GetCharacteristicAsync(std::string service, std::string characteristic) {
-            if (gattCharacteristics.count(characteristic) == 0) {
-                auto gattService = co_await GetServiceAsync(service);
-
-                auto characteristicResult = co_await gattService.GetCharacteristicsAsync();
-                if (characteristicResult.Status() != GattCommunicationStatus::Success)
-                    co_return nullptr;
-
-                for (auto c : characteristicResult.Characteristics()) {
-                    std::string uuid = to_uuidstr(c.Uuid());
-                    if (characteristic.size() == 4) {
-                        uuid = uuid.substr(4, 4);
-                    }
+        std::vector<uint8_t> Dump() {
+            auto records = Snapshot();
+            std::vector<uint8_t> out(records.size() * sizeof(PackedRecord));
+            if (!records.empty()) {
+                std::memcpy(out.data(), records.data(), out.size());
+            }
+            return out;
+        }
 
-                    if (uuid == characteristic) {
-                        gattCharacteristics.insert(std::make_pair(characteristic, c));
+        // Chrome trace event format, for chrome://tracing & ui.perfetto.dev.
+        // Timestamps are steady_clock (QPC) microseconds, the clock of the flutter timeline.
+        std::string ToChromeJson() {
+            static const char* names[] = { "none", "methodCall", "connected", "disconnected", "reconnected",
+                "read", "write", "notify", "poll", "scanResult", "canceled", "span" };
+            auto pid = GetCurrentProcessId();
+
+            std::ostringstream json;
+            json << std::fixed << std::setprecision(3);
+            json << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+            bool first = true;
+            for (auto& r : Snapshot()) {
+                json << (first ? "" : ",");
+                first = false;
+                if (r.event == TSPAN) {
+                    json << "{\"name\":\"" << (const char*)(uintptr_t)r.arg0 << "\",\"cat\":\"fbp\",\"ph\":\"X\""
+                         << ",\"ts\":" << r.timestamp / 1000.0 << ",\"dur\":" << r.arg1 / 1000.0
+                         << ",\"pid\":" << pid << ",\"tid\":" << r.thread << "}";
+                } else {
+                    json << "{\"name\":\"" << (r.event < 12 ? names[r.event] : "unknown") << "\",\"cat\":\"fbp\",\"ph\":\"i\",\"s\":\"t\""
+                         << ",\"ts\":" << r.timestamp / 1000.0
+                         << ",\"pid\":" << pid << ",\"tid\":" << r.thread << ",\"args\":{";
+                    if (r.event == TMETHOD_CALL) {
+                        char method[9] = {};
+                        std::memcpy(method, &r.arg0, 8);
+                        json << "\"method\":\"" << method << "\"";
+                    } else {
+                        json << "\"arg0\":\"0x" << std::hex << r.arg0 << "\",\"arg1\":\"0x" << r.arg1 << std::dec << "\"";
                     }
+                    json << "}}";
                 }
             }
-            co_return gattCharacteristics.at(characteristic);
+            json << "]}";
+            return json.str();
+        }
+
+    private:
+        struct Slot {
+            std::atomic<uint64_t> sequence{ 0 };
+            std::atomic<int64_t> timestamp{ 0 };
+            std::atomic<uint32_t> event{ 0 };
+            std::atomic<uint32_t> thread{ 0 };
+            std::atomic<uint64_t> arg0{ 0 };
+            std::atomic<uint64_t> arg1{ 0 };
+        };
+        std::array<Slot, capacity> slots{};
+        std::atomic<uint64_t> next{ 0 };
+
+        void Write(int64_t timestamp, TraceEvent event, uint64_t arg0, uint64_t arg1) {
+            uint64_t index = next.fetch_add(1, std::memory_order_relaxed);
+            auto& slot = slots[index & (capacity - 1)];
+            slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.timestamp.store(timestamp, std::memory_order_relaxed);
+            slot.event.store(event, std::memory_order_relaxed);
+            slot.thread.store(GetCurrentThreadId(), std::memory_order_relaxed);
+            slot.arg0.store(arg0, std::memory_order_relaxed);
+            slot.arg1.store(arg1, std::memory_order_relaxed);
+            slot.sequence.store(index * 2 + 2, std::memory_order_release);
         }
     };
 
-    class FlutterBluePlusPlugin : public flutter::Plugin {
+    // Times a region of code, including co_awaits, in tracing mode.
+    // The name must be a string literal. The span is recorded by End(), or when it goes out of scope.
+    class TraceSpan {
     public:
-        static void RegisterWithRegistrar(flutter::PluginRegistrarWindows* registrar);
-
-        FlutterBluePlusPlugin();
+        TraceSpan(TraceRing& ring, const char* name)
+            : ring(ring), name(name), start(ring.spans.load(std::memory_order_relaxed) ? TraceRing::Now() : 0) {}
+        ~TraceSpan() { End(); }
+
+        void End() {
+            if (start != 0) {
+                ring.RecordSpan(name, start, TraceRing::Now());
+                start = 0;
+            }
+        }
 
-        virtual ~FlutterBluePlusPlugin();
     private:
-        winrt::fire_and_forget InitializeAsync();
+        TraceRing& ring;
+        const char* name;
+        int64_t start;
+    };
 
-        // Called when a method is called on this plugin's channel from Dart.
-        void HandleMethodCall(
-            const flutter::MethodCall<flutter::EncodableValue>& method_call,
-            std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+    // the first 8 characters of a method name, packed into a trace argument
+    uint64_t traceName(const std::string& name) {
+        uint64_t packed = 0;
+        std::memcpy(&packed, name.data(), name.size() < 8 ? name.size() : 8);
+        return packed;
+    }
 
-        std::unique_ptr<flutter::MethodChannel<EncodableValue>> method_channel_;
+    // a native operation that dart can cancel, or that has a deadline
+    struct OpQueue;
+    struct OpWaiter;
 
-        EncodableList targetServiceUuids;
+    struct PendingOperation {
+        // the WinRT calls the operation is currently waiting on.
+        // usually one, but batches run several at once.
+        std::vector<IAsyncInfo> running;
+        bool canceled = false;
 
-        Radio bluetoothRadio{ nullptr };
+        // the device queue the operation waits in for its turn, if it does
+        std::shared_ptr<OpQueue> queue;
+        std::shared_ptr<OpWaiter> waiter;
+    };
 
-        BluetoothLEAdvertisementWatcher bluetoothLEWatcher{ nullptr };
-        winrt::event_token bluetoothLEWatcherReceivedToken;
-        void BluetoothLEWatcher_Received(BluetoothLEAdvertisementWatcher sender, BluetoothLEAdvertisementReceivedEventArgs args);
-        winrt::fire_and_forget SendScanResultAsync(BluetoothLEAdvertisementReceivedEventArgs args);
+    // a scan response waiting for the next advertisement of its device
+    struct ScanResponse {
+        BluetoothLEAdvertisement advertisement;
+        std::chrono::steady_clock::time_point time;
+    };
 
-        std::map<uint64_t, std::unique_ptr<BluetoothDeviceAgent>> connectedDevices{};
+    // Random addresses rotate, so scan responses of devices that are never seen
+    // again must not pile up. Older ones are not merged, and evicted when the cache is full.
+    constexpr size_t scanResponsesMax = 512;
+    constexpr std::chrono::seconds scanResponseMaxAge{ 10 };
 
-        winrt::fire_and_forget ConnectAsync(uint64_t bluetoothAddress);
-        void BluetoothLEDevice_ConnectionStatusChanged(BluetoothLEDevice sender, IInspectable args);
-        void CleanConnection(uint64_t bluetoothAddress);
-        winrt::fire_and_forget DiscoverServicesAsync(BluetoothDeviceAgent& bluetoothDeviceAgent);
-        winrt::fire_and_forget SetNotifiableAsync(BluetoothDeviceAgent& bluetoothDeviceAgent, std::string service, std::string characteristic, int32_t bleInputProperty);
-        winrt::fire_and_forget ReadValueAsync(BluetoothDeviceAgent& bluetoothDeviceAgent, std::string service, std::string characteristic);
-        winrt::fire_and_forget WriteValueAsync(BluetoothDeviceAgent& bluetoothDeviceAgent, std::string service, std::string characteristic, std::vector<uint8_t> value, int32_t bleOutputProperty);
-        void FlutterBluePlusPlugin::GattCharacteristic_ValueChanged(GattCharacteristic sender, GattValueChangedEventArgs args);
+    // a characteristic value, and when it was read or notified
+    struct CachedValue {
+        std::vector<uint8_t> value;
+        std::chrono::steady_clock::time_point time;
+    };
 
-        int32_t logLevel;
-        void FlutterBluePlusPlugin::FBPLog(LogLevel level, winrt::hstring message);
+    // an operation of 'performBatch'
+    struct BatchOperation {
+        int32_t type; // 0 = read, 1 = write, 2 = setNotifyValue
+        std::string service;
+        std::string characteristic;
+        std::vector<uint8_t> value;
+        int32_t writeType;
+        bool enable;
+        int32_t channelId;
+        GattCharacteristic gattCharacteristic{ nullptr };
+        bool registered = false; // ValueChanged was registered by this batch
     };
 
-    // static
-    void FlutterBluePlusPlugin::RegisterWithRegistrar(
-        flutter::PluginRegistrarWindows* registrar) {
-        auto method_channel_ =
-            std::make_unique<flutter::MethodChannel<EncodableValue>>(
-                registrar->messenger(), "flutter_blue_plus/methods",
-                &flutter::StandardMethodCodec::GetInstance());
+    // a characteristic read periodically by 'startPolling'
+    struct PollSettings {
+        std::chrono::milliseconds interval;
+        std::chrono::milliseconds jitter;
+        bool onlyOnChange;
+        int32_t channelId;
+        uint32_t generation;
+    };
 
-        auto plugin = std::make_unique<FlutterBluePlusPlugin>();
+    // failed polls wait 2, 4 .. 32 intervals before retrying, at most this long
+    constexpr int32_t pollMaxBackoffShift = 5;
+    constexpr std::chrono::milliseconds pollMaxBackoff{ 60000 };
 
-        method_channel_->SetMethodCallHandler(
-            [plugin_pointer = plugin.get()](const auto& call, auto result) {
-                plugin_pointer->HandleMethodCall(call, std::move(result));
-            });
+    // how to reconnect after the link drops, see 'connect'. 0 attempts = never.
+    struct ReconnectPolicy {
+        int32_t maxAttempts = 0;
+        std::chrono::milliseconds initialDelay{ 0 };
+        std::chrono::milliseconds maxDelay{ 0 };
+    };
 
-        plugin->method_channel_ = std::move(method_channel_);
+    // what the adapter supports, read once at startup
+    struct AdapterCapabilities {
+        bool lowEnergy = false;
+        bool centralRole = false;
+        bool peripheralRole = false;
+        bool extendedAdvertising = false;
+        uint32_t maxAdvertisementDataLength = 0;
+    };
 
-        registrar->AddPlugin(std::move(plugin));
-    }
+    // what a flow controlled stream does with an event when dart has no credits left
+    enum FlowPolicy : int32_t {
+        FLOW_NONE = 0,        // no flow control, every event is sent
+        FLOW_DROP_OLDEST = 1, // keep a bounded backlog, dropping its oldest event
+        FLOW_DROP_NEWEST = 2, // drop the new event
+        FLOW_CONFLATE = 3,    // keep only the latest backlogged event of each key (device or characteristic)
+        FLOW_BLOCK = 4,       // hold events in the backlog until credits arrive, dropping them after flowBlockTimeout
+    };
 
-    FlutterBluePlusPlugin::FlutterBluePlusPlugin() {
-        InitializeAsync();
-    }
+    const std::chrono::milliseconds flowBlockTimeout{ 1000 };
 
-    FlutterBluePlusPlugin::~FlutterBluePlusPlugin() {}
+    // the conflation key of aligned batches, no notification has it (a device address is never 0)
+    const uint64_t alignedBatchKey = 0;
 
-    winrt::fire_and_forget FlutterBluePlusPlugin::InitializeAsync() {
-        auto bluetoothAdapter = co_await BluetoothAdapter::GetDefaultAsync();
+    struct FlowEvent {
+        uint64_t key; // device or characteristic
+        const char* method;
+        EncodableMap event;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    // Events native sends on its own (notifications or aligned batches of them, scan results) spend one credit each.
+    // Dart grants credits back as it handles them, so at most 'credits' events wait in the
+    // engine's queue at once, however busy the UI isolate is.
+    struct FlowStream {
+        std::mutex mutex;
+        int32_t policy = FLOW_NONE;
+        int64_t credits = 0;
+        size_t backlogCapacity = 0;
+        std::deque<FlowEvent> backlog;
+
+        // Events that have a credit, waiting to be sent. Only one thread sends at a time
+        // ('sending'), outside the lock, so the callbacks never wait on the platform channel
+        // and the events still leave in order.
+        std::vector<FlowEvent> outbox;
+        bool sending = false;
+
+        // counters
+        int64_t sent = 0;
+        int64_t dropped = 0;
+        int64_t conflated = 0;
+    };
+
+    // the field types of a payload layout, see 'setNotifyValue'
+    enum PayloadFieldType : int32_t {
+        PAYLOAD_UINT8 = 0,
+        PAYLOAD_INT8 = 1,
+        PAYLOAD_UINT16 = 2,
+        PAYLOAD_INT16 = 3,
+        PAYLOAD_UINT32 = 4,
+        PAYLOAD_INT32 = 5,
+        PAYLOAD_FLOAT32 = 6,
+    };
 
-        if (bluetoothAdapter != nullptr) {
-            bluetoothRadio = co_await bluetoothAdapter.GetRadioAsync();
+    size_t payloadFieldSize(int32_t type) {
+        switch (type) {
+            case PAYLOAD_UINT8:
+            case PAYLOAD_INT8: return 1;
+            case PAYLOAD_UINT16:
+            case PAYLOAD_INT16: return 2;
+            default: return 4;
         }
     }
 
-    void FlutterBluePlusPlugin::HandleMethodCall(
-        const flutter::MethodCall<flutter::EncodableValue>& method_call,
-        std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
-        auto method_name = method_call.method_name();
-        FBPLog(LDEBUG, L"MethodName: " + winrt::to_hstring(method_name));
+    struct PayloadField {
+        int32_t type;
+        double scale = 1.0;
+        double offset = 0.0;
+    };
 
-        if (method_name.compare("flutterHotRestart") == 0) {
-            result->Success(EncodableValue(true));
-        }
-        else if (method_name.compare("connectedCount") == 0) {
-            result->Success((int32_t)connectedDevices.size());
+    // Decodes notifications that are packed records of fixed size fields,
+    // e.g. 20 x int16 accelerometer samples, into a flat Float32List or Int32List.
+    // Each field becomes raw * scale + offset. A trailing partial record is ignored.
+    struct PayloadLayout {
+        std::vector<PayloadField> fields;
+        bool bigEndian = false;
+        int32_t repeat = 0; // records per payload, 0 = as many as the payload holds
+        bool asInt32 = false;
+        size_t recordSize = 0;
+
+        double ReadField(const uint8_t* data, int32_t type) const {
+            size_t size = payloadFieldSize(type);
+            uint32_t raw = 0;
+            for (size_t i = 0; i < size; i++) {
+                raw |= (uint32_t)data[bigEndian ? size - 1 - i : i] << (8 * i);
+            }
+            switch (type) {
+                case PAYLOAD_UINT8: return (uint8_t)raw;
+                case PAYLOAD_INT8: return (int8_t)(uint8_t)raw;
+                case PAYLOAD_UINT16: return (uint16_t)raw;
+                case PAYLOAD_INT16: return (int16_t)(uint16_t)raw;
+                case PAYLOAD_INT32: return (int32_t)raw;
+                case PAYLOAD_FLOAT32: {
+                    float f;
+                    std::memcpy(&f, &raw, sizeof(f));
+                    return f;
+                }
+                default: return raw;
+            }
         }
-        else if (method_name.compare("setLogLevel") == 0) {
-            logLevel = std::get<int32_t>(*method_call.arguments());
-            FBPLog(LINFO, L"LogLevel: " + winrt::to_hstring(logLevel));
 
-            result->Success(EncodableValue(true));
-        }
-        else if (method_name.compare("getAdapterState") == 0) {
-            result->Success(EncodableMap{
-                {"adapter_state", to_bmAdapterState(bluetoothRadio ? bluetoothRadio.State() : RadioState::Unknown)}
-            });
-        }
-        else if (method_name.compare("getSystemDevices") == 0) {
-            EncodableList devices;
-            result->Success(EncodableMap{
-                    {"devices", devices}
-            });
+        template <typename T>
+        std::vector<T> DecodeAs(const std::vector<uint8_t>& bytes) const {
+            size_t records = recordSize ? bytes.size() / recordSize : 0;
+            if (repeat > 0 && (size_t)repeat < records) {
+                records = (size_t)repeat;
+            }
+            std::vector<T> out;
+            out.reserve(records * fields.size());
+            const uint8_t* data = bytes.data();
+            for (size_t r = 0; r < records; r++) {
+                for (const auto& field : fields) {
+                    double value = ReadField(data, field.type) * field.scale + field.offset;
+                    if constexpr (std::is_same_v<T, float>) {
+                        out.push_back((float)value);
+                    } else {
+                        out.push_back((int32_t)std::llround(value));
+                    }
+                    data += payloadFieldSize(field.type);
+                }
+            }
+            return out;
         }
-        else if (method_name.compare("startScan") == 0) {
-            const auto *arguments = std::get_if<EncodableMap>(method_call.arguments());
 
-            // check adapter state
-            if (isAdapterOn(bluetoothRadio) == false) {
-                result->Error("startScan", "bluetooth must be turned on.");
-                return;
+        EncodableValue Decode(const std::vector<uint8_t>& bytes) const {
+            if (asInt32) {
+                return EncodableValue(DecodeAs<int32_t>(bytes));
             }
+            return EncodableValue(DecodeAs<float>(bytes));
+        }
+    };
 
-            auto withServices_it = arguments->find(EncodableValue("with_services"));
-            if (withServices_it != arguments->end()) {
-                targetServiceUuids = std::move(std::get<EncodableList>(withServices_it->second));
-            }
+    double optionalDouble(const EncodableMap& args, const char* key, double defaultValue) {
+        auto it = args.find(EncodableValue(key));
+        if (it != args.end() && std::holds_alternative<double>(it->second)) {
+            return std::get<double>(it->second);
+        }
+        return defaultValue;
+    }
 
-            if (!bluetoothLEWatcher) {
-                bluetoothLEWatcher = BluetoothLEAdvertisementWatcher();
-                bluetoothLEWatcher.ScanningMode(BluetoothLEScanningMode::Active);
-                bluetoothLEWatcherReceivedToken = bluetoothLEWatcher.Received({ this, &FlutterBluePlusPlugin::BluetoothLEWatcher_Received });
-            }
-            bluetoothLEWatcher.Start();
-            result->Success(EncodableValue(true));
+    // the 'payload_layout' argument of setNotifyValue, null if absent
+    std::shared_ptr<const PayloadLayout> parsePayloadLayout(const EncodableMap& args) {
+        auto it = args.find(EncodableValue("payload_layout"));
+        if (it == args.end() || it->second.IsNull()) {
+            return nullptr;
         }
-        else if (method_name.compare("stopScan") == 0) {
-            if (bluetoothLEWatcher) {
-                bluetoothLEWatcher.Stop();
-                bluetoothLEWatcher.Received(bluetoothLEWatcherReceivedToken);
+        const auto& map = argumentAs<EncodableMap>(&it->second, "payload_layout");
+
+        auto layout = std::make_shared<PayloadLayout>();
+        for (const auto& item : requiredArg<EncodableList>(map, "fields")) {
+            const auto& f = argumentAs<EncodableMap>(&item, "fields");
+            PayloadField field;
+            field.type = requiredArg<int32_t>(f, "type");
+            if (field.type < PAYLOAD_UINT8 || field.type > PAYLOAD_FLOAT32) {
+                throw ArgumentError{ "invalid payload field type: " + std::to_string(field.type) };
             }
-            bluetoothLEWatcher = nullptr;
-            result->Success(EncodableValue(true));
+            field.scale = optionalDouble(f, "scale", 1.0);
+            field.offset = optionalDouble(f, "offset", 0.0);
+            layout->recordSize += payloadFieldSize(field.type);
+            layout->fields.push_back(field);
+        }
+        if (layout->fields.empty()) {
+            throw ArgumentError{ "payload_layout has no fields" };
         }
-        else if (method_name.compare("connect") == 0) {
-            auto args = std::get<EncodableMap>(*method_call.arguments());
-            std::string remoteId = std::get<std::string>(args[EncodableValue("remote_id")]);
-            FBPLog(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+        layout->bigEndian = requiredArg<bool>(map, "big_endian");
+        layout->repeat = optionalInt32(map, "repeat", 0);
+        layout->asInt32 = requiredArg<bool>(map, "as_int32");
+        return layout;
+    }
 
-            // "d9:da:10:8a:32:3a" to "d9da108a323a"
-            remoteId = remove_string(remoteId, ":");
+#if FBP_DART_API_DL
+    template <typename T>
+    void freeExternalVector(void*, void* peer) {
+        delete static_cast<std::vector<T>*>(peer);
+    }
 
-            ConnectAsync(std::stoull(remoteId.c_str(), 0, 16));
-            result->Success(EncodableValue(true));
+    // Posts values to a dart port, from any thread. The vector becomes external typed
+    // data that dart owns until it is garbage collected, so its payload is never copied.
+    template <typename T>
+    bool postToPort(int64_t port, std::vector<T> values, Dart_TypedData_Type type) {
+        auto owned = new std::vector<T>(std::move(values));
+
+        Dart_CObject message;
+        message.type = Dart_CObject_kExternalTypedData;
+        message.value.as_external_typed_data.type = type;
+        message.value.as_external_typed_data.length = (intptr_t)owned->size();
+        message.value.as_external_typed_data.data = reinterpret_cast<uint8_t*>(owned->data());
+        message.value.as_external_typed_data.peer = owned;
+        message.value.as_external_typed_data.callback = freeExternalVector<T>;
+
+        // on failure dart does not take ownership
+        if (!Dart_PostCObject_DL(port, &message)) {
+            delete owned;
+            return false;
         }
-        else if (method_name.compare("disconnect") == 0) {
-            std::string remoteId = std::get<std::string>(*method_call.arguments());
-            FBPLog(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+        return true;
+    }
+#endif
 
-            // "d9:da:10:8a:32:3a" to "d9da108a323a"
-            remoteId = remove_string(remoteId, ":");
+    // sizes of the native snapshot, see NativeSnapshot
+    const size_t snapshotDevices = 32;
+    const size_t snapshotChannels = 128;
+    const size_t snapshotValueBytes = 512;
 
-            CleanConnection(std::stoull(remoteId.c_str(), 0, 16));
-            result->Success(EncodableValue(true));
+    struct DeviceSnapshot {
+        std::atomic<uint64_t> bluetoothAddress{ 0 }; // 0 = free slot
+        std::atomic<bool> connected{ false };
+        std::atomic<int32_t> mtu{ 0 };
+    };
+
+    // A seqlock: the sequence is odd while a writer copies a value in. Readers copy the
+    // value out and retry until they see the same even sequence before and after.
+    struct ValueSnapshot {
+        std::atomic<uint32_t> sequence{ 0 };
+        std::atomic<int32_t> length{ -1 }; // -1 = no value
+        uint8_t bytes[snapshotValueBytes];
+    };
+
+    // Waiting on a seqlock: pause briefly at first, then give up the time slice,
+    // as the other side may have been preempted in the middle of its copy.
+    inline void seqlockBackoff(uint32_t& spins) {
+        if (++spins < 64) {
+            YieldProcessor();
+        } else {
+            SwitchToThread();
         }
-        else if (method_name.compare("readRssi") == 0) {
-            // No way currently to get connected RSSI on Windows
-            // https://stackoverflow.com/questions/64096245/how-to-get-rssi-of-a-connected-bluetoothledevice-in-uwp
+    }
 
-            std::string remoteId = std::get<std::string>(*method_call.arguments());
-            FBPLog(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+    // returned for a device or channel that does not fit in the snapshot
+    const int32_t snapshotOverflow = -2;
 
-            result->Success(EncodableValue(true));
+    // keep in sync with NativeCounter in native_snapshot.dart
+    enum SnapshotCounter : int32_t {
+        COUNTER_NOTIFICATIONS = 0,
+        COUNTER_SCAN_RESULTS = 1,
+        COUNTER_CONNECTS = 2,
+        COUNTER_DISCONNECTS = 3,
+        COUNTER_COUNT = 4,
+    };
 
-            method_channel_->InvokeMethod("OnReadRssi",
-                std::make_unique<EncodableValue>(EncodableMap{
-                      {"remote_id", EncodableValue(remoteId)},
-                      {"rssi", EncodableValue(0)},
-                      {"success", EncodableValue(true)},
-                      {"error_string", EncodableValue("success")},
-                      {"error_code", EncodableValue(0)},
-                }));
+    // Native state that the exported C functions read from any thread without locking,
+    // so dart can query it synchronously over FFI. The plugin updates it as things change.
+    //   - devices are kept in fixed slots, claimed on connect & freed on disconnect.
+    //     Devices connected while every slot is taken are counted in untrackedDevices.
+    //   - last values are kept per routing id (the channel id dart gives in setNotifyValue),
+    //     for notified & polled values. Higher ids read as snapshotOverflow.
+    struct NativeSnapshot {
+        std::atomic<int32_t> adapterState{ 0 };
+        std::atomic<int32_t> connectedCount{ 0 };
+        std::array<DeviceSnapshot, snapshotDevices> devices;
+        std::atomic<int32_t> untrackedDevices{ 0 };
+        std::array<ValueSnapshot, snapshotChannels> values;
+        std::array<std::atomic<int64_t>, COUNTER_COUNT> counters{};
+
+        DeviceSnapshot* FindDevice(uint64_t bluetoothAddress) {
+            if (bluetoothAddress == 0) {
+                return nullptr; // would match a free slot
+            }
+            for (auto& device : devices) {
+                if (device.bluetoothAddress.load(std::memory_order_relaxed) == bluetoothAddress) {
+                    return &device;
+                }
+            }
+            return nullptr;
         }
-        else if (method_name.compare("discoverServices") == 0) {
-            std::string remoteId = std::get<std::string>(*method_call.arguments());
-            FBPLog(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
 
-            // "d9:da:10:8a:32:3a" to "d9da108a323a"
-            std::string remoteIdString = remove_string(remoteId, ":");
-            auto remoteIdInt = std::stoull(remoteIdString.c_str(), 0, 16);
+        void AddDevice(uint64_t bluetoothAddress) {
+            counters[COUNTER_CONNECTS]++;
+            auto device = FindDevice(bluetoothAddress);
+            for (size_t i = 0; i < devices.size() && !device; i++) {
+                uint64_t free = 0;
+                if (devices[i].bluetoothAddress.compare_exchange_strong(free, bluetoothAddress)) {
+                    device = &devices[i];
+                }
+            }
+            if (device) {
+                device->mtu = 23;
+                device->connected = true;
+            } else {
+                untrackedDevices++;
+            }
+        }
 
-            auto it = connectedDevices.find(remoteIdInt);
-            if (it == connectedDevices.end()) {
-                result->Error("discoverServices", "Device is disconnected. remoteId:" + remoteId);
+        void RemoveDevice(uint64_t bluetoothAddress) {
+            counters[COUNTER_DISCONNECTS]++;
+            if (auto device = FindDevice(bluetoothAddress)) {
+                device->connected = false;
+                device->mtu = 0;
+                device->bluetoothAddress = 0;
                 return;
             }
-            DiscoverServicesAsync(*it->second);
-            result->Success(EncodableValue(true));
+            int32_t untracked = untrackedDevices.load();
+            while (untracked > 0 && !untrackedDevices.compare_exchange_weak(untracked, untracked - 1)) {
+            }
         }
-        else if (method_name.compare("setNotifyValue") == 0) {
-            auto args = std::get<EncodableMap>(*method_call.arguments());
-            std::string remoteId = std::get<std::string>(args[EncodableValue("remote_id")]);
-            FBPLog(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
-
-            auto characteristicUuid = std::get<std::string>(args[EncodableValue("characteristic_uuid")]);
-            auto serviceUuid = std::get<std::string>(args[EncodableValue("service_uuid")]);
-            //auto secondaryServiceUuid = std::get<std::string>(args[EncodableValue("secondary_service_uuid")]);
-            auto enable = std::get<bool>(args[EncodableValue("enable")]);
 
-            // "d9:da:10:8a:32:3a" to "d9da108a323a"
-            std::string remoteIdString = remove_string(remoteId, ":");
-            auto remoteIdInt = std::stoull(remoteIdString.c_str(), 0, 16);
+        // a device without a slot may be connected, the snapshot cannot tell
+        bool Knows(uint64_t bluetoothAddress) {
+            return FindDevice(bluetoothAddress) || untrackedDevices.load() == 0;
+        }
 
-            auto it = connectedDevices.find(remoteIdInt);
-            if (it == connectedDevices.end()) {
-                result->Error("setNotifyValue", "Device is disconnected. remoteId:" + remoteId);
+        // length -1 clears the value
+        void SetValue(int32_t channelId, const uint8_t* data, int32_t length) {
+            if (channelId <= 0 || (size_t)channelId >= values.size()) {
                 return;
             }
-
-            SetNotifiableAsync(*it->second, serviceUuid, characteristicUuid, enable ? 1 : 0);
-            result->Success(EncodableValue(true));
-        }
-        else if (method_name.compare("requestMtu") == 0) {
-            result->Error("requestMtu", "Windows does not allow mtu requests to the peripheral");
+            auto& value = values[channelId];
+
+            // writers take turns making the sequence odd
+            uint32_t sequence = value.sequence.load(std::memory_order_relaxed);
+            uint32_t spins = 0;
+            while ((sequence & 1) || !value.sequence.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire)) {
+                seqlockBackoff(spins);
+                sequence = value.sequence.load(std::memory_order_relaxed);
+            }
+            if (length > 0) {
+                std::memcpy(value.bytes, data, (size_t)length < snapshotValueBytes ? (size_t)length : snapshotValueBytes);
+            }
+            value.length.store(length, std::memory_order_relaxed);
+            value.sequence.store(sequence + 2, std::memory_order_release);
         }
-        else if (method_name.compare("readCharacteristic") == 0) {
-            auto args = std::get<EncodableMap>(*method_call.arguments());
-            std::string remoteId = std::get<std::string>(args[EncodableValue("remote_id")]);
-            FBPLog(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
 
-            auto characteristicUuid = std::get<std::string>(args[EncodableValue("characteristic_uuid")]);
-            auto serviceUuid = std::get<std::string>(args[EncodableValue("service_uuid")]);
-            //auto secondaryServiceUuid = std::get<std::string>(args[EncodableValue("secondary_service_uuid")]);
-
-            // "d9:da:10:8a:32:3a" to "d9da108a323a"
-            std::string remoteIdString = remove_string(remoteId, ":");
-            auto remoteIdInt = std::stoull(remoteIdString.c_str(), 0, 16);
-
-            auto it = connectedDevices.find(remoteIdInt);
-            if (it == connectedDevices.end()) {
-                result->Error("readCharacteristic", "Device is disconnected. remoteId: " + remoteId);
-                return;
+        // returns the full length of the value, of which at most 'capacity' bytes are copied.
+        // -1 = no value, snapshotOverflow = the channel id is beyond the snapshot.
+        int32_t ReadValue(int32_t channelId, uint8_t* out, size_t capacity) {
+            if (channelId <= 0) {
+                return -1;
+            }
+            if ((size_t)channelId >= values.size()) {
+                return snapshotOverflow;
             }
+            auto& value = values[channelId];
+            for (uint32_t spins = 0;; seqlockBackoff(spins)) {
+                uint32_t before = value.sequence.load(std::memory_order_acquire);
+                if (before & 1) {
+                    continue;
+                }
+                int32_t length = value.length.load(std::memory_order_relaxed);
+                size_t copy = length < 0 ? 0 : (size_t)length;
+                copy = copy < capacity ? copy : capacity;
+                copy = copy < snapshotValueBytes ? copy : snapshotValueBytes;
+                std::memcpy(out, value.bytes, copy);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (value.sequence.load(std::memory_order_relaxed) == before) {
+                    return length;
+                }
+            }
+        }
 
-            ReadValueAsync(*it->second, serviceUuid, characteristicUuid);
-            result->Success(EncodableValue(true));
+        void ClearValues() {
+            for (int32_t i = 1; i < (int32_t)values.size(); i++) {
+                SetValue(i, nullptr, -1);
+            }
         }
-        else if (method_name.compare("writeCharacteristic") == 0) {
-            auto args = std::get<EncodableMap>(*method_call.arguments());
-            std::string remoteId = std::get<std::string>(args[EncodableValue("remote_id")]);
-            FBPLog(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+    };
+
+    // the exported C functions have no plugin instance to ask
+    NativeSnapshot nativeSnapshot;
+
+    // Monotonic microseconds, from QueryPerformanceCounter. Notifications are stamped
+    // with it as they arrive, before any channel or isolate scheduling delay.
+    int64_t monotonicMicros() {
+        static const int64_t frequency = [] {
+            LARGE_INTEGER f;
+            QueryPerformanceFrequency(&f);
+            return (int64_t)f.QuadPart;
+        }();
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+        return (counter.QuadPart / frequency) * 1000000 + (counter.QuadPart % frequency) * 1000000 / frequency;
+    }
 
-            auto characteristicUuid = std::get<std::string>(args[EncodableValue("characteristic_uuid")]);
-            auto serviceUuid = std::get<std::string>(args[EncodableValue("service_uuid")]);
-            //auto secondaryServiceUuid = std::get<std::string>(args[EncodableValue("secondary_service_uuid")]);
-            auto writeType = std::get<int32_t>(args[EncodableValue("write_type")]);
-            //auto allowLongWrite = std::get<int32_t>(args[EncodableValue("allow_long_write")]);
-            auto value = std::get<std::string>(args[EncodableValue("value")]);
+    // Notifications of several devices, held back and sent in time order, see 'setAlignment'.
+    // An event waits at least one window, so one that arrives up to a window late is still in order.
+    // Notifications held back until they are due. Bounded, a full buffer drops its oldest
+    // event, so a window longer than dart can keep up with does not grow memory.
+    const int32_t defaultAlignmentCapacity = 4096;
+
+    struct AlignmentBuffer {
+        std::mutex mutex;
+        int32_t window = 0; // milliseconds, 0 = off
+        uint32_t generation = 0;
+        size_t capacity = (size_t)defaultAlignmentCapacity;
+        std::deque<std::pair<int64_t, EncodableMap>> events; // timestamp, event
+    };
 
-            auto hexValue = hex_to_bytes(value);
+    // a method call that arrived before the adapter was ready
+    struct QueuedMethodCall {
+        std::string method;
+        std::unique_ptr<EncodableValue> arguments;
+        MethodResultPtr result;
+    };
 
-            // "d9:da:10:8a:32:3a" to "d9da108a323a"
-            std::string remoteIdString = remove_string(remoteId, ":");
-            auto remoteIdInt = std::stoull(remoteIdString.c_str(), 0, 16);
+    // an operation waiting in an OpQueue, signaled when its turn comes or it is canceled
+    struct OpWaiter {
+        winrt::handle signal{ CreateEventW(nullptr, TRUE, FALSE, nullptr) };
+        bool canceled = false;
+    };
 
-            auto it = connectedDevices.find(remoteIdInt);
-            if (it == connectedDevices.end()) {
-                result->Error("writeCharacteristic", "Device is disconnected. remoteId:" + remoteId);
-                return;
+    // The gatt operations of a device, one at a time. When one finishes, the next is
+    // the oldest waiting operation of the highest priority, so a control write only
+    // waits for the transaction on the air, not for the bulk reads queued before it.
+    // Shared with the waiting coroutines: once closed, they must not touch the agent.
+    struct OpQueue {
+        std::mutex mutex;
+        bool busy = false;
+        std::atomic<bool> closed{ false };
+        std::array<std::deque<std::shared_ptr<OpWaiter>>, PRIORITY_COUNT> waiting;
+
+        // returns a waiter to wait on, or nothing if the queue was free and is now ours
+        std::shared_ptr<OpWaiter> Enter(int32_t priority) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!busy || closed) {
+                busy = true;
+                return {};
             }
+            auto waiter = std::make_shared<OpWaiter>();
+            waiting[priority].push_back(waiter);
+            return waiter;
+        }
 
-            WriteValueAsync(*it->second, serviceUuid, characteristicUuid, hexValue, writeType);
-            result->Success(EncodableValue(true));
+        IAsyncAction WaitAsync(int32_t priority) {
+            auto waiter = Enter(priority);
+            if (waiter) {
+                co_await winrt::resume_on_signal(waiter->signal.get());
+            }
         }
-        else {
-            result->NotImplemented();
+
+        // hands the queue to the next operation
+        void Leave() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& lane : waiting) {
+                if (!lane.empty()) {
+                    SetEvent(lane.front()->signal.get());
+                    lane.pop_front();
+                    return;
+                }
+            }
+            busy = false;
         }
-    }
 
-    std::vector<uint8_t> parseManufacturerDataHead(BluetoothLEAdvertisement advertisement)
-    {
-        if (advertisement.ManufacturerData().Size() == 0)
-            return std::vector<uint8_t>();
+        // Takes a canceled operation out of its lane, so it never gets the turn.
+        // Does nothing if its turn already came.
+        void Cancel(const std::shared_ptr<OpWaiter>& waiter) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& lane : waiting) {
+                auto it = std::find(lane.begin(), lane.end(), waiter);
+                if (it != lane.end()) {
+                    lane.erase(it);
+                    waiter->canceled = true;
+                    SetEvent(waiter->signal.get());
+                    return;
+                }
+            }
+        }
 
-        auto manufacturerData = advertisement.ManufacturerData().GetAt(0);
-        // FIXME Compat with REG_DWORD_BIG_ENDIAN
-        uint8_t* prefix = uint16_t_union{ manufacturerData.CompanyId() }.bytes;
-        auto result = std::vector<uint8_t>{ prefix, prefix + sizeof(uint16_t_union) };
+        // wakes every waiting operation, they find the queue closed
+        void Close() {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            for (auto& lane : waiting) {
+                for (auto& waiter : lane) {
+                    SetEvent(waiter->signal.get());
+                }
+                lane.clear();
+            }
+        }
+    };
+
+    // an operation's turn on an OpQueue, handed on when it goes out of scope
+    struct OpTurn {
+        std::shared_ptr<OpQueue> queue;
+        ~OpTurn() { queue->Leave(); }
+    };
+
+    // how dart wants the notifications of one attribute handle, see setNotifyValue
+    struct NotifyRoute {
+        int32_t channelId = 0;
+        std::shared_ptr<const PayloadLayout> payloadLayout;
+        int64_t port = 0;
+    };
+
+    // Shared by the plugin's map and the coroutines working on the device, so a coroutine
+    // that outlives the connection still has an agent to look at, closed but valid.
+    struct BluetoothDeviceAgent {
+        BluetoothLEDevice device;
+        const uint64_t bluetoothAddress;
+        winrt::event_token connnectionStatusChangedToken;
+
+        // Guards the gatt caches, the notify routes, the session, the device handle & the
+        // connection parameters request, which the platform thread, the threadpool &
+        // ValueChanged callbacks all touch. Never held across a co_await.
+        std::mutex gattMutex;
+        std::map<std::string, GattDeviceService> gattServices;
+        std::map<std::string, GattCharacteristic> gattCharacteristics;
+        std::map<std::string, winrt::event_token> valueChangedTokens;
+
+        // attribute handle -> routing id given by dart in setNotifyValue
+        std::map<uint16_t, int32_t> notifyChannelIds;
+
+        // attribute handle -> how to decode its notifications, given by dart in setNotifyValue
+        std::map<uint16_t, std::shared_ptr<const PayloadLayout>> payloadLayouts;
+
+        // attribute handle -> dart SendPort that receives its notifications instead of the method channel
+        std::map<uint16_t, int64_t> notifyPorts;
+
+        // attribute handle -> last value read or notified, to serve reads with a max age.
+        // attribute handle -> reads waiting on the read already in flight for that handle.
+        std::mutex valuesMutex;
+        std::map<uint16_t, CachedValue> lastValues;
+        std::map<uint16_t, std::vector<MethodResultPtr>> pendingReads;
+
+        // characteristic -> generation of its running poll, also guarded by valuesMutex
+        std::map<std::string, uint32_t> polls;
+
+        // reads, writes, setNotifyValue & polls, by priority
+        std::shared_ptr<OpQueue> opQueue = std::make_shared<OpQueue>();
+
+        // reports the negotiated mtu, see OpenSessionAsync
+        GattSession session{ nullptr };
+        winrt::event_token maxPduSizeChangedToken;
+
+        // while reconnecting, the agent keeps its gatt cache & ValueChanged handlers
+        ReconnectPolicy reconnectPolicy;
+        std::atomic<bool> reconnecting{ false };
+
+#if FBP_CONNECTION_PARAMETERS
+        // the preferred connection parameters apply until this request is closed
+        BluetoothLEPreferredConnectionParametersRequest connectionParametersRequest{ nullptr };
+        winrt::event_token connectionParametersChangedToken;
+        winrt::event_token connectionPhyChangedToken;
+#endif
+
+        BluetoothDeviceAgent(BluetoothLEDevice device, winrt::event_token connnectionStatusChangedToken)
+            : device(device),
+            bluetoothAddress(device.BluetoothAddress()),
+            connnectionStatusChangedToken(connnectionStatusChangedToken) {}
+
+        ~BluetoothDeviceAgent() {
+            Close();
+        }
+
+        // Releases the OS handles now, rather than whenever the last reference goes away.
+        // Windows keeps the link up while the device or any of its services is still open.
+        void Close() {
+            opQueue->Close();
+            std::lock_guard<std::mutex> lock(gattMutex);
+            if (session) {
+                session.MaxPduSizeChanged(maxPduSizeChangedToken);
+                session.Close();
+                session = nullptr;
+            }
+            for (auto& service : gattServices) {
+                service.second.Close();
+            }
+            gattServices.clear();
+            gattCharacteristics.clear();
+            if (device) {
+                device.Close();
+                device = nullptr;
+            }
+        }
+
+        // the device handle, or null once closed. Copied, so it stays usable while the agent closes.
+        BluetoothLEDevice Device() {
+            std::lock_guard<std::mutex> lock(gattMutex);
+            return device;
+        }
+
+        // only asks the device for this service, rather than enumerating all of them
+        IAsyncOperation<GattDeviceService> GetServiceAsync(std::string service) {
+            BluetoothLEDevice openDevice{ nullptr };
+            {
+                std::lock_guard<std::mutex> lock(gattMutex);
+                auto it = gattServices.find(service);
+                if (it != gattServices.end()) {
+                    co_return it->second;
+                }
+                openDevice = device;
+            }
+            if (!openDevice) {
+                throw winrt::hresult_error(RO_E_CLOSED, L"device is disconnected");
+            }
+
+            auto serviceResult = co_await openDevice.GetGattServicesForUuidAsync(parseUuid(service));
+            if (serviceResult.Status() != GattCommunicationStatus::Success)
+                co_return nullptr;
+
+            std::lock_guard<std::mutex> lock(gattMutex);
+            if (serviceResult.Services().Size() > 0) {
+                auto gattService = serviceResult.Services().GetAt(0);
+                if (opQueue->closed) {
+                    gattService.Close(); // Close() already ran, it would keep the link up
+                    throw winrt::hresult_error(RO_E_CLOSED, L"device is disconnected");
+                }
+                gattServices.insert(std::make_pair(service, gattService));
+            }
+            co_return gattServices.at(service);
+        }
+
+        IAsyncOperation<GattCharacteristic> GetCharacteristicAsync(std::string service, std::string characteristic) {
+            {
+                std::lock_guard<std::mutex> lock(gattMutex);
+                auto it = gattCharacteristics.find(characteristic);
+                if (it != gattCharacteristics.end()) {
+                    co_return it->second;
+                }
+            }
+
+            auto gattService = co_await GetServiceAsync(service);
+
+            auto characteristicResult = co_await gattService.GetCharacteristicsForUuidAsync(parseUuid(characteristic));
+            if (characteristicResult.Status() != GattCommunicationStatus::Success)
+                co_return nullptr;
+
+            std::lock_guard<std::mutex> lock(gattMutex);
+            if (characteristicResult.Characteristics().Size() > 0) {
+                gattCharacteristics.insert(std::make_pair(characteristic, characteristicResult.Characteristics().GetAt(0)));
+            }
+            co_return gattCharacteristics.at(characteristic);
+        }
+
+        // the cached characteristic, or null if it was not resolved yet
+        GattCharacteristic FindCharacteristic(const std::string& characteristic) {
+            std::lock_guard<std::mutex> lock(gattMutex);
+            auto it = gattCharacteristics.find(characteristic);
+            return it != gattCharacteristics.end() ? it->second : nullptr;
+        }
+
+        NotifyRoute RouteOf(uint16_t handle) {
+            std::lock_guard<std::mutex> lock(gattMutex);
+            NotifyRoute route;
+            auto channel = notifyChannelIds.find(handle);
+            if (channel != notifyChannelIds.end()) {
+                route.channelId = channel->second;
+            }
+            auto layout = payloadLayouts.find(handle);
+            if (layout != payloadLayouts.end()) {
+                route.payloadLayout = layout->second;
+            }
+            auto port = notifyPorts.find(handle);
+            if (port != notifyPorts.end()) {
+                route.port = port->second;
+            }
+            return route;
+        }
+
+        // the characteristics with a ValueChanged handler
+        std::vector<GattCharacteristic> Subscribed() {
+            std::lock_guard<std::mutex> lock(gattMutex);
+            std::vector<GattCharacteristic> subscribed;
+            for (auto& tokenPair : valueChangedTokens) {
+                if (tokenPair.second) {
+                    subscribed.push_back(gattCharacteristics.at(tokenPair.first));
+                }
+            }
+            return subscribed;
+        }
+    };
+
+    class FlutterBluePlusPlugin : public flutter::Plugin {
+    public:
+        static void RegisterWithRegistrar(flutter::PluginRegistrarWindows* registrar);
+
+        FlutterBluePlusPlugin();
+
+        virtual ~FlutterBluePlusPlugin();
+    private:
+        winrt::fire_and_forget InitializeAsync();
+
+        // Called when a method is called on this plugin's channel from Dart.
+        void HandleMethodCall(
+            const flutter::MethodCall<flutter::EncodableValue>& method_call,
+            std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result);
+        void DispatchMethodCall(const std::string& method_name, const EncodableValue* arguments, MethodResultPtr result);
+
+        // Method calls are queued until InitializeAsync has found the adapter,
+        // so an early call sees the real adapter instead of a null radio.
+        std::mutex initializeMutex;
+        std::atomic<bool> initialized{ false };
+        std::vector<QueuedMethodCall> queuedCalls;
+
+        // One handler per method, found by name in a sorted table.
+        // A handler that defers its result moves it out; otherwise it stays with the caller.
+        using MethodHandler = void (FlutterBluePlusPlugin::*)(const EncodableValue* arguments, MethodResultPtr& result);
+        struct MethodEntry {
+            const char* name;
+            MethodHandler handler;
+        };
+        void HandleFlutterHotRestart(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleConnectedCount(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleSetLogLevel(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetAdapterState(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetAdapterCapabilities(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetAdapterName(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleIsSupported(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetSystemDevices(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetBondedDevices(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleStartScan(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleStopScan(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleConnect(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleDisconnect(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleReadRssi(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleDiscoverServices(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleDiscoverDescriptors(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleSetNotifyValue(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleSetAutoConnect(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandlePerformBatch(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleStartPolling(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleStopPolling(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetNativeTrace(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleSetNativeTracing(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetNativeTraceJson(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetNativeStats(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleCancelOperation(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleRequestMtu(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleRequestConnectionPriority(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleSetPreferredPhy(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGetConnectionParameters(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleReadCharacteristic(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleWriteCharacteristic(const EncodableValue* arguments, MethodResultPtr& result);
+
+        std::unique_ptr<flutter::MethodChannel<EncodableValue>> method_channel_;
+
+        EncodableList targetServiceUuids;
+
+        Radio bluetoothRadio{ nullptr };
+        AdapterCapabilities adapterCapabilities;
+
+        // adapter state changes are pushed to dart, instead of dart polling for them
+        winrt::event_token radioStateChangedToken;
+        std::atomic<int32_t> lastAdapterState{ -1 };
+        void Radio_StateChanged(Radio sender, IInspectable args);
+
+        // the watcher is replaced on the platform thread, and paused & resumed by the duty cycle
+        std::mutex scanMutex;
+        BluetoothLEAdvertisementWatcher bluetoothLEWatcher{ nullptr };
+        winrt::event_token bluetoothLEWatcherReceivedToken;
+        void StopWatcher();
+
+        // devices connected to the system, by any app
+        winrt::fire_and_forget GetSystemDevicesAsync(MethodResultPtr result);
+
+        // Paired devices are enumerated once by a DeviceWatcher, which then keeps the
+        // list current, so every later getBondedDevices is answered from memory.
+        std::mutex pairedDevicesMutex;
+        DeviceWatcher pairedDevicesWatcher{ nullptr };
+        winrt::event_token pairedDevicesAddedToken;
+        winrt::event_token pairedDevicesUpdatedToken;
+        winrt::event_token pairedDevicesRemovedToken;
+        winrt::event_token pairedDevicesEnumeratedToken;
+        winrt::event_token pairedDevicesStoppedToken;
+        bool pairedDevicesEnumerated = false;
+        std::map<winrt::hstring, DeviceInformation> pairedDevices{};
+        std::vector<MethodResultPtr> pairedDevicesResults;
+        EncodableMap PairedDevicesList();
+        void PairedDevicesWatcher_Added(DeviceWatcher sender, DeviceInformation info);
+        void PairedDevicesWatcher_Updated(DeviceWatcher sender, DeviceInformationUpdate update);
+        void PairedDevicesWatcher_Removed(DeviceWatcher sender, DeviceInformationUpdate update);
+        void PairedDevicesWatcher_EnumerationCompleted(DeviceWatcher sender, IInspectable args);
+        void PairedDevicesWatcher_Stopped(DeviceWatcher sender, IInspectable args);
+        void BluetoothLEWatcher_Received(BluetoothLEAdvertisementWatcher sender, BluetoothLEAdvertisementReceivedEventArgs args);
+        winrt::fire_and_forget SendScanResultAsync(BluetoothLEAdvertisementReceivedEventArgs args, BluetoothLEAdvertisement scanResponse);
+
+        // scan responses are merged into the next advertisement of the same device
+        std::mutex scanResponsesMutex;
+        std::map<uint64_t, ScanResponse> scanResponses{};
+
+        // duty cycle: the watcher runs for scanWindow out of every scanInterval
+        std::atomic<uint32_t> scanGeneration{ 0 };
+        winrt::fire_and_forget ScanDutyCycleAsync(uint32_t generation, std::chrono::milliseconds scanWindow, std::chrono::milliseconds scanInterval);
+
+        // Read from the watcher, threadpool & ValueChanged threads too, so guarded by devicesMutex.
+        // FindAgent returns a copy, which keeps the agent alive while the caller uses it.
+        std::mutex devicesMutex;
+        std::map<uint64_t, std::shared_ptr<BluetoothDeviceAgent>> connectedDevices{};
+        std::shared_ptr<BluetoothDeviceAgent> FindAgent(uint64_t bluetoothAddress);
+        std::vector<std::shared_ptr<BluetoothDeviceAgent>> ConnectedAgents();
+
+        // every BluetoothLEDevice opened & closed. open = opened - closed, which should equal connectedCount
+        std::atomic<int64_t> devicesOpened{ 0 };
+        std::atomic<int64_t> devicesClosed{ 0 };
+
+        // Polls are spread over their interval by a golden ratio sequence,
+        // so that many polls with the same interval do not read all at once.
+        uint32_t pollGeneration = 0;
+        uint32_t pollsStarted = 0;
+        winrt::fire_and_forget PollAsync(uint64_t bluetoothAddress, std::string service, std::string characteristic, PollSettings poll, std::chrono::milliseconds firstDelay);
+        bool IsPolling(uint64_t bluetoothAddress, const std::string& characteristic, uint32_t generation);
+
+        winrt::fire_and_forget ConnectAsync(uint64_t bluetoothAddress, ReconnectPolicy reconnectPolicy, int32_t operationId,
+                                            BluetoothAddressType addressType = BluetoothAddressType::Unspecified, bool autoConnect = false);
+
+        // Connect on sight: an advertisement from an allowlisted address, or one advertising an
+        // allowlisted service, starts ConnectAsync straight from the watcher callback.
+        std::mutex autoConnectMutex;
+        std::atomic<bool> autoConnectEnabled{ false };
+        std::set<uint64_t> autoConnectAddresses;
+        std::vector<winrt::guid> autoConnectServices;
+        ReconnectPolicy autoConnectReconnectPolicy;
+        std::set<uint64_t> autoConnecting; // attempts in flight, also guarded by autoConnectMutex
+        bool AutoConnectMatches(BluetoothLEAdvertisementReceivedEventArgs const& args, BluetoothLEAdvertisement const& scanResponse, ReconnectPolicy& reconnectPolicy);
+
+        // Ends an auto connect attempt on every path out of ConnectAsync.
+        struct AutoConnectScope {
+            FlutterBluePlusPlugin* plugin;
+            uint64_t bluetoothAddress;
+            bool active;
+            ~AutoConnectScope() {
+                if (active) {
+                    std::lock_guard<std::mutex> lock(plugin->autoConnectMutex);
+                    plugin->autoConnecting.erase(bluetoothAddress);
+                }
+            }
+        };
+        winrt::fire_and_forget ReconnectAsync(uint64_t bluetoothAddress);
+        winrt::fire_and_forget OpenSessionAsync(uint64_t bluetoothAddress, BluetoothDeviceId deviceId);
+        void BluetoothLEDevice_ConnectionStatusChanged(BluetoothLEDevice sender, IInspectable args);
+        void BluetoothLEDevice_ConnectionParametersChanged(BluetoothLEDevice sender, IInspectable args);
+        void CleanConnection(uint64_t bluetoothAddress);
+        void SendMtu(uint64_t bluetoothAddress, uint16_t mtu);
+        winrt::fire_and_forget DiscoverServicesAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::vector<winrt::guid> serviceUuids, bool lazyDescriptors, int32_t operationId, MethodResultPtr result);
+        winrt::fire_and_forget DiscoverDescriptorsAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::string service, std::string characteristic, MethodResultPtr result);
+        winrt::fire_and_forget SetNotifiableAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::string service, std::string characteristic, int32_t bleInputProperty, int32_t channelId, std::shared_ptr<const PayloadLayout> payloadLayout, int64_t nativePort, int32_t priority, int32_t operationId, MethodResultPtr result);
+        winrt::fire_and_forget ReadValueAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::string service, std::string characteristic, int32_t maxAge, int32_t priority, int32_t operationId, MethodResultPtr result);
+        void CompleteReads(BluetoothDeviceAgent& bluetoothDeviceAgent, uint16_t handle, MethodResultPtr result, const EncodableMap& response);
+        void FailReads(BluetoothDeviceAgent& bluetoothDeviceAgent, bool inFlight, uint16_t handle, MethodResultPtr result, const std::string& message);
+        winrt::fire_and_forget PerformBatchAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::vector<BatchOperation> operations, int32_t priority, int32_t operationId, MethodResultPtr result);
+        IAsyncAction RunBatchOperationsAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::vector<BatchOperation>& operations, std::vector<size_t> indices, std::vector<EncodableMap>& results, int32_t operationId);
+        winrt::fire_and_forget WriteValueAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::string service, std::string characteristic, std::vector<uint8_t> value, int32_t bleOutputProperty, int32_t priority, int32_t operationId, MethodResultPtr result);
+
+        // Operations are identified by an id chosen by dart (0 = not cancelable).
+        // They are canceled by 'cancelOperation', or when their deadline passes.
+        std::mutex operationsMutex;
+        std::map<int32_t, PendingOperation> pendingOperations{};
+        void BeginOperation(const EncodableMap& args, int32_t& operationId);
+        void EndOperation(int32_t operationId);
+        bool CancelOperation(int32_t operationId);
+
+        // Waits for a turn on a device's queue. An operation canceled while it waits leaves
+        // the queue without ever getting the turn, and throws hresult_canceled.
+        IAsyncAction WaitTurnAsync(std::shared_ptr<OpQueue> queue, int32_t priority, int32_t operationId);
+        winrt::fire_and_forget OperationDeadlineAsync(int32_t operationId, std::chrono::milliseconds timeout);
+
+        // Ends the operation when the coroutine that owns it finishes, on every path.
+        struct OperationScope {
+            FlutterBluePlusPlugin* plugin;
+            int32_t operationId;
+            ~OperationScope() { plugin->EndOperation(operationId); }
+        };
+
+        // Records the WinRT call an operation is waiting on, so it can be canceled.
+        // If the operation was canceled in between two calls, the new call is canceled too.
+        template <typename TAsync>
+        TAsync TrackOperation(int32_t operationId, TAsync async) {
+            std::lock_guard<std::mutex> lock(operationsMutex);
+            auto it = pendingOperations.find(operationId);
+            if (it != pendingOperations.end()) {
+                auto& running = it->second.running;
+                running.erase(std::remove_if(running.begin(), running.end(),
+                    [](IAsyncInfo const& info) { return info.Status() != AsyncStatus::Started; }), running.end());
+                running.push_back(async);
+                if (it->second.canceled) {
+                    async.Cancel();
+                }
+            }
+            return async;
+        }
+
+        // Times an async call in tracing mode. Wrap it outside TrackOperation, so cancel still reaches the call.
+        template <typename TResult>
+        IAsyncOperation<TResult> Traced(const char* name, IAsyncOperation<TResult> async) {
+            if (!trace.spans.load(std::memory_order_relaxed)) {
+                return async;
+            }
+            return TracedAsync(name, async);
+        }
+        template <typename TResult>
+        IAsyncOperation<TResult> TracedAsync(const char* name, IAsyncOperation<TResult> async) {
+            TraceSpan span(trace, name);
+            co_return co_await async;
+        }
+
+        // Sends the response of a GATT operation. If the method call was deferred,
+        // the response completes it directly. Otherwise it is sent as a separate event.
+        void SendResponse(MethodResultPtr result, const std::string& method, EncodableMap response);
+
+        // notifications & polls, and scan results
+        FlowStream notifyFlow;
+        FlowStream scanFlow;
+        FlowStream* FlowStreamAt(int32_t index);
+        void EmitEvent(FlowStream& stream, int32_t index, const char* method, EncodableMap event, uint64_t key);
+        void FlushBacklog(FlowStream& stream);
+        void SendOutbox(FlowStream& stream, std::unique_lock<std::mutex>& lock);
+        void HandleSetFlowControl(const EncodableValue* arguments, MethodResultPtr& result);
+        void HandleGrantCredits(const EncodableValue* arguments, MethodResultPtr& result);
+
+        // notifications, either sent as they arrive or aligned in time
+        AlignmentBuffer alignment;
+        void EmitNotification(EncodableMap event, uint64_t key, int64_t timestamp);
+        void HandleSetAlignment(const EncodableValue* arguments, MethodResultPtr& result);
+        winrt::fire_and_forget AlignmentFlushAsync(uint32_t generation, int32_t window);
+        bool FlushAlignment(uint32_t generation, int64_t watermark);
+        void FlutterBluePlusPlugin::GattCharacteristic_ValueChanged(GattCharacteristic sender, GattValueChangedEventArgs args);
+
+        int32_t logLevel;
+        TraceRing trace;
+        BufferPool writeBuffers;
+        void FlutterBluePlusPlugin::FBPLog(LogLevel level, winrt::hstring message);
+    };
+
+    // static
+    void FlutterBluePlusPlugin::RegisterWithRegistrar(
+        flutter::PluginRegistrarWindows* registrar) {
+        auto method_channel_ =
+            std::make_unique<flutter::MethodChannel<EncodableValue>>(
+                registrar->messenger(), "flutter_blue_plus/methods",
+                &flutter::StandardMethodCodec::GetInstance());
+
+        auto plugin = std::make_unique<FlutterBluePlusPlugin>();
+
+        method_channel_->SetMethodCallHandler(
+            [plugin_pointer = plugin.get()](const auto& call, auto result) {
+                plugin_pointer->HandleMethodCall(call, std::move(result));
+            });
+
+        plugin->method_channel_ = std::move(method_channel_);
+
+        registrar->AddPlugin(std::move(plugin));
+    }
+
+    FlutterBluePlusPlugin::FlutterBluePlusPlugin() {
+        InitializeAsync();
+    }
+
+    FlutterBluePlusPlugin::~FlutterBluePlusPlugin() {
+        if (bluetoothRadio) {
+            bluetoothRadio.StateChanged(radioStateChangedToken);
+        }
+        if (pairedDevicesWatcher) {
+            pairedDevicesWatcher.Added(pairedDevicesAddedToken);
+            pairedDevicesWatcher.Updated(pairedDevicesUpdatedToken);
+            pairedDevicesWatcher.Removed(pairedDevicesRemovedToken);
+            pairedDevicesWatcher.EnumerationCompleted(pairedDevicesEnumeratedToken);
+            pairedDevicesWatcher.Stopped(pairedDevicesStoppedToken);
+            pairedDevicesWatcher.Stop();
+        }
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::InitializeAsync() {
+        // called from RegisterWithRegistrar, on the platform thread
+        winrt::apartment_context platformThread;
+        try {
+            auto bluetoothAdapter = co_await BluetoothAdapter::GetDefaultAsync();
+
+            if (bluetoothAdapter != nullptr) {
+                adapterCapabilities.lowEnergy = bluetoothAdapter.IsLowEnergySupported();
+                adapterCapabilities.centralRole = bluetoothAdapter.IsCentralRoleSupported();
+                adapterCapabilities.peripheralRole = bluetoothAdapter.IsPeripheralRoleSupported();
+                try {
+                    // only on Windows 10 2004 and later
+                    adapterCapabilities.extendedAdvertising = bluetoothAdapter.IsExtendedAdvertisingSupported();
+                    adapterCapabilities.maxAdvertisementDataLength = bluetoothAdapter.MaxAdvertisementDataLength();
+                } catch (winrt::hresult_error const&) {
+                }
+
+                bluetoothRadio = co_await bluetoothAdapter.GetRadioAsync();
+            }
+
+            if (bluetoothRadio) {
+                lastAdapterState = to_bmAdapterState(bluetoothRadio.State());
+                nativeSnapshot.adapterState = lastAdapterState.load();
+                radioStateChangedToken = bluetoothRadio.StateChanged({ this, &FlutterBluePlusPlugin::Radio_StateChanged });
+            }
+        } catch (winrt::hresult_error const& e) {
+            FBP_LOG(LERROR, L"InitializeAsync " + e.message());
+        }
+
+        // run the calls that arrived meanwhile, in order, on the platform thread like
+        // any other call. 'initialized' is only set once the queue is empty, so a
+        // new call cannot overtake a queued one.
+        co_await platformThread;
+        while (true) {
+            std::vector<QueuedMethodCall> calls;
+            {
+                std::lock_guard<std::mutex> lock(initializeMutex);
+                if (queuedCalls.empty()) {
+                    initialized = true;
+                    break;
+                }
+                calls.swap(queuedCalls);
+            }
+            for (auto& call : calls) {
+                DispatchMethodCall(call.method, call.arguments.get(), std::move(call.result));
+            }
+        }
+    }
+
+    void FlutterBluePlusPlugin::Radio_StateChanged(Radio sender, IInspectable) {
+        auto adapterState = to_bmAdapterState(sender.State());
+        nativeSnapshot.adapterState = adapterState;
+
+        // the event also fires for changes that keep the same state
+        if (lastAdapterState.exchange(adapterState) == adapterState || !method_channel_) {
+            return;
+        }
+        FBP_LOG(LDEBUG, L"Radio_StateChanged " + winrt::to_hstring(adapterState));
+
+        method_channel_->InvokeMethod("OnAdapterStateChanged",
+            std::make_unique<EncodableValue>(EncodableMap{
+                {"adapter_state", EncodableValue(adapterState)}
+            }));
+    }
+
+    void FlutterBluePlusPlugin::HandleMethodCall(
+        const flutter::MethodCall<flutter::EncodableValue>& method_call,
+        std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
+        const auto& method_name = method_call.method_name();
+        TraceSpan span(trace, "HandleMethodCall");
+        trace.Record(TMETHOD_CALL, traceName(method_name));
+        FBP_LOG(LDEBUG, L"MethodName: " + winrt::to_hstring(method_name));
+
+        if (!initialized) {
+            std::lock_guard<std::mutex> lock(initializeMutex);
+            if (!initialized) {
+                auto arguments = method_call.arguments() ? std::make_unique<EncodableValue>(*method_call.arguments()) : nullptr;
+                queuedCalls.push_back(QueuedMethodCall{ method_name, std::move(arguments), std::move(result) });
+                return;
+            }
+        }
+
+        DispatchMethodCall(method_name, method_call.arguments(), std::move(result));
+    }
+
+    void FlutterBluePlusPlugin::DispatchMethodCall(const std::string& method_name, const EncodableValue* arguments, MethodResultPtr result) {
+        // keep sorted by name, it is binary searched
+        static const MethodEntry methods[] = {
+            {"cancelOperation", &FlutterBluePlusPlugin::HandleCancelOperation},
+            {"connect", &FlutterBluePlusPlugin::HandleConnect},
+            {"connectedCount", &FlutterBluePlusPlugin::HandleConnectedCount},
+            {"disconnect", &FlutterBluePlusPlugin::HandleDisconnect},
+            {"discoverDescriptors", &FlutterBluePlusPlugin::HandleDiscoverDescriptors},
+            {"discoverServices", &FlutterBluePlusPlugin::HandleDiscoverServices},
+            {"flutterHotRestart", &FlutterBluePlusPlugin::HandleFlutterHotRestart},
+            {"getAdapterCapabilities", &FlutterBluePlusPlugin::HandleGetAdapterCapabilities},
+            {"getAdapterName", &FlutterBluePlusPlugin::HandleGetAdapterName},
+            {"getAdapterState", &FlutterBluePlusPlugin::HandleGetAdapterState},
+            {"getBondedDevices", &FlutterBluePlusPlugin::HandleGetBondedDevices},
+            {"getConnectionParameters", &FlutterBluePlusPlugin::HandleGetConnectionParameters},
+            {"getNativeStats", &FlutterBluePlusPlugin::HandleGetNativeStats},
+            {"getNativeTrace", &FlutterBluePlusPlugin::HandleGetNativeTrace},
+            {"getNativeTraceJson", &FlutterBluePlusPlugin::HandleGetNativeTraceJson},
+            {"getSystemDevices", &FlutterBluePlusPlugin::HandleGetSystemDevices},
+            {"grantCredits", &FlutterBluePlusPlugin::HandleGrantCredits},
+            {"isSupported", &FlutterBluePlusPlugin::HandleIsSupported},
+            {"performBatch", &FlutterBluePlusPlugin::HandlePerformBatch},
+            {"readCharacteristic", &FlutterBluePlusPlugin::HandleReadCharacteristic},
+            {"readRssi", &FlutterBluePlusPlugin::HandleReadRssi},
+            {"requestConnectionPriority", &FlutterBluePlusPlugin::HandleRequestConnectionPriority},
+            {"requestMtu", &FlutterBluePlusPlugin::HandleRequestMtu},
+            {"setAlignment", &FlutterBluePlusPlugin::HandleSetAlignment},
+            {"setAutoConnect", &FlutterBluePlusPlugin::HandleSetAutoConnect},
+            {"setFlowControl", &FlutterBluePlusPlugin::HandleSetFlowControl},
+            {"setLogLevel", &FlutterBluePlusPlugin::HandleSetLogLevel},
+            {"setNativeTracing", &FlutterBluePlusPlugin::HandleSetNativeTracing},
+            {"setNotifyValue", &FlutterBluePlusPlugin::HandleSetNotifyValue},
+            {"setPreferredPhy", &FlutterBluePlusPlugin::HandleSetPreferredPhy},
+            {"startPolling", &FlutterBluePlusPlugin::HandleStartPolling},
+            {"startScan", &FlutterBluePlusPlugin::HandleStartScan},
+            {"stopPolling", &FlutterBluePlusPlugin::HandleStopPolling},
+            {"stopScan", &FlutterBluePlusPlugin::HandleStopScan},
+            {"writeCharacteristic", &FlutterBluePlusPlugin::HandleWriteCharacteristic},
+        };
+
+        auto entry = std::lower_bound(std::begin(methods), std::end(methods), method_name.c_str(),
+            [](const MethodEntry& e, const char* name) { return std::strcmp(e.name, name) < 0; });
+        if (entry == std::end(methods) || method_name.compare(entry->name) != 0) {
+            result->NotImplemented();
+            return;
+        }
+
+        try {
+            (this->*entry->handler)(arguments, result);
+        } catch (const ArgumentError& e) {
+            FBP_LOG(LERROR, winrt::to_hstring(method_name) + L": " + winrt::to_hstring(e.message));
+            if (result) {
+                result->Error(method_name, e.message);
+            }
+        }
+    }
+
+    void FlutterBluePlusPlugin::HandleFlutterHotRestart(const EncodableValue*, MethodResultPtr& result) {
+        // routing ids are assigned by dart, and restart from scratch
+        // and so do the ports of the previous isolate
+        for (auto& agent : ConnectedAgents()) {
+            {
+                std::lock_guard<std::mutex> lock(agent->gattMutex);
+                agent->notifyChannelIds.clear();
+                agent->notifyPorts.clear();
+            }
+            std::lock_guard<std::mutex> lock(agent->valuesMutex);
+            agent->polls.clear();
+        }
+        nativeSnapshot.ClearValues();
+        {
+            std::lock_guard<std::mutex> lock(alignment.mutex);
+            alignment.window = 0;
+            alignment.generation++;
+            alignment.events.clear();
+        }
+
+        // credits granted by the previous isolate will never be returned
+        for (auto stream : { &notifyFlow, &scanFlow }) {
+            std::lock_guard<std::mutex> lock(stream->mutex);
+            stream->policy = FLOW_NONE;
+            stream->backlog.clear();
+        }
+        result->Success(EncodableValue(true));
+    }
+
+    void FlutterBluePlusPlugin::HandleConnectedCount(const EncodableValue*, MethodResultPtr& result) {
+        result->Success(nativeSnapshot.connectedCount.load());
+    }
+
+    void FlutterBluePlusPlugin::HandleSetLogLevel(const EncodableValue* arguments, MethodResultPtr& result) {
+        logLevel = argumentAs<int32_t>(arguments, "log_level");
+        FBP_LOG(LINFO, L"LogLevel: " + winrt::to_hstring(logLevel));
+
+        result->Success(EncodableValue(true));
+    }
+
+    void FlutterBluePlusPlugin::HandleGetAdapterState(const EncodableValue*, MethodResultPtr& result) {
+        result->Success(EncodableMap{
+            {"adapter_state", to_bmAdapterState(bluetoothRadio ? bluetoothRadio.State() : RadioState::Unknown)}
+        });
+    }
+
+    void FlutterBluePlusPlugin::HandleGetAdapterCapabilities(const EncodableValue*, MethodResultPtr& result) {
+        result->Success(EncodableMap{
+            {"low_energy", EncodableValue(adapterCapabilities.lowEnergy)},
+            {"central_role", EncodableValue(adapterCapabilities.centralRole)},
+            {"peripheral_role", EncodableValue(adapterCapabilities.peripheralRole)},
+            {"extended_advertising", EncodableValue(adapterCapabilities.extendedAdvertising)},
+            {"max_advertisement_data_length", EncodableValue((int32_t)adapterCapabilities.maxAdvertisementDataLength)},
+        });
+    }
+
+    void FlutterBluePlusPlugin::HandleGetAdapterName(const EncodableValue*, MethodResultPtr& result) {
+        result->Success(EncodableValue(bluetoothRadio ? winrt::to_string(bluetoothRadio.Name()) : std::string()));
+    }
+
+    void FlutterBluePlusPlugin::HandleIsSupported(const EncodableValue*, MethodResultPtr& result) {
+        result->Success(EncodableValue(adapterCapabilities.lowEnergy));
+    }
+
+    void FlutterBluePlusPlugin::HandleGetSystemDevices(const EncodableValue*, MethodResultPtr& result) {
+        GetSystemDevicesAsync(std::move(result));
+    }
+
+    void FlutterBluePlusPlugin::HandleGetBondedDevices(const EncodableValue*, MethodResultPtr& result) {
+        std::lock_guard<std::mutex> lock(pairedDevicesMutex);
+        if (pairedDevicesEnumerated) {
+            result->Success(PairedDevicesList());
+            return;
+        }
+
+        // answered when the first enumeration completes
+        pairedDevicesResults.push_back(std::move(result));
+        if (!pairedDevicesWatcher) {
+            pairedDevicesWatcher = DeviceInformation::CreateWatcher(
+                BluetoothLEDevice::GetDeviceSelectorFromPairingState(true),
+                std::vector<winrt::hstring>{ deviceAddressProperty },
+                DeviceInformationKind::AssociationEndpoint);
+            pairedDevicesAddedToken = pairedDevicesWatcher.Added({ this, &FlutterBluePlusPlugin::PairedDevicesWatcher_Added });
+            pairedDevicesUpdatedToken = pairedDevicesWatcher.Updated({ this, &FlutterBluePlusPlugin::PairedDevicesWatcher_Updated });
+            pairedDevicesRemovedToken = pairedDevicesWatcher.Removed({ this, &FlutterBluePlusPlugin::PairedDevicesWatcher_Removed });
+            pairedDevicesEnumeratedToken = pairedDevicesWatcher.EnumerationCompleted({ this, &FlutterBluePlusPlugin::PairedDevicesWatcher_EnumerationCompleted });
+            pairedDevicesStoppedToken = pairedDevicesWatcher.Stopped({ this, &FlutterBluePlusPlugin::PairedDevicesWatcher_Stopped });
+            pairedDevicesWatcher.Start();
+        }
+    }
+
+    void FlutterBluePlusPlugin::HandleStartScan(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+
+        // check adapter state
+        if (isAdapterOn(bluetoothRadio) == false) {
+            result->Error("startScan", "bluetooth must be turned on.");
+            return;
+        }
+
+        auto withServices_it = args.find(EncodableValue("with_services"));
+        if (withServices_it != args.end()) {
+            targetServiceUuids = argumentAs<EncodableList>(&withServices_it->second, "with_services");
+        }
+
+        // 0 = passive, 1 = active
+        int32_t scanMode = optionalInt32(args, "windows_scan_mode", 1);
+
+        // duty cycle, in milliseconds. 0 = scan continuously
+        int32_t scanWindow = optionalInt32(args, "windows_scan_window", 0);
+        int32_t scanInterval = optionalInt32(args, "windows_scan_interval", 0);
+
+        // restart the watcher so the new settings apply
+        StopWatcher();
+
+        uint32_t generation;
+        {
+            std::lock_guard<std::mutex> lock(scanMutex);
+            bluetoothLEWatcher = BluetoothLEAdvertisementWatcher();
+            bluetoothLEWatcher.ScanningMode(scanMode == 0 ? BluetoothLEScanningMode::Passive : BluetoothLEScanningMode::Active);
+            bluetoothLEWatcherReceivedToken = bluetoothLEWatcher.Received({ this, &FlutterBluePlusPlugin::BluetoothLEWatcher_Received });
+            bluetoothLEWatcher.Start();
+            generation = ++scanGeneration;
+        }
+
+        if (scanWindow > 0 && scanInterval > scanWindow) {
+            ScanDutyCycleAsync(generation, std::chrono::milliseconds(scanWindow), std::chrono::milliseconds(scanInterval));
+        }
+        result->Success(EncodableValue(true));
+    }
+
+    void FlutterBluePlusPlugin::HandleStopScan(const EncodableValue*, MethodResultPtr& result) {
+        StopWatcher();
+        result->Success(EncodableValue(true));
+    }
+
+    // stops the watcher & its duty cycle, and forgets the scan responses
+    void FlutterBluePlusPlugin::StopWatcher() {
+        BluetoothLEAdvertisementWatcher watcher{ nullptr };
+        {
+            std::lock_guard<std::mutex> lock(scanMutex);
+            scanGeneration++;
+            watcher = std::exchange(bluetoothLEWatcher, nullptr);
+        }
+        if (watcher) {
+            watcher.Stop();
+            watcher.Received(bluetoothLEWatcherReceivedToken);
+        }
+        std::lock_guard<std::mutex> lock(scanResponsesMutex);
+        scanResponses.clear();
+    }
+
+    void FlutterBluePlusPlugin::HandleConnect(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+        const auto& remoteId = requiredArg<std::string>(args, "remote_id");
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+
+        auto bluetoothAddress = parseRemoteId(remoteId);
+
+        ReconnectPolicy reconnectPolicy;
+        reconnectPolicy.maxAttempts = optionalInt32(args, "windows_reconnect_attempts", 0);
+        reconnectPolicy.initialDelay = std::chrono::milliseconds(optionalInt32(args, "windows_reconnect_delay", 0));
+        reconnectPolicy.maxDelay = std::chrono::milliseconds(optionalInt32(args, "windows_reconnect_max_delay", 0));
+
+        int32_t operationId = 0;
+        BeginOperation(args, operationId);
+
+        ConnectAsync(bluetoothAddress, reconnectPolicy, operationId);
+        result->Success(EncodableValue(true));
+    }
+
+    void FlutterBluePlusPlugin::HandleSetAutoConnect(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+
+        std::set<uint64_t> addresses;
+        for (const auto& remoteId : requiredArg<EncodableList>(args, "remote_ids")) {
+            addresses.insert(parseRemoteId(argumentAs<std::string>(&remoteId, "remote_ids")));
+        }
+        std::vector<winrt::guid> services;
+        for (const auto& uuid : requiredArg<EncodableList>(args, "service_uuids")) {
+            services.push_back(parseGuid(argumentAs<std::string>(&uuid, "service_uuids")));
+        }
+
+        ReconnectPolicy reconnectPolicy;
+        reconnectPolicy.maxAttempts = optionalInt32(args, "windows_reconnect_attempts", 0);
+        reconnectPolicy.initialDelay = std::chrono::milliseconds(optionalInt32(args, "windows_reconnect_delay", 0));
+        reconnectPolicy.maxDelay = std::chrono::milliseconds(optionalInt32(args, "windows_reconnect_max_delay", 0));
+
+        {
+            std::lock_guard<std::mutex> lock(autoConnectMutex);
+            autoConnectEnabled = !addresses.empty() || !services.empty();
+            autoConnectAddresses.swap(addresses);
+            autoConnectServices.swap(services);
+            autoConnectReconnectPolicy = reconnectPolicy;
+        }
+        result->Success(EncodableValue(true));
+    }
+
+    void FlutterBluePlusPlugin::HandleDisconnect(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& remoteId = argumentAs<std::string>(arguments, "remote_id");
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+
+        CleanConnection(parseRemoteId(remoteId));
+        result->Success(EncodableValue(true));
+    }
+
+    void FlutterBluePlusPlugin::HandleReadRssi(const EncodableValue* arguments, MethodResultPtr& result) {
+        // No way currently to get connected RSSI on Windows
+        // https://stackoverflow.com/questions/64096245/how-to-get-rssi-of-a-connected-bluetoothledevice-in-uwp
+
+        const auto& remoteId = argumentAs<std::string>(arguments, "remote_id");
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+
+        result->Success(EncodableValue(true));
+
+        method_channel_->InvokeMethod("OnReadRssi",
+            std::make_unique<EncodableValue>(EncodableMap{
+                  {"remote_id", EncodableValue(remoteId)},
+                  {"rssi", EncodableValue(0)},
+                  {"success", EncodableValue(true)},
+                  {"error_string", EncodableValue("success")},
+                  {"error_code", EncodableValue(0)},
+            }));
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::DiscoverDescriptorsAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::string service, std::string characteristic, MethodResultPtr result) {
+        auto& bluetoothDeviceAgent = *agent;
+        try {
+            auto bluetoothAddress = bluetoothDeviceAgent.bluetoothAddress;
+            auto gattCharacteristic = co_await Traced("GetCharacteristicAsync", bluetoothDeviceAgent.GetCharacteristicAsync(service, characteristic));
+            auto descriptorsResult = co_await Traced("GetDescriptorsAsync", gattCharacteristic.GetDescriptorsAsync());
+            if (descriptorsResult.Status() != GattCommunicationStatus::Success) {
+                result->Error("discoverDescriptors", getGattCommunicationStatusMessage(descriptorsResult.Status()));
+                co_return;
+            }
+
+            EncodableList descriptors;
+            for (auto d : descriptorsResult.Descriptors()) {
+                descriptors.push_back(to_bmDescriptor(bluetoothAddress, gattCharacteristic, d));
+            }
+            result->Success(EncodableValue(descriptors));
+        } catch (winrt::hresult_error const& e) {
+            result->Error("discoverDescriptors", winrt::to_string(e.message()));
+        } catch (std::out_of_range const&) {
+            result->Error("discoverDescriptors", "characteristic not found: " + characteristic);
+        } catch (...) {
+            FBP_LOG(LERROR, L"Unexpected error in DiscoverDescriptorsAsync");
+            result->Error("discoverDescriptors", "Unexpected error in DiscoverDescriptorsAsync");
+        }
+    }
+
+    void FlutterBluePlusPlugin::HandleDiscoverServices(const EncodableValue* arguments, MethodResultPtr& result) {
+        // either the remoteId, or a map when the result is deferred
+        const EncodableMap* args = arguments ? std::get_if<EncodableMap>(arguments) : nullptr;
+        const auto& remoteId = args ? requiredArg<std::string>(*args, "remote_id") : argumentAs<std::string>(arguments, "remote_id");
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+
+        auto agent = FindAgent(parseRemoteId(remoteId));
+        if (!agent) {
+            result->Error("discoverServices", "Device is disconnected. remoteId:" + remoteId);
+            return;
+        }
+
+        // optional, only discover these services
+        std::vector<winrt::guid> serviceUuids;
+        auto uuids = args ? args->find(EncodableValue("service_uuids")) : EncodableMap::const_iterator();
+        if (args && uuids != args->end() && !uuids->second.IsNull()) {
+            for (const auto& uuid : argumentAs<EncodableList>(&uuids->second, "service_uuids")) {
+                serviceUuids.push_back(parseUuid(argumentAs<std::string>(&uuid, "service_uuids")));
+            }
+        }
+
+        // optional, leave descriptors to 'discoverDescriptors'
+        auto lazy = args ? args->find(EncodableValue("lazy_descriptors")) : EncodableMap::const_iterator();
+        bool lazyDescriptors = args && lazy != args->end() && std::holds_alternative<bool>(lazy->second) && std::get<bool>(lazy->second);
+
+        int32_t operationId = 0;
+        if (args) {
+            BeginOperation(*args, operationId);
+        }
+
+        if (args && isDeferredResult(*args)) {
+            DiscoverServicesAsync(agent, std::move(serviceUuids), lazyDescriptors, operationId, std::move(result));
+        } else {
+            DiscoverServicesAsync(agent, std::move(serviceUuids), lazyDescriptors, operationId, nullptr);
+            result->Success(EncodableValue(true));
+        }
+    }
+
+    void FlutterBluePlusPlugin::HandleDiscoverDescriptors(const EncodableValue* arguments, MethodResultPtr& result) {
+        CharacteristicArgs args(arguments);
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(args.remoteId));
+
+        auto agent = FindAgent(args.bluetoothAddress);
+        if (!agent) {
+            result->Error("discoverDescriptors", "Device is disconnected. remoteId:" + args.remoteId);
+            return;
+        }
+
+        DiscoverDescriptorsAsync(agent, args.serviceUuid, args.characteristicUuid, std::move(result));
+    }
+
+    void FlutterBluePlusPlugin::HandleSetNotifyValue(const EncodableValue* arguments, MethodResultPtr& result) {
+        CharacteristicArgs args(arguments);
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(args.remoteId));
+
+        auto enable = requiredArg<bool>(args.map, "enable");
+
+        // optional, used by dart to route notifications
+        int32_t channelId = optionalInt32(args.map, "channel_id", 0);
+
+        // optional, decode notifications natively
+        auto payloadLayout = parsePayloadLayout(args.map);
+
+        // optional, post notifications to this dart port, see 'PostToPort'
+        int64_t nativePort = 0;
+        auto port = args.map.find(EncodableValue("native_port"));
+        if (port != args.map.end() && !port->second.IsNull()) {
+            // the codec sends small integers as int32
+            auto small = std::get_if<int32_t>(&port->second);
+            nativePort = small ? *small : argumentAs<int64_t>(&port->second, "native_port");
+        }
+
+        auto agent = FindAgent(args.bluetoothAddress);
+        if (!agent) {
+            result->Error("setNotifyValue", "Device is disconnected. remoteId:" + args.remoteId);
+            return;
+        }
+
+        auto priority = parsePriority(args.map);
+
+        int32_t operationId = 0;
+        BeginOperation(args.map, operationId);
+
+        if (isDeferredResult(args.map)) {
+            SetNotifiableAsync(agent, args.serviceUuid, args.characteristicUuid, enable ? 1 : 0, channelId, payloadLayout, nativePort, priority, operationId, std::move(result));
+        } else {
+            SetNotifiableAsync(agent, args.serviceUuid, args.characteristicUuid, enable ? 1 : 0, channelId, payloadLayout, nativePort, priority, operationId, nullptr);
+            result->Success(EncodableValue(true));
+        }
+    }
+
+    void FlutterBluePlusPlugin::HandlePerformBatch(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+        const auto& remoteId = requiredArg<std::string>(args, "remote_id");
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+
+        std::vector<BatchOperation> operations;
+        for (const auto& item : requiredArg<EncodableList>(args, "operations")) {
+            const auto& op = argumentAs<EncodableMap>(&item, "operations");
+            BatchOperation batchOperation;
+            batchOperation.type = requiredArg<int32_t>(op, "type");
+            batchOperation.service = requiredArg<std::string>(op, "service_uuid");
+            batchOperation.characteristic = requiredArg<std::string>(op, "characteristic_uuid");
+            auto value = op.find(EncodableValue("value"));
+            if (value != op.end() && std::holds_alternative<std::string>(value->second)) {
+                batchOperation.value = hex_to_bytes(std::get<std::string>(value->second));
+            }
+            batchOperation.writeType = optionalInt32(op, "write_type", 0);
+            auto enable = op.find(EncodableValue("enable"));
+            batchOperation.enable = enable != op.end() && std::holds_alternative<bool>(enable->second) && std::get<bool>(enable->second);
+            batchOperation.channelId = optionalInt32(op, "channel_id", 0);
+            operations.push_back(std::move(batchOperation));
+        }
+
+        auto agent = FindAgent(parseRemoteId(remoteId));
+        if (!agent) {
+            result->Error("performBatch", "Device is disconnected. remoteId:" + remoteId);
+            return;
+        }
+
+        auto priority = parsePriority(args);
+        int32_t operationId = 0;
+        BeginOperation(args, operationId);
+
+        PerformBatchAsync(agent, std::move(operations), priority, operationId, std::move(result));
+    }
+
+    void FlutterBluePlusPlugin::HandleStartPolling(const EncodableValue* arguments, MethodResultPtr& result) {
+        CharacteristicArgs args(arguments);
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(args.remoteId));
+
+        PollSettings poll;
+        poll.interval = std::chrono::milliseconds(requiredArg<int32_t>(args.map, "interval"));
+        poll.jitter = std::chrono::milliseconds(optionalInt32(args.map, "jitter", 0));
+        poll.onlyOnChange = requiredArg<bool>(args.map, "only_on_change");
+        poll.channelId = optionalInt32(args.map, "channel_id", 0);
+        if (poll.interval.count() <= 0) {
+            throw ArgumentError{ "interval must be positive" };
+        }
+        if (poll.jitter.count() < 0 || poll.jitter >= poll.interval) {
+            throw ArgumentError{ "jitter must be between 0 and interval" };
+        }
+        poll.generation = ++pollGeneration;
+
+        auto agent = FindAgent(args.bluetoothAddress);
+        if (!agent) {
+            result->Error("startPolling", "Device is disconnected. remoteId:" + args.remoteId);
+            return;
+        }
+
+        // replaces any poll already running on this characteristic
+        {
+            std::lock_guard<std::mutex> lock(agent->valuesMutex);
+            agent->polls[args.characteristicUuid] = poll.generation;
+        }
+
+        const double goldenRatio = 0.6180339887498949;
+        double phase = std::fmod(pollsStarted++ * goldenRatio, 1.0);
+        auto firstDelay = std::chrono::milliseconds((int64_t)(phase * poll.interval.count()));
+
+        PollAsync(args.bluetoothAddress, args.serviceUuid, args.characteristicUuid, poll, firstDelay);
+        result->Success(EncodableValue(true));
+    }
+
+    void FlutterBluePlusPlugin::HandleStopPolling(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+        const auto& remoteId = requiredArg<std::string>(args, "remote_id");
+        const auto& characteristicUuid = requiredArg<std::string>(args, "characteristic_uuid");
+
+        bool stopped = false;
+        auto agent = FindAgent(parseRemoteId(remoteId));
+        if (agent) {
+            std::lock_guard<std::mutex> lock(agent->valuesMutex);
+            stopped = agent->polls.erase(characteristicUuid) > 0;
+        }
+        result->Success(EncodableValue(stopped));
+    }
+
+    void FlutterBluePlusPlugin::HandleGetNativeTrace(const EncodableValue*, MethodResultPtr& result) {
+        result->Success(EncodableValue(EncodableMap{
+            {"record_size", EncodableValue((int32_t)sizeof(TraceRing::PackedRecord))},
+            {"records", EncodableValue(trace.Dump())}
+        }));
+    }
+
+    void FlutterBluePlusPlugin::HandleSetNativeTracing(const EncodableValue* arguments, MethodResultPtr& result) {
+        trace.spans = argumentAs<bool>(arguments, "enable");
+        result->Success(EncodableValue(true));
+    }
+
+    void FlutterBluePlusPlugin::HandleGetNativeTraceJson(const EncodableValue*, MethodResultPtr& result) {
+        result->Success(EncodableValue(trace.ToChromeJson()));
+    }
+
+    void FlutterBluePlusPlugin::HandleGetNativeStats(const EncodableValue*, MethodResultPtr& result) {
+        int64_t services = 0;
+        int64_t characteristics = 0;
+        int64_t subscriptions = 0;
+        int64_t pendingReads = 0;
+        int64_t cachedValueBytes = 0;
+        auto agents = ConnectedAgents();
+        for (auto& agent : agents) {
+            {
+                std::lock_guard<std::mutex> lock(agent->gattMutex);
+                services += (int64_t)agent->gattServices.size();
+                characteristics += (int64_t)agent->gattCharacteristics.size();
+                for (auto& token : agent->valueChangedTokens) {
+                    if (token.second) {
+                        subscriptions++;
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> lock(agent->valuesMutex);
+            for (auto& reads : agent->pendingReads) {
+                pendingReads += (int64_t)reads.second.size();
+            }
+            for (auto& value : agent->lastValues) {
+                cachedValueBytes += (int64_t)value.second.value.size();
+            }
+        }
+
+        int64_t operations = 0;
+        {
+            std::lock_guard<std::mutex> lock(operationsMutex);
+            operations = (int64_t)pendingOperations.size();
+        }
+
+        auto stats = EncodableMap{
+            {"connected_devices", EncodableValue((int64_t)agents.size())},
+            {"open_devices", EncodableValue(devicesOpened - devicesClosed)},
+            {"devices_opened", EncodableValue(devicesOpened.load())},
+            {"devices_closed", EncodableValue(devicesClosed.load())},
+            {"open_services", EncodableValue(services)},
+            {"cached_characteristics", EncodableValue(characteristics)},
+            {"subscriptions", EncodableValue(subscriptions)},
+            {"pending_operations", EncodableValue(operations)},
+            {"pending_reads", EncodableValue(pendingReads)},
+            {"cached_value_bytes", EncodableValue(cachedValueBytes)},
+            {"write_buffer_bytes", EncodableValue((int64_t)writeBuffers.PooledBytes())},
+            {"trace_bytes", EncodableValue((int64_t)sizeof(TraceRing))},
+        };
+        {
+            std::lock_guard<std::mutex> lock(alignment.mutex);
+            stats[EncodableValue("alignment_buffered")] = EncodableValue((int64_t)alignment.events.size());
+            stats[EncodableValue("alignment_capacity")] = EncodableValue((int64_t)alignment.capacity);
+        }
+        for (auto stream : { std::make_pair("notify", &notifyFlow), std::make_pair("scan", &scanFlow) }) {
+            std::lock_guard<std::mutex> lock(stream.second->mutex);
+            auto prefix = std::string(stream.first);
+            stats[EncodableValue(prefix + "_sent")] = EncodableValue(stream.second->sent);
+            stats[EncodableValue(prefix + "_dropped")] = EncodableValue(stream.second->dropped);
+            stats[EncodableValue(prefix + "_conflated")] = EncodableValue(stream.second->conflated);
+            stats[EncodableValue(prefix + "_backlog")] = EncodableValue((int64_t)stream.second->backlog.size());
+            stats[EncodableValue(prefix + "_credits")] = EncodableValue(stream.second->credits);
+        }
+        result->Success(EncodableValue(std::move(stats)));
+    }
+
+    void FlutterBluePlusPlugin::HandleCancelOperation(const EncodableValue* arguments, MethodResultPtr& result) {
+        auto operationId = argumentAs<int32_t>(arguments, "operation_id");
+        result->Success(EncodableValue(CancelOperation(operationId)));
+    }
+
+    void FlutterBluePlusPlugin::HandleRequestMtu(const EncodableValue*, MethodResultPtr& result) {
+        result->Error("requestMtu", "Windows does not allow mtu requests to the peripheral");
+    }
+
+    void FlutterBluePlusPlugin::HandleRequestConnectionPriority(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+        const auto& remoteId = requiredArg<std::string>(args, "remote_id");
+        auto connectionPriority = requiredArg<int32_t>(args, "connection_priority");
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(remoteId));
+
+        auto agent = FindAgent(parseRemoteId(remoteId));
+        auto device = agent ? agent->Device() : BluetoothLEDevice{ nullptr };
+        if (!device) {
+            result->Error("requestConnectionPriority", "Device is disconnected. remoteId:" + remoteId);
+            return;
+        }
+
+#if FBP_CONNECTION_PARAMETERS
+        try {
+            // balanced = 0, high = 1, lowPower = 2
+            auto parameters = connectionPriority == 1 ? BluetoothLEPreferredConnectionParameters::ThroughputOptimized()
+                            : connectionPriority == 2 ? BluetoothLEPreferredConnectionParameters::PowerOptimized()
+                                                      : BluetoothLEPreferredConnectionParameters::Balanced();
+
+            // only the latest request applies
+            auto request = device.RequestPreferredConnectionParameters(parameters);
+            auto status = request.Status();
+            {
+                std::lock_guard<std::mutex> lock(agent->gattMutex);
+                std::swap(agent->connectionParametersRequest, request);
+            }
+            if (request) {
+                request.Close();
+            }
+
+            if (status != BluetoothLEPreferredConnectionParametersRequestStatus::Success) {
+                result->Error("requestConnectionPriority", "request failed, status: " + std::to_string((int32_t)status));
+                return;
+            }
+            result->Success(EncodableValue(true));
+        } catch (winrt::hresult_error const& e) {
+            result->Error("requestConnectionPriority", winrt::to_string(e.message()));
+        }
+#else
+        (void)connectionPriority;
+        result->Error("requestConnectionPriority", "requires a plugin built with the Windows 11 SDK");
+#endif
+    }
+
+    // Windows picks the phy itself and has no api to prefer one.
+    // The request is accepted, and the phy in use is reported through OnConnectionParametersChanged.
+    void FlutterBluePlusPlugin::HandleSetPreferredPhy(const EncodableValue*, MethodResultPtr& result) {
+        // the phy in use is reported by getConnectionParameters & OnConnectionParametersChanged
+        result->Error("setPreferredPhy", "windows chooses the phy itself");
+    }
+
+    void FlutterBluePlusPlugin::HandleGetConnectionParameters(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& remoteId = argumentAs<std::string>(arguments, "remote_id");
+
+        auto agent = FindAgent(parseRemoteId(remoteId));
+        auto device = agent ? agent->Device() : BluetoothLEDevice{ nullptr };
+        if (!device) {
+            result->Error("getConnectionParameters", "Device is disconnected. remoteId:" + remoteId);
+            return;
+        }
+
+#if FBP_CONNECTION_PARAMETERS
+        try {
+            result->Success(to_bmConnectionParameters(device));
+        } catch (winrt::hresult_error const& e) {
+            result->Error("getConnectionParameters", winrt::to_string(e.message()));
+        }
+#else
+        result->Error("getConnectionParameters", "requires a plugin built with the Windows 11 SDK");
+#endif
+    }
+
+    void FlutterBluePlusPlugin::HandleReadCharacteristic(const EncodableValue* arguments, MethodResultPtr& result) {
+        CharacteristicArgs args(arguments);
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(args.remoteId));
+
+        auto agent = FindAgent(args.bluetoothAddress);
+        if (!agent) {
+            result->Error("readCharacteristic", "Device is disconnected. remoteId: " + args.remoteId);
+            return;
+        }
+
+        // -1 = always read from the device
+        auto maxAge = optionalInt32(args.map, "max_age", -1);
+        auto priority = parsePriority(args.map);
+
+        int32_t operationId = 0;
+        BeginOperation(args.map, operationId);
+
+        if (isDeferredResult(args.map)) {
+            ReadValueAsync(agent, args.serviceUuid, args.characteristicUuid, maxAge, priority, operationId, std::move(result));
+        } else {
+            ReadValueAsync(agent, args.serviceUuid, args.characteristicUuid, maxAge, priority, operationId, nullptr);
+            result->Success(EncodableValue(true));
+        }
+    }
+
+    void FlutterBluePlusPlugin::HandleWriteCharacteristic(const EncodableValue* arguments, MethodResultPtr& result) {
+        CharacteristicArgs args(arguments);
+        FBP_LOG(LDEBUG, L"RemoteId: " + winrt::to_hstring(args.remoteId));
+
+        auto writeType = requiredArg<int32_t>(args.map, "write_type");
+        auto value = hex_to_bytes(requiredArg<std::string>(args.map, "value"));
+
+        auto agent = FindAgent(args.bluetoothAddress);
+        if (!agent) {
+            result->Error("writeCharacteristic", "Device is disconnected. remoteId:" + args.remoteId);
+            return;
+        }
+
+        auto priority = parsePriority(args.map);
+
+        int32_t operationId = 0;
+        BeginOperation(args.map, operationId);
+
+        if (isDeferredResult(args.map)) {
+            WriteValueAsync(agent, args.serviceUuid, args.characteristicUuid, std::move(value), writeType, priority, operationId, std::move(result));
+        } else {
+            WriteValueAsync(agent, args.serviceUuid, args.characteristicUuid, std::move(value), writeType, priority, operationId, nullptr);
+            result->Success(EncodableValue(true));
+        }
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::GetSystemDevicesAsync(MethodResultPtr result) {
+        try {
+            auto selector = BluetoothLEDevice::GetDeviceSelectorFromConnectionStatus(BluetoothConnectionStatus::Connected);
+            auto infos = co_await DeviceInformation::FindAllAsync(selector, std::vector<winrt::hstring>{ deviceAddressProperty });
+
+            EncodableList devices;
+            for (auto const& info : infos) {
+                auto device = to_bmBluetoothDevice(info);
+                if (!device.empty()) {
+                    devices.push_back(EncodableValue(std::move(device)));
+                }
+            }
+            result->Success(EncodableMap{
+                {"devices", devices}
+            });
+        } catch (winrt::hresult_error const& e) {
+            FBP_LOG(LERROR, L"GetSystemDevicesAsync " + e.message());
+            result->Error("getSystemDevices", winrt::to_string(e.message()));
+        } catch (...) {
+            FBP_LOG(LERROR, L"Unexpected error in GetSystemDevicesAsync");
+            result->Error("getSystemDevices", "Unexpected error in GetSystemDevicesAsync");
+        }
+    }
+
+    // pairedDevicesMutex must be held
+    EncodableMap FlutterBluePlusPlugin::PairedDevicesList() {
+        EncodableList devices;
+        for (auto const& paired : pairedDevices) {
+            auto device = to_bmBluetoothDevice(paired.second);
+            if (!device.empty()) {
+                devices.push_back(EncodableValue(std::move(device)));
+            }
+        }
+        return EncodableMap{
+            {"devices", devices}
+        };
+    }
+
+    void FlutterBluePlusPlugin::PairedDevicesWatcher_Added(DeviceWatcher, DeviceInformation info) {
+        std::lock_guard<std::mutex> lock(pairedDevicesMutex);
+        pairedDevices.insert_or_assign(info.Id(), info);
+    }
+
+    void FlutterBluePlusPlugin::PairedDevicesWatcher_Updated(DeviceWatcher, DeviceInformationUpdate update) {
+        std::lock_guard<std::mutex> lock(pairedDevicesMutex);
+        auto it = pairedDevices.find(update.Id());
+        if (it != pairedDevices.end()) {
+            it->second.Update(update);
+        }
+    }
+
+    void FlutterBluePlusPlugin::PairedDevicesWatcher_Removed(DeviceWatcher, DeviceInformationUpdate update) {
+        std::lock_guard<std::mutex> lock(pairedDevicesMutex);
+        pairedDevices.erase(update.Id());
+    }
+
+    void FlutterBluePlusPlugin::PairedDevicesWatcher_EnumerationCompleted(DeviceWatcher, IInspectable) {
+        std::vector<MethodResultPtr> results;
+        EncodableMap devices;
+        {
+            std::lock_guard<std::mutex> lock(pairedDevicesMutex);
+            pairedDevicesEnumerated = true;
+            results.swap(pairedDevicesResults);
+            devices = PairedDevicesList();
+        }
+        FBP_LOG(LDEBUG, L"PairedDevicesWatcher_EnumerationCompleted " + winrt::to_hstring((int32_t)results.size()));
+        for (auto& result : results) {
+            result->Success(devices);
+        }
+    }
+
+    // the watcher stopped or aborted (e.g. the radio was removed). The cache no longer
+    // tracks changes, so drop it and start a new watcher on the next getBondedDevices.
+    void FlutterBluePlusPlugin::PairedDevicesWatcher_Stopped(DeviceWatcher sender, IInspectable) {
+        std::vector<MethodResultPtr> results;
+        {
+            std::lock_guard<std::mutex> lock(pairedDevicesMutex);
+            if (sender != pairedDevicesWatcher) {
+                return;
+            }
+            sender.Added(pairedDevicesAddedToken);
+            sender.Updated(pairedDevicesUpdatedToken);
+            sender.Removed(pairedDevicesRemovedToken);
+            sender.EnumerationCompleted(pairedDevicesEnumeratedToken);
+            sender.Stopped(pairedDevicesStoppedToken);
+            pairedDevicesWatcher = nullptr;
+            pairedDevicesEnumerated = false;
+            pairedDevices.clear();
+            results.swap(pairedDevicesResults);
+        }
+        FBP_LOG(LDEBUG, L"PairedDevicesWatcher_Stopped " + winrt::to_hstring((int32_t)sender.Status()));
+        for (auto& result : results) {
+            result->Error("getBondedDevices", "device watcher stopped before enumeration completed");
+        }
+    }
+
+    std::vector<uint8_t> parseManufacturerDataHead(BluetoothLEAdvertisement advertisement)
+    {
+        if (advertisement.ManufacturerData().Size() == 0)
+            return std::vector<uint8_t>();
+
+        auto manufacturerData = advertisement.ManufacturerData().GetAt(0);
+        // FIXME Compat with REG_DWORD_BIG_ENDIAN
+        uint8_t* prefix = uint16_t_union{ manufacturerData.CompanyId() }.bytes;
+        auto result = std::vector<uint8_t>{ prefix, prefix + sizeof(uint16_t_union) };
+
+        auto data = to_bytevc(manufacturerData.Data());
+        result.insert(result.end(), data.begin(), data.end());
+        return result;
+    }
+
+    void FlutterBluePlusPlugin::BluetoothLEWatcher_Received(
+        BluetoothLEAdvertisementWatcher sender,
+        BluetoothLEAdvertisementReceivedEventArgs args) {
+        TraceSpan span(trace, "WatcherReceived");
+        nativeSnapshot.counters[COUNTER_SCAN_RESULTS]++;
+        BluetoothLEAdvertisement scanResponse{ nullptr };
+        {
+            std::lock_guard<std::mutex> lock(scanResponsesMutex);
+
+            // In active mode a scan response arrives as its own event. Rather than
+            // forwarding it, keep it and merge it into the device's next advertisement.
+            auto now = std::chrono::steady_clock::now();
+            if (args.AdvertisementType() == BluetoothLEAdvertisementType::ScanResponse) {
+                if (scanResponses.size() >= scanResponsesMax && scanResponses.count(args.BluetoothAddress()) == 0) {
+                    for (auto it = scanResponses.begin(); it != scanResponses.end();) {
+                        it = now - it->second.time > scanResponseMaxAge ? scanResponses.erase(it) : std::next(it);
+                    }
+                    if (scanResponses.size() >= scanResponsesMax) {
+                        scanResponses.erase(std::min_element(scanResponses.begin(), scanResponses.end(),
+                            [](const auto& a, const auto& b) { return a.second.time < b.second.time; }));
+                    }
+                }
+                scanResponses.insert_or_assign(args.BluetoothAddress(), ScanResponse{ args.Advertisement(), now });
+                return;
+            }
+
+            auto it = scanResponses.find(args.BluetoothAddress());
+            if (it != scanResponses.end() && now - it->second.time <= scanResponseMaxAge) {
+                scanResponse = it->second.advertisement;
+            }
+        }
+
+        ReconnectPolicy reconnectPolicy;
+        if (autoConnectEnabled && AutoConnectMatches(args, scanResponse, reconnectPolicy)) {
+            FBP_LOG(LDEBUG, L"AutoConnect " + winrt::hstring(formatBluetoothAddress(args.BluetoothAddress())));
+            ConnectAsync(args.BluetoothAddress(), reconnectPolicy, 0, args.BluetoothAddressType(), true);
+        }
+
+        SendScanResultAsync(args, scanResponse);
+    }
+
+    bool FlutterBluePlusPlugin::AutoConnectMatches(BluetoothLEAdvertisementReceivedEventArgs const& args, BluetoothLEAdvertisement const& scanResponse, ReconnectPolicy& reconnectPolicy) {
+        // a non-connectable advertisement (e.g. a beacon) would only fail to connect
+        if (!args.IsConnectable()) {
+            return false;
+        }
+        auto bluetoothAddress = args.BluetoothAddress();
+        if (FindAgent(bluetoothAddress)) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(autoConnectMutex);
+        if (autoConnecting.count(bluetoothAddress) > 0) {
+            return false;
+        }
+
+        bool matches = autoConnectAddresses.count(bluetoothAddress) > 0;
+        if (!matches && !autoConnectServices.empty()) {
+            auto advertises = [this](BluetoothLEAdvertisement const& advertisement) {
+                for (auto const& uuid : advertisement.ServiceUuids()) {
+                    if (std::find(autoConnectServices.begin(), autoConnectServices.end(), uuid) != autoConnectServices.end()) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+            matches = advertises(args.Advertisement()) || (scanResponse && advertises(scanResponse));
+        }
+        if (!matches) {
+            return false;
+        }
+
+        autoConnecting.insert(bluetoothAddress);
+        reconnectPolicy = autoConnectReconnectPolicy;
+        return true;
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::ScanDutyCycleAsync(uint32_t generation, std::chrono::milliseconds scanWindow, std::chrono::milliseconds scanInterval) {
+        // Pauses or resumes the watcher of this generation, and returns false once scanning
+        // stopped or restarted. The check & the call share one critical section, so a
+        // StopWatcher that bumps the generation can never be followed by a late Start.
+        auto toggleWatcher = [this, generation](bool start) {
+            std::lock_guard<std::mutex> lock(scanMutex);
+            if (generation != scanGeneration || !bluetoothLEWatcher) {
+                return false;
+            }
+            if (start) {
+                bluetoothLEWatcher.Start();
+            } else {
+                bluetoothLEWatcher.Stop();
+            }
+            return true;
+        };
+        while (true) {
+            co_await winrt::resume_after(scanWindow);
+            if (!toggleWatcher(false)) {
+                co_return;
+            }
+            FBP_LOG(LVERBOSE, L"ScanDutyCycle: watcher paused");
+
+            co_await winrt::resume_after(scanInterval - scanWindow);
+            if (!toggleWatcher(true)) {
+                co_return;
+            }
+            FBP_LOG(LVERBOSE, L"ScanDutyCycle: watcher resumed");
+        }
+    }
+
+    bool FlutterBluePlusPlugin::IsPolling(uint64_t bluetoothAddress, const std::string& characteristic, uint32_t generation) {
+        auto agent = FindAgent(bluetoothAddress);
+        if (!agent) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(agent->valuesMutex);
+        auto poll = agent->polls.find(characteristic);
+        return poll != agent->polls.end() && poll->second == generation;
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::PollAsync(uint64_t bluetoothAddress, std::string service, std::string characteristic, PollSettings poll, std::chrono::milliseconds firstDelay) {
+        thread_local std::mt19937 random{ std::random_device{}() };
+        std::uniform_int_distribution<int64_t> jitter(-poll.jitter.count(), poll.jitter.count());
+        auto remoteId = winrt::to_string(formatBluetoothAddress(bluetoothAddress));
+
+        GattCharacteristic gattCharacteristic{ nullptr };
+        auto delay = firstDelay;
+        int32_t failures = 0;
+        auto backOff = [&]() {
+            if (failures < pollMaxBackoffShift) {
+                failures++;
+            }
+            delay = poll.interval * (int64_t{ 1 } << failures);
+            if (delay > pollMaxBackoff && poll.interval < pollMaxBackoff) {
+                delay = pollMaxBackoff;
+            }
+        };
+        while (true) {
+            co_await winrt::resume_after(delay);
+            delay = poll.interval + std::chrono::milliseconds(jitter(random));
+            if (delay.count() < 0) {
+                delay = std::chrono::milliseconds(0);
+            }
+
+            // stopped, replaced, or disconnected?
+            if (!IsPolling(bluetoothAddress, characteristic, poll.generation)) {
+                FBP_LOG(LDEBUG, L"PollAsync stopped " + winrt::to_hstring(characteristic));
+                co_return;
+            }
+
+            std::vector<uint8_t> bytes;
+            int64_t timestamp = 0;
+            {
+                // polls are bulk reads, behind the operations dart asks for
+                auto agent = FindAgent(bluetoothAddress);
+                if (!agent) {
+                    co_return;
+                }
+                auto opQueue = agent->opQueue;
+                co_await opQueue->WaitAsync(PRIORITY_BULK);
+                OpTurn turn{ opQueue };
+                if (opQueue->closed) {
+                    co_return;
+                }
+
+                try {
+                    if (!gattCharacteristic) {
+                        gattCharacteristic = co_await agent->GetCharacteristicAsync(service, characteristic);
+                    }
+                    auto readValueResult = co_await gattCharacteristic.ReadValueAsync(BluetoothCacheMode::Uncached);
+                    if (readValueResult.Status() != GattCommunicationStatus::Success) {
+                        FBP_LOG(LDEBUG, L"PollAsync read failed " + winrt::to_hstring(characteristic));
+                        backOff();
+                        continue;
+                    }
+                    failures = 0;
+                    timestamp = monotonicMicros();
+                    bytes = to_bytevc(readValueResult.Value());
+                    trace.Record(TPOLL, bluetoothAddress, ((uint64_t)gattCharacteristic.AttributeHandle() << 32) | bytes.size());
+                } catch (...) {
+                    FBP_LOG(LERROR, L"Unexpected error in PollAsync " + winrt::to_hstring(characteristic));
+                    backOff();
+                    continue;
+                }
+            }
+
+            // the device may have disconnected while reading
+            auto agent = FindAgent(bluetoothAddress);
+            if (!agent) {
+                co_return;
+            }
+
+            bool changed = true;
+            {
+                std::lock_guard<std::mutex> lock(agent->valuesMutex);
+                auto& last = agent->lastValues[gattCharacteristic.AttributeHandle()];
+                changed = last.value != bytes || last.time == std::chrono::steady_clock::time_point{};
+                last = CachedValue{ bytes, std::chrono::steady_clock::now() };
+            }
+            if (poll.onlyOnChange && !changed) {
+                continue;
+            }
+            auto layout = agent->RouteOf(gattCharacteristic.AttributeHandle()).payloadLayout;
+
+            // delivered like a notification
+            auto response = EncodableMap{
+                      {"remote_id", remoteId},
+                      {"service_uuid", EncodableValue(service)},
+                      {"secondary_service_uuid", EncodableValue()},
+                      {"characteristic_uuid", EncodableValue(characteristic)},
+                      {"value", EncodableValue(to_hexstring(bytes))},
+                      {"timestamp", EncodableValue(timestamp)},
+                      {"success", EncodableValue(1)},
+                      {"error_string", EncodableValue("success")},
+                      {"error_code", EncodableValue(0)}
+                };
+            if (poll.channelId != 0) {
+                response[EncodableValue("channel_id")] = EncodableValue(poll.channelId);
+                nativeSnapshot.SetValue(poll.channelId, bytes.data(), (int32_t)bytes.size());
+            }
+            if (layout) {
+                response[EncodableValue("decoded")] = layout->Decode(bytes);
+            }
+            EmitNotification(std::move(response), (bluetoothAddress << 16) | gattCharacteristic.AttributeHandle(), timestamp);
+        }
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::SendScanResultAsync(BluetoothLEAdvertisementReceivedEventArgs args, BluetoothLEAdvertisement scanResponse) {
+        // when the radio received it, in microseconds since the unix epoch
+        auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(winrt::clock::to_sys(args.Timestamp()).time_since_epoch()).count();
+        trace.Record(TSCAN_RESULT, args.BluetoothAddress(), (uint64_t)(int64_t)args.RawSignalStrengthInDBm());
+        auto device = co_await Traced("FromBluetoothAddressAsync", BluetoothLEDevice::FromBluetoothAddressAsync(args.BluetoothAddress()));
+
+        // the scan response usually carries the local name
+        auto localName = args.Advertisement().LocalName();
+        if (localName.empty() && scanResponse) {
+            localName = scanResponse.LocalName();
+        }
+        auto name = device ? device.Name() : localName;
+        FBP_LOG(LDEBUG, L"Received BluetoothAddress:" + winrt::to_hstring(args.BluetoothAddress())
+            + L", Name:" + name + L", LocalName:" + localName);
+
+        // the advertisement, followed by its scan response (if any)
+        std::vector<BluetoothLEAdvertisement> sections{ args.Advertisement() };
+        if (scanResponse) {
+            sections.push_back(scanResponse);
+        }
+
+        bool hasService = false;
+        if (targetServiceUuids.size() > 0) {
+            for (auto const& section : sections) {
+                IVector<winrt::guid> services = section.ServiceUuids();
+                for (winrt::guid serviceUuid : services) {
+                    for (flutter::EncodableValue targetServiceUuid : targetServiceUuids) {
+                        if (to_uuidstr(serviceUuid) == std::get<std::string>(targetServiceUuid)) {
+                            hasService = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        } else {
+            hasService = true;
+        }
+
+        EncodableMap manufacturerData;
+        EncodableMap serviceData;
+        EncodableList serviceUuidList;
+        std::set<winrt::guid> seenServiceUuids; // the scan response often repeats them
+        for (auto const& section : sections) {
+            for (auto const& data : section.ManufacturerData()) {
+                auto manufacturerId = data.CompanyId();
+
+                manufacturerData[EncodableValue(manufacturerId)] = EncodableValue(to_hexstring(data.Data()));
+            }
+
+            for (auto const& data : section.GetSectionsByType(0x16)) {
+                std::vector<uint8_t> bytes = to_bytevc(data.Data());
+
+                std::vector<uint8_t> uuidBytes;
+                std::vector<uint8_t> payloadBytes;
+
+                auto dataSize = data.Data().Length();
+                if (dataSize > 0) {
+                    size_t uuidSize = 0;
+
+                    if (dataSize >= 128) {
+                        uuidSize = 16;
+                    } else if (dataSize >= 32) {
+                        uuidSize = 4;
+                    } else {
+                        uuidSize = 2;
+                    }
+
+                    uuidBytes.resize(uuidSize);
+                    for (size_t i=0; i<uuidSize; i++) {
+                        uuidBytes[i] = bytes[i];
+                    }
+
+                    payloadBytes.resize(dataSize - uuidSize);
+                    for (size_t i=0; i<dataSize - uuidSize; i++) {
+                        payloadBytes[i] = bytes[i + uuidSize];
+                    }
+                }
+
+                // Convert Little Endian to Big Endian
+                std::reverse(uuidBytes.begin(), uuidBytes.end());
+                std::reverse(payloadBytes.begin(), payloadBytes.end());
+
+                serviceData[EncodableValue(to_hexstring(uuidBytes))] = EncodableValue(to_hexstring(payloadBytes));
+            }
+
+            IVector<winrt::guid> serviceUuids = section.ServiceUuids();
+            for (winrt::guid uuid : serviceUuids) {
+                if (seenServiceUuids.insert(uuid).second) {
+                    serviceUuidList.push_back(EncodableValue(to_uuidstr(uuid)));
+                }
+            }
+        }
+
+        EncodableValue txPower;
+        if (args.TransmitPowerLevelInDBm()) {
+            txPower = EncodableValue((short)args.TransmitPowerLevelInDBm().Value());
+        }
+
+        if (hasService) {
+            EncodableList advertisements;
+            advertisements.push_back(EncodableMap{
+                {"remote_id", EncodableValue(winrt::to_string(formatBluetoothAddress(args.BluetoothAddress())))},
+                {"platform_name", EncodableValue(winrt::to_string(name))},
+                {"adv_name", EncodableValue(winrt::to_string(localName))},
+                {"connectable", EncodableValue(args.IsConnectable())},
+                {"tx_power_level", txPower},
+                {"manufacturer_data", EncodableValue(manufacturerData)},
+                {"service_uuids", EncodableValue(serviceUuidList)},
+                {"service_data", EncodableValue(serviceData)},
+                {"rssi", EncodableValue(args.RawSignalStrengthInDBm())},
+                {"timestamp", EncodableValue((int64_t)timestamp)}
+            });
+
+            EmitEvent(scanFlow, 1, "OnScanResponse", EncodableMap{
+                    {EncodableValue("advertisements"), advertisements},
+            }, args.BluetoothAddress());
+        }
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::ConnectAsync(uint64_t bluetoothAddress, ReconnectPolicy reconnectPolicy, int32_t operationId,
+                                                               BluetoothAddressType addressType, bool autoConnect) {
+        OperationScope scope{ this, operationId };
+        AutoConnectScope autoConnectScope{ this, bluetoothAddress, autoConnect };
+        BluetoothLEDevice device{ nullptr };
+        try {
+            // the address type from the advertisement saves the OS from resolving it
+            auto fromAddress = addressType == BluetoothAddressType::Unspecified ? BluetoothLEDevice::FromBluetoothAddressAsync(bluetoothAddress)
+                                                                                : BluetoothLEDevice::FromBluetoothAddressAsync(bluetoothAddress, addressType);
+            device = co_await Traced("FromBluetoothAddressAsync", TrackOperation(operationId, fromAddress));
+            if (!device) {
+                method_channel_->InvokeMethod("OnConnectionStateChanged",
+                    std::make_unique<EncodableValue>(EncodableMap{
+                          {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                          {"connection_state", EncodableValue(0)},
+                          {"disconnect_reason_code", EncodableValue()},
+                          {"disconnect_reason_string", EncodableValue("device not found")}
+                    }));
+                co_return;
+            }
+            devicesOpened++;
+
+            auto servicesResult = co_await Traced("GetGattServicesAsync", TrackOperation(operationId, device.GetGattServicesAsync()));
+            if (servicesResult.Status() != GattCommunicationStatus::Success) {
+                std::string errorMessage = getGattCommunicationStatusMessage(servicesResult.Status());
+                FBP_LOG(LERROR, L"GetGattServicesAsync error: " + winrt::to_hstring(errorMessage));
+                device.Close();
+                devicesClosed++;
+
+                method_channel_->InvokeMethod("OnConnectionStateChanged",
+                    std::make_unique<EncodableValue>(EncodableMap{
+                          {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                          {"connection_state", EncodableValue(0)},
+                          {"disconnect_reason_code", EncodableValue((int32_t)servicesResult.Status())},
+                          {"disconnect_reason_string", EncodableValue(errorMessage)}
+                    }));
+
+                co_return;
+            }
+        } catch (winrt::hresult_canceled const&) {
+            FBP_LOG(LINFO, L"ConnectAsync canceled");
+
+            // release the connection attempt, so it does not block the next one
+            if (device) {
+                device.Close();
+                devicesClosed++;
+            }
+
+            // 23789258 = connection canceled
+            method_channel_->InvokeMethod("OnConnectionStateChanged",
+                std::make_unique<EncodableValue>(EncodableMap{
+                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                      {"connection_state", EncodableValue(0)},
+                      {"disconnect_reason_code", EncodableValue(23789258)},
+                      {"disconnect_reason_string", EncodableValue("connection canceled")}
+                }));
+            co_return;
+        } catch (winrt::hresult_error const& ex) {
+            // e.g. the radio was turned off, or the device is out of range
+            FBP_LOG(LERROR, L"ConnectAsync " + ex.message());
+            if (device) {
+                device.Close();
+                devicesClosed++;
+            }
+
+            method_channel_->InvokeMethod("OnConnectionStateChanged",
+                std::make_unique<EncodableValue>(EncodableMap{
+                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                      {"connection_state", EncodableValue(0)},
+                      {"disconnect_reason_code", EncodableValue((int32_t)ex.code())},
+                      {"disconnect_reason_string", EncodableValue(winrt::to_string(ex.message()))}
+                }));
+            co_return;
+        }
+
+        auto connnectionStatusChangedToken = device.ConnectionStatusChanged({ this, &FlutterBluePlusPlugin::BluetoothLEDevice_ConnectionStatusChanged });
+        auto deviceAgent = std::make_shared<BluetoothDeviceAgent>(device, connnectionStatusChangedToken);
+        deviceAgent->reconnectPolicy = reconnectPolicy;
+#if FBP_CONNECTION_PARAMETERS
+        try {
+            deviceAgent->connectionParametersChangedToken = device.ConnectionParametersChanged({ this, &FlutterBluePlusPlugin::BluetoothLEDevice_ConnectionParametersChanged });
+            deviceAgent->connectionPhyChangedToken = device.ConnectionPhyChanged({ this, &FlutterBluePlusPlugin::BluetoothLEDevice_ConnectionParametersChanged });
+        } catch (winrt::hresult_error const&) {
+            // Windows 10
+        }
+#endif
+
+        // Already connected, by a connect that finished first? Keep the existing agent,
+        // which holds the subscriptions. Looked up & inserted at once, so of two racing
+        // connects exactly one wins.
+        bool inserted;
+        {
+            std::lock_guard<std::mutex> lock(devicesMutex);
+            inserted = connectedDevices.emplace(bluetoothAddress, deviceAgent).second;
+            nativeSnapshot.connectedCount = (int32_t)connectedDevices.size();
+        }
+        if (!inserted) {
+            device.ConnectionStatusChanged(connnectionStatusChangedToken);
+#if FBP_CONNECTION_PARAMETERS
+            if (deviceAgent->connectionParametersChangedToken) {
+                device.ConnectionParametersChanged(deviceAgent->connectionParametersChangedToken);
+                device.ConnectionPhyChanged(deviceAgent->connectionPhyChangedToken);
+            }
+#endif
+            deviceAgent->Close();
+            devicesClosed++;
+            method_channel_->InvokeMethod("OnConnectionStateChanged",
+                std::make_unique<EncodableValue>(EncodableMap{
+                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                  {"connection_state", EncodableValue(1)},
+                  {"disconnect_reason_code", EncodableValue()},
+                  {"disconnect_reason_string", EncodableValue()}
+                }));
+            co_return;
+        }
+        trace.Record(TCONNECTED, bluetoothAddress);
+        nativeSnapshot.AddDevice(bluetoothAddress);
+        OpenSessionAsync(bluetoothAddress, device.BluetoothDeviceId());
+
+        method_channel_->InvokeMethod("OnConnectionStateChanged",
+            std::make_unique<EncodableValue>(EncodableMap{
+              {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+              {"connection_state", EncodableValue(1)},
+              {"disconnect_reason_code", EncodableValue()},
+              {"disconnect_reason_string", EncodableValue()}
+            }));
+    }
+
+    void FlutterBluePlusPlugin::BluetoothLEDevice_ConnectionStatusChanged(BluetoothLEDevice sender, IInspectable args) {
+        FBP_LOG(LDEBUG, L"ConnectionStatusChanged " + winrt::to_hstring((int32_t)sender.ConnectionStatus()));
+        if (sender.ConnectionStatus() == BluetoothConnectionStatus::Disconnected) {
+            auto bluetoothAddress = sender.BluetoothAddress();
+            trace.Record(TDISCONNECTED, bluetoothAddress);
+
+            // reconnect natively?
+            auto agent = FindAgent(bluetoothAddress);
+            if (agent && agent->reconnectPolicy.maxAttempts > 0) {
+                if (agent->reconnecting.exchange(true)) {
+                    return; // already reconnecting
+                }
+                if (auto snapshot = nativeSnapshot.FindDevice(bluetoothAddress)) {
+                    snapshot->connected = false;
+                }
+
+                // dart keeps its subscriptions & caches while we reconnect
+                method_channel_->InvokeMethod("OnConnectionStateChanged",
+                    std::make_unique<EncodableValue>(EncodableMap{
+                          {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                          {"connection_state", EncodableValue(0)},
+                          {"disconnect_reason_code", EncodableValue()},
+                          {"disconnect_reason_string", EncodableValue("reconnecting")},
+                          {"reconnecting", EncodableValue(true)}
+                    }));
+
+                ReconnectAsync(bluetoothAddress);
+                return;
+            }
+
+            CleanConnection(bluetoothAddress);
+
+            method_channel_->InvokeMethod("OnConnectionStateChanged",
+                std::make_unique<EncodableValue>(EncodableMap{
+                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                      {"connection_state", EncodableValue(0)},
+                      {"disconnect_reason_code", EncodableValue()},
+                      {"disconnect_reason_string", EncodableValue()}
+                }));
+        }
+    }
+
+    void FlutterBluePlusPlugin::BluetoothLEDevice_ConnectionParametersChanged(BluetoothLEDevice sender, IInspectable) {
+#if FBP_CONNECTION_PARAMETERS
+        try {
+            auto parameters = to_bmConnectionParameters(sender);
+            FBP_LOG(LDEBUG, L"ConnectionParametersChanged " + winrt::to_hstring(sender.BluetoothAddress()));
+            method_channel_->InvokeMethod("OnConnectionParametersChanged", std::make_unique<EncodableValue>(std::move(parameters)));
+        } catch (winrt::hresult_error const&) {
+            // Windows 10
+        }
+#else
+        (void)sender;
+#endif
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::ReconnectAsync(uint64_t bluetoothAddress) {
+        auto agent = FindAgent(bluetoothAddress);
+        if (!agent) {
+            co_return;
+        }
+        auto device = agent->Device();
+        auto policy = agent->reconnectPolicy;
+        if (policy.maxDelay < policy.initialDelay) {
+            policy.maxDelay = policy.initialDelay;
+        }
+
+        auto delay = policy.initialDelay;
+        for (int32_t attempt = 1; attempt <= policy.maxAttempts; attempt++) {
+            co_await winrt::resume_after(delay);
+            delay = delay * 2 < policy.maxDelay ? delay * 2 : policy.maxDelay;
+
+            // disconnected by dart in the meantime?
+            if (agent->opQueue->closed || !agent->reconnecting) {
+                co_return;
+            }
+
+            FBP_LOG(LDEBUG, L"ReconnectAsync attempt " + winrt::to_hstring(attempt));
+
+            try {
+                // an uncached gatt request makes the OS connect the link again
+                auto servicesResult = co_await device.GetGattServicesAsync(BluetoothCacheMode::Uncached);
+                if (servicesResult.Status() != GattCommunicationStatus::Success ||
+                    device.ConnectionStatus() != BluetoothConnectionStatus::Connected) {
+                    continue;
+                }
+
+                if (agent->opQueue->closed || !agent->reconnecting) {
+                    co_return;
+                }
+
+                // The characteristics and their ValueChanged handlers survive in the agent,
+                // but the peripheral may have forgotten the CCCDs, so write them again.
+                for (auto& c : agent->Subscribed()) {
+                    auto props = (unsigned int)c.CharacteristicProperties();
+                    auto descriptorValue = (props & (unsigned int)GattCharacteristicProperties::Notify) ? GattClientCharacteristicConfigurationDescriptorValue::Notify
+                                                                                                        : GattClientCharacteristicConfigurationDescriptorValue::Indicate;
+                    auto status = co_await c.WriteClientCharacteristicConfigurationDescriptorAsync(descriptorValue);
+                    if (status != GattCommunicationStatus::Success) {
+                        FBP_LOG(LERROR, L"ReconnectAsync: could not restore subscription " + winrt::to_hstring(to_uuidstr(c.Uuid())));
+                    }
+                }
+            } catch (...) {
+                FBP_LOG(LERROR, L"Unexpected error in ReconnectAsync");
+                continue;
+            }
+
+            if (agent->opQueue->closed || !agent->reconnecting.exchange(false)) {
+                co_return;
+            }
+            trace.Record(TRECONNECTED, bluetoothAddress, attempt);
+            if (auto snapshot = nativeSnapshot.FindDevice(bluetoothAddress)) {
+                snapshot->connected = true;
+            }
+
+            FBP_LOG(LINFO, L"ReconnectAsync: reconnected after " + winrt::to_hstring(attempt) + L" attempt(s)");
+            method_channel_->InvokeMethod("OnConnectionStateChanged",
+                std::make_unique<EncodableValue>(EncodableMap{
+                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                      {"connection_state", EncodableValue(1)},
+                      {"disconnect_reason_code", EncodableValue()},
+                      {"disconnect_reason_string", EncodableValue()}
+                }));
+            co_return;
+        }
 
-        auto data = to_bytevc(manufacturerData.Data());
-        result.insert(result.end(), data.begin(), data.end());
-        return result;
+        // gave up
+        FBP_LOG(LINFO, L"ReconnectAsync: giving up");
+        CleanConnection(bluetoothAddress);
     }
 
-    void FlutterBluePlusPlugin::BluetoothLEWatcher_Received(
-        BluetoothLEAdvertisementWatcher sender,
-        BluetoothLEAdvertisementReceivedEventArgs args) {
-        SendScanResultAsync(args);
+    winrt::fire_and_forget FlutterBluePlusPlugin::OpenSessionAsync(uint64_t bluetoothAddress, BluetoothDeviceId deviceId) {
+        try {
+            auto session = co_await GattSession::FromDeviceIdAsync(deviceId);
+            auto agent = FindAgent(bluetoothAddress);
+            bool attached = false;
+            if (session && agent) {
+                std::lock_guard<std::mutex> lock(agent->gattMutex);
+                if (!agent->session && agent->device) {
+                    agent->session = session;
+                    agent->maxPduSizeChangedToken = session.MaxPduSizeChanged([this, bluetoothAddress](GattSession const& sender, IInspectable const&) {
+                        SendMtu(bluetoothAddress, sender.MaxPduSize());
+                    });
+                    attached = true;
+                }
+            }
+            if (!attached) {
+                if (session) {
+                    session.Close();
+                }
+                co_return;
+            }
+            SendMtu(bluetoothAddress, session.MaxPduSize());
+        } catch (winrt::hresult_error const& e) {
+            FBP_LOG(LERROR, L"OpenSessionAsync " + e.message());
+        }
+    }
+
+    void FlutterBluePlusPlugin::SendMtu(uint64_t bluetoothAddress, uint16_t mtu) {
+        if (auto snapshot = nativeSnapshot.FindDevice(bluetoothAddress)) {
+            snapshot->mtu = mtu;
+        }
+        method_channel_->InvokeMethod("OnMtuChanged",
+            std::make_unique<EncodableValue>(EncodableMap{
+                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                  {"mtu", EncodableValue((int32_t)mtu)},
+                  {"success", EncodableValue(1)},
+                  {"error_string", EncodableValue("success")},
+                  {"error_code", EncodableValue(0)}
+            }));
+    }
+
+    std::shared_ptr<BluetoothDeviceAgent> FlutterBluePlusPlugin::FindAgent(uint64_t bluetoothAddress) {
+        std::lock_guard<std::mutex> lock(devicesMutex);
+        auto it = connectedDevices.find(bluetoothAddress);
+        return it != connectedDevices.end() ? it->second : nullptr;
+    }
+
+    std::vector<std::shared_ptr<BluetoothDeviceAgent>> FlutterBluePlusPlugin::ConnectedAgents() {
+        std::lock_guard<std::mutex> lock(devicesMutex);
+        std::vector<std::shared_ptr<BluetoothDeviceAgent>> agents;
+        for (auto& device : connectedDevices) {
+            agents.push_back(device.second);
+        }
+        return agents;
+    }
+
+    void FlutterBluePlusPlugin::CleanConnection(uint64_t bluetoothAddress) {
+        std::shared_ptr<BluetoothDeviceAgent> deviceAgent;
+        {
+            std::lock_guard<std::mutex> lock(devicesMutex);
+            auto node = connectedDevices.extract(bluetoothAddress);
+            if (!node.empty()) {
+                deviceAgent = std::move(node.mapped());
+                nativeSnapshot.connectedCount = (int32_t)connectedDevices.size();
+            }
+        }
+        if (deviceAgent) {
+            nativeSnapshot.RemoveDevice(bluetoothAddress);
+            deviceAgent->device.ConnectionStatusChanged(deviceAgent->connnectionStatusChangedToken);
+#if FBP_CONNECTION_PARAMETERS
+            if (deviceAgent->connectionParametersChangedToken) {
+                deviceAgent->device.ConnectionParametersChanged(deviceAgent->connectionParametersChangedToken);
+                deviceAgent->device.ConnectionPhyChanged(deviceAgent->connectionPhyChangedToken);
+            }
+            BluetoothLEPreferredConnectionParametersRequest request{ nullptr };
+            {
+                std::lock_guard<std::mutex> lock(deviceAgent->gattMutex);
+                request = std::exchange(deviceAgent->connectionParametersRequest, nullptr);
+            }
+            if (request) {
+                request.Close();
+            }
+#endif
+            // closed first, so running operations register no handler after these are collected
+            deviceAgent->opQueue->Close();
+            std::vector<std::pair<GattCharacteristic, winrt::event_token>> handlers;
+            {
+                std::lock_guard<std::mutex> lock(deviceAgent->gattMutex);
+                for (auto& tokenPair : deviceAgent->valueChangedTokens) {
+                    handlers.emplace_back(deviceAgent->gattCharacteristics.at(tokenPair.first), tokenPair.second);
+                }
+            }
+            for (auto& handler : handlers) {
+                handler.first.ValueChanged(handler.second);
+            }
+            deviceAgent->Close();
+            devicesClosed++;
+
+            method_channel_->InvokeMethod("OnConnectionStateChanged",
+                std::make_unique<EncodableValue>(EncodableMap{
+                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                      {"connection_state", EncodableValue(0)},
+                      {"disconnect_reason_code", EncodableValue()},
+                      {"disconnect_reason_string", EncodableValue()}
+                }));
+        }
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::DiscoverServicesAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::vector<winrt::guid> serviceUuids, bool lazyDescriptors, int32_t operationId, MethodResultPtr result) {
+        OperationScope scope{ this, operationId };
+        auto& bluetoothDeviceAgent = *agent;
+        try {
+            auto device = bluetoothDeviceAgent.Device();
+            if (!device) {
+                throw winrt::hresult_error(RO_E_CLOSED, L"device is disconnected");
+            }
+
+            // all services, or only ask the device for the ones dart needs
+            std::vector<GattDeviceService> gattServices;
+            bool success = true;
+            if (serviceUuids.empty()) {
+                auto serviceResult = co_await Traced("GetGattServicesAsync", TrackOperation(operationId, device.GetGattServicesAsync()));
+                success = serviceResult.Status() == GattCommunicationStatus::Success;
+                if (success) {
+                    for (auto s : serviceResult.Services()) {
+                        gattServices.push_back(s);
+                    }
+                }
+            }
+            for (const auto& uuid : serviceUuids) {
+                auto serviceResult = co_await Traced("GetGattServicesForUuidAsync", TrackOperation(operationId, device.GetGattServicesForUuidAsync(uuid)));
+                success = serviceResult.Status() == GattCommunicationStatus::Success;
+                if (!success) {
+                    break;
+                }
+                for (auto s : serviceResult.Services()) {
+                    gattServices.push_back(s);
+                }
+            }
+            if (!success) {
+                EncodableList services;
+                SendResponse(std::move(result), "OnDiscoveredServices", EncodableMap{
+                          {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                          {"services", EncodableValue(services)},
+                          {"success", EncodableValue(0)},
+                          {"error_string", EncodableValue("Invalid status")},
+                          {"error_code", EncodableValue(0)}
+                    });
+                co_return;
+            }
+
+            auto bluetoothAddress = bluetoothDeviceAgent.bluetoothAddress;
+            EncodableList services;
+
+            for (auto s : gattServices) {
+                EncodableList includedServices;
+                auto includedServiceResult = co_await Traced("GetIncludedServicesAsync", TrackOperation(operationId, s.GetIncludedServicesAsync()));
+                if (includedServiceResult.Status() != GattCommunicationStatus::Success) {
+                    //includedServices = co_await bmBluetoothService(includedServiceResult, bluetoothAddress);
+                }
+
+                auto service = EncodableMap{
+                        {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                        {"service_uuid", to_uuidstr(s.Uuid())},
+                        {"is_primary", EncodableValue(true)},
+                        {"included_services", EncodableValue(includedServices)}
+                };
+
+                auto characteristicResult = co_await Traced("GetCharacteristicsAsync", TrackOperation(operationId, s.GetCharacteristicsAsync()));
+                if (characteristicResult.Status() == GattCommunicationStatus::Success) {
+                    EncodableList characteristics;
+                    for (auto c : characteristicResult.Characteristics()) {
+                        EncodableList descriptors;
+                        if (!lazyDescriptors) {
+                            auto descriptorsResult = co_await Traced("GetDescriptorsAsync", TrackOperation(operationId, c.GetDescriptorsAsync()));
+                            for (auto d : descriptorsResult.Descriptors()) {
+                                descriptors.push_back(to_bmDescriptor(bluetoothAddress, c, d));
+                            }
+                        }
+
+                        auto props = (unsigned int)c.CharacteristicProperties();
+                        auto propsMap = EncodableMap{
+                                {"broadcast", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Broadcast))},
+                                {"read", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Read))},
+                                {"write_without_response", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::WriteWithoutResponse))},
+                                {"write", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Write))},
+                                {"notify", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Notify))},
+                                {"indicate", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Indicate))},
+                                {"authenticated_signed_writes", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::AuthenticatedSignedWrites))},
+                                {"extended_properties", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::ExtendedProperties))},
+                                {"notify_encryption_required", EncodableValue(false)},
+                                {"indicate_encryption_required", EncodableValue(false)}
+                        };
+
+                        characteristics.push_back(EncodableMap{
+                                {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                                {"service_uuid", to_uuidstr(c.Service().Uuid())},
+                                {"secondary_service_uuid", EncodableValue()},
+                                {"characteristic_uuid", to_uuidstr(c.Uuid())},
+                                {"descriptors", EncodableValue(descriptors)},
+                                {"descriptors_pending", EncodableValue(lazyDescriptors)},
+                                {"properties", EncodableValue(propsMap)}
+                        });
+                    }
+                    service.insert({ "characteristics", characteristics });
+                }
+
+                services.push_back(service);
+            }
+
+            SendResponse(std::move(result), "OnDiscoveredServices", EncodableMap{
+                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                  {"services", EncodableValue(services)},
+                  {"partial", EncodableValue(!serviceUuids.empty())},
+                  {"success", EncodableValue(1)},
+                  {"error_string", EncodableValue("success")},
+                  {"error_code", EncodableValue(0)}
+            });
+        } catch (winrt::hresult_canceled const& ex) {
+            FBP_LOG(LINFO, L"DiscoverServicesAsync canceled");
+            SendResponse(std::move(result), "OnDiscoveredServices", EncodableMap{
+                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                  {"services", EncodableValue(EncodableList())},
+                  {"success", EncodableValue(0)},
+                  {"error_string", EncodableValue("operation canceled")},
+                  {"error_code", EncodableValue((int32_t)ex.code())}
+            });
+        } catch (winrt::hresult_error const& ex) {
+            FBP_LOG(LERROR, L"DiscoverServicesAsync " + ex.message());
+            SendResponse(std::move(result), "OnDiscoveredServices", EncodableMap{
+                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                  {"services", EncodableValue(EncodableList())},
+                  {"success", EncodableValue(0)},
+                  {"error_string", EncodableValue(winrt::to_string(ex.message()))},
+                  {"error_code", EncodableValue((int32_t)ex.code())}
+            });
+        } catch (...) {
+            FBP_LOG(LERROR, L"Unexpected error in DiscoverServicesAsync");
+            SendResponse(std::move(result), "OnDiscoveredServices", EncodableMap{
+                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                  {"services", EncodableValue(EncodableList())},
+                  {"success", EncodableValue(0)},
+                  {"error_string", EncodableValue("Unexpected error in DiscoverServicesAsync")},
+                  {"error_code", EncodableValue(0)}
+            });
+        }
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::SetNotifiableAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::string service, std::string characteristic, int32_t bleInputProperty, int32_t channelId, std::shared_ptr<const PayloadLayout> payloadLayout, int64_t nativePort, int32_t priority, int32_t operationId, MethodResultPtr result) {
+        FBP_LOG(LDEBUG, L"SetNotifiableAsync " + winrt::to_hstring((int32_t) bleInputProperty));
+        OperationScope scope{ this, operationId };
+
+        // The agent is ours until we return, but it may be closed by a disconnect
+        // at any await, after which nothing may be registered with it.
+        auto& bluetoothDeviceAgent = *agent;
+        auto opQueue = bluetoothDeviceAgent.opQueue;
+        try {
+            co_await WaitTurnAsync(opQueue, priority, operationId);
+            OpTurn turn{ opQueue };
+            if (opQueue->closed) {
+                if (result) {
+                    result->Error("setNotifyValue", "Device is disconnected");
+                }
+                co_return;
+            }
+
+            auto gattCharacteristic = co_await Traced("GetCharacteristicAsync", TrackOperation(operationId, bluetoothDeviceAgent.GetCharacteristicAsync(service, characteristic)));
+
+            // check notify-able
+            auto props = (unsigned int)gattCharacteristic.CharacteristicProperties();
+            if ((props & (unsigned int)GattCharacteristicProperties::Notify) == 0 &&
+                (props & (unsigned int)GattCharacteristicProperties::Indicate) == 0) {
+                std::vector<uint8_t> bytes;
+                SendResponse(std::move(result), "OnDescriptorWritten", EncodableMap{
+                        {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                        {"service_uuid", EncodableValue(service)},
+                        {"secondary_service_uuid", EncodableValue()},
+                        {"characteristic_uuid", EncodableValue(characteristic)},
+                        {"descriptor_uuid", EncodableValue("2902")},
+                        {"value", EncodableValue(to_hexstring(bytes))},
+                        {"success", EncodableValue(0)},
+                        {"error_string", EncodableValue("neither NOTIFY nor INDICATE properties are supported by this BLE characteristic")},
+                        {"error_code", EncodableValue(587024)}
+                    });
+                co_return;
+            }
+
+            auto descriptorValue = bleInputProperty == 1 ? GattClientCharacteristicConfigurationDescriptorValue::Notify
+                                                         : bleInputProperty == 2 ? GattClientCharacteristicConfigurationDescriptorValue::Indicate
+                                                                                 : GattClientCharacteristicConfigurationDescriptorValue::None;
+
+            auto writeDescriptorStatus = co_await Traced("WriteClientCharacteristicConfigurationDescriptorAsync", TrackOperation(operationId, gattCharacteristic.WriteClientCharacteristicConfigurationDescriptorAsync(descriptorValue)));
+            FBP_LOG(LDEBUG, L"WriteClientCharacteristicConfigurationDescriptorAsync " + winrt::to_hstring((int32_t) writeDescriptorStatus));
+            if (opQueue->closed) {
+                if (result) {
+                    result->Error("setNotifyValue", "Device is disconnected");
+                }
+                co_return;
+            }
+
+            // register before responding, so no notification is missed
+            if (bleInputProperty != 0) {
+                std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.gattMutex);
+                if (channelId != 0) {
+                    bluetoothDeviceAgent.notifyChannelIds[gattCharacteristic.AttributeHandle()] = channelId;
+                }
+                if (payloadLayout) {
+                    bluetoothDeviceAgent.payloadLayouts[gattCharacteristic.AttributeHandle()] = payloadLayout;
+                } else {
+                    bluetoothDeviceAgent.payloadLayouts.erase(gattCharacteristic.AttributeHandle());
+                }
+                if (nativePort != 0) {
+                    bluetoothDeviceAgent.notifyPorts[gattCharacteristic.AttributeHandle()] = nativePort;
+                } else {
+                    bluetoothDeviceAgent.notifyPorts.erase(gattCharacteristic.AttributeHandle());
+                }
+                // closed since the check above? CleanConnection no longer unregisters handlers
+                if (!opQueue->closed) {
+                    bluetoothDeviceAgent.valueChangedTokens[characteristic] = gattCharacteristic.ValueChanged({ this, &FlutterBluePlusPlugin::GattCharacteristic_ValueChanged });
+                }
+            }
+            else {
+                winrt::event_token token;
+                {
+                    std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.gattMutex);
+                    bluetoothDeviceAgent.notifyChannelIds.erase(gattCharacteristic.AttributeHandle());
+                    bluetoothDeviceAgent.payloadLayouts.erase(gattCharacteristic.AttributeHandle());
+                    bluetoothDeviceAgent.notifyPorts.erase(gattCharacteristic.AttributeHandle());
+                    token = std::exchange(bluetoothDeviceAgent.valueChangedTokens[characteristic], {});
+                }
+                gattCharacteristic.ValueChanged(token);
+            }
+
+            std::vector<uint8_t> bytes;
+            bytes.push_back((uint8_t) descriptorValue);
+
+            auto success = writeDescriptorStatus == GattCommunicationStatus::Success;
+            SendResponse(std::move(result), "OnDescriptorWritten", EncodableMap{
+                    {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                    {"service_uuid", EncodableValue(service)},
+                    {"secondary_service_uuid", EncodableValue()},
+                    {"characteristic_uuid", EncodableValue(characteristic)},
+                    {"descriptor_uuid", EncodableValue("2902")},
+                    {"value", EncodableValue(to_hexstring(bytes))},
+                    {"success", EncodableValue(success ? 1 : 0)},
+                    {"error_string", EncodableValue(success ? "success" : "invalid status")},
+                    {"error_code", EncodableValue(success ? 0 : (int32_t) writeDescriptorStatus)}
+                });
+        } catch (winrt::hresult_canceled const& ex) {
+            FBP_LOG(LINFO, L"SetNotifiableAsync canceled");
+            SendResponse(std::move(result), "OnDescriptorWritten", EncodableMap{
+                    {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                    {"service_uuid", EncodableValue(service)},
+                    {"secondary_service_uuid", EncodableValue()},
+                    {"characteristic_uuid", EncodableValue(characteristic)},
+                    {"descriptor_uuid", EncodableValue("2902")},
+                    {"value", EncodableValue(std::string())},
+                    {"success", EncodableValue(0)},
+                    {"error_string", EncodableValue("operation canceled")},
+                    {"error_code", EncodableValue((int32_t)ex.code())}
+                });
+        } catch(...) {
+            FBP_LOG(LERROR, L"Unexpected error in SetNotifiableAsync");
+            if (result) {
+                result->Error("setNotifyValue", "Unexpected error in SetNotifiableAsync");
+            }
+            co_return;
+        }
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::ReadValueAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::string service, std::string characteristic, int32_t maxAge, int32_t priority, int32_t operationId, MethodResultPtr result) {
+        OperationScope scope{ this, operationId };
+        auto& bluetoothDeviceAgent = *agent;
+        auto remoteId = winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress));
+        bool inFlight = false;
+        uint16_t handle = 0;
+
+        // Serves a fresh enough cached value, or joins the read already in flight for
+        // the handle. Otherwise this read becomes the one in flight. True if answered.
+        auto serveOrJoin = [&]() {
+            // the cached value is copied out, and sent once the lock is released
+            std::vector<uint8_t> value;
+            {
+                std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.valuesMutex);
+                auto cached = bluetoothDeviceAgent.lastValues.find(handle);
+                if (maxAge < 0 || cached == bluetoothDeviceAgent.lastValues.end() ||
+                    std::chrono::steady_clock::now() - cached->second.time > std::chrono::milliseconds(maxAge)) {
+                    auto pending = bluetoothDeviceAgent.pendingReads.find(handle);
+                    if (pending != bluetoothDeviceAgent.pendingReads.end()) {
+                        pending->second.push_back(std::move(result));
+                        return true;
+                    }
+                    bluetoothDeviceAgent.pendingReads[handle];
+                    inFlight = true;
+                    return false;
+                }
+                value = cached->second.value;
+            }
+            SendResponse(std::move(result), "OnCharacteristicReceived", EncodableMap{
+                      {"remote_id", remoteId},
+                      {"service_uuid", EncodableValue(service)},
+                      {"secondary_service_uuid", EncodableValue()},
+                      {"characteristic_uuid", EncodableValue(characteristic)},
+                      {"value", EncodableValue(to_hexstring(value))},
+                      {"success", EncodableValue(1)},
+                      {"error_string", EncodableValue("success")},
+                      {"error_code", EncodableValue(0)}
+                });
+            return true;
+        };
+
+        // A characteristic read before is known without an await, so its readers are
+        // answered or coalesced now, rather than each waiting for a turn of its own.
+        auto known = bluetoothDeviceAgent.FindCharacteristic(characteristic);
+        if (known && ((unsigned int)known.CharacteristicProperties() & (unsigned int)GattCharacteristicProperties::Read) != 0) {
+            handle = known.AttributeHandle();
+            if (serveOrJoin()) {
+                co_return;
+            }
+        }
+
+        // wait for our turn. If the device disconnected meanwhile, the agent is closed.
+        auto opQueue = bluetoothDeviceAgent.opQueue;
+        try {
+            co_await WaitTurnAsync(opQueue, priority, operationId);
+            OpTurn turn{ opQueue };
+            if (opQueue->closed) {
+                FailReads(bluetoothDeviceAgent, inFlight, handle, std::move(result), "Device is disconnected");
+                co_return;
+            }
+
+            auto gattCharacteristic = co_await Traced("GetCharacteristicAsync", TrackOperation(operationId, bluetoothDeviceAgent.GetCharacteristicAsync(service, characteristic)));
+
+            // check readable
+            auto props = (unsigned int)gattCharacteristic.CharacteristicProperties();
+            if ((props & (unsigned int)GattCharacteristicProperties::Read) == 0) {
+                std::vector<uint8_t> bytes;
+                SendResponse(std::move(result), "OnCharacteristicReceived", EncodableMap{
+                        {"remote_id", remoteId},
+                        {"service_uuid", EncodableValue(service)},
+                        {"secondary_service_uuid", EncodableValue()},
+                        {"characteristic_uuid", EncodableValue(characteristic)},
+                        {"value", EncodableValue(to_hexstring(bytes))},
+                        {"success", EncodableValue(0)},
+                        {"error_string", EncodableValue("The READ property is not supported by this BLE characteristic")},
+                        {"error_code", EncodableValue(572824)}
+                    });
+                co_return;
+            }
+
+            // first read of this characteristic: resolved only now
+            if (!inFlight) {
+                handle = gattCharacteristic.AttributeHandle();
+                if (serveOrJoin()) {
+                    co_return;
+                }
+            }
+
+            auto readValueResult = co_await Traced("ReadValueAsync", TrackOperation(operationId, gattCharacteristic.ReadValueAsync(BluetoothCacheMode::Uncached)));
+            trace.Record(TREAD, bluetoothDeviceAgent.bluetoothAddress,
+                ((uint64_t)handle << 32) | ((uint64_t)readValueResult.Status() << 16) | (readValueResult.Value() ? readValueResult.Value().Length() : 0));
+            if (readValueResult.Status() != GattCommunicationStatus::Success) {
+                CompleteReads(bluetoothDeviceAgent, handle, std::move(result), EncodableMap{
+                          {"remote_id", remoteId},
+                          {"service_uuid", EncodableValue(service)},
+                          {"secondary_service_uuid", EncodableValue()},
+                          {"characteristic_uuid", EncodableValue(characteristic)},
+                          {"value", EncodableValue(std::string())},
+                          {"success", EncodableValue(0)},
+                          {"error_string", EncodableValue(getGattCommunicationStatusMessage(readValueResult.Status()))},
+                          {"error_code", EncodableValue((int32_t)readValueResult.Status())}
+                    });
+                co_return;
+            }
+
+            auto bytes = to_bytevc(readValueResult.Value());
+
+            FBP_LOG(LDEBUG, L"ReadValueAsync " + winrt::to_hstring(characteristic) + L", " + winrt::to_hstring(to_hexstring(bytes)));
+
+            {
+                std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.valuesMutex);
+                bluetoothDeviceAgent.lastValues[handle] = CachedValue{ bytes, std::chrono::steady_clock::now() };
+            }
+
+            CompleteReads(bluetoothDeviceAgent, handle, std::move(result), EncodableMap{
+                      {"remote_id", remoteId},
+                      {"service_uuid", EncodableValue(service)},
+                      {"secondary_service_uuid", EncodableValue()},
+                      {"characteristic_uuid", EncodableValue(characteristic)},
+                      {"value", EncodableValue(to_hexstring(bytes))},
+                      {"success", EncodableValue(1)},
+                      {"error_string", EncodableValue("success")},
+                      {"error_code", EncodableValue(0)}
+                });
+        } catch (winrt::hresult_canceled const& ex) {
+            FBP_LOG(LINFO, L"ReadValueAsync canceled");
+            auto response = EncodableMap{
+                      {"remote_id", remoteId},
+                      {"service_uuid", EncodableValue(service)},
+                      {"secondary_service_uuid", EncodableValue()},
+                      {"characteristic_uuid", EncodableValue(characteristic)},
+                      {"value", EncodableValue(std::string())},
+                      {"success", EncodableValue(0)},
+                      {"error_string", EncodableValue("operation canceled")},
+                      {"error_code", EncodableValue((int32_t)ex.code())}
+                };
+            // reads without a method result all wait on the same event, which this answers
+            bool eventAnswered = !result;
+            SendResponse(std::move(result), "OnCharacteristicReceived", response);
+
+            // Only this read was canceled, not the reads that joined it. They read again,
+            // the first one owning the new read & the others joining it. It has no operation
+            // id, so it cannot be canceled in turn.
+            if (inFlight) {
+                std::vector<MethodResultPtr> joined;
+                {
+                    std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.valuesMutex);
+                    joined = std::move(bluetoothDeviceAgent.pendingReads[handle]);
+                    bluetoothDeviceAgent.pendingReads.erase(handle);
+                }
+                for (auto& r : joined) {
+                    if (!r) {
+                        if (eventAnswered) {
+                            continue;
+                        }
+                        eventAnswered = true;
+                    }
+                    ReadValueAsync(agent, service, characteristic, -1, priority, 0, std::move(r));
+                }
+            }
+        } catch(...) {
+            FBP_LOG(LERROR, L"Unexpected error in ReadValueAsync");
+            FailReads(bluetoothDeviceAgent, inFlight, handle, std::move(result), "Unexpected error in ReadValueAsync");
+        }
+    }
+
+    // fails this read and, if it was the one in flight, every read that joined it
+    void FlutterBluePlusPlugin::FailReads(BluetoothDeviceAgent& bluetoothDeviceAgent, bool inFlight, uint16_t handle, MethodResultPtr result, const std::string& message) {
+        std::vector<MethodResultPtr> waiting;
+        if (inFlight) {
+            std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.valuesMutex);
+            waiting = std::move(bluetoothDeviceAgent.pendingReads[handle]);
+            bluetoothDeviceAgent.pendingReads.erase(handle);
+        }
+        waiting.push_back(std::move(result));
+        for (auto& r : waiting) {
+            if (r) {
+                r->Error("readCharacteristic", message);
+            }
+        }
+    }
+
+    // answers the in-flight read of this handle, and every read that joined it
+    void FlutterBluePlusPlugin::CompleteReads(BluetoothDeviceAgent& bluetoothDeviceAgent, uint16_t handle, MethodResultPtr result, const EncodableMap& response) {
+        std::vector<MethodResultPtr> waiting;
+        {
+            std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.valuesMutex);
+            waiting = std::move(bluetoothDeviceAgent.pendingReads[handle]);
+            bluetoothDeviceAgent.pendingReads.erase(handle);
+        }
+        waiting.push_back(std::move(result));
+
+        // reads without a method result all wait on the same event, so send it once
+        bool sendEvent = false;
+        for (auto& r : waiting) {
+            if (r) {
+                r->Success(EncodableValue(response));
+            } else {
+                sendEvent = true;
+            }
+        }
+        if (sendEvent) {
+            method_channel_->InvokeMethod("OnCharacteristicReceived", std::make_unique<EncodableValue>(response));
+        }
+    }
+
+    winrt::fire_and_forget FlutterBluePlusPlugin::WriteValueAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::string service, std::string characteristic, std::vector<uint8_t> value, int32_t bleOutputProperty, int32_t priority, int32_t operationId, MethodResultPtr result) {
+        OperationScope scope{ this, operationId };
+
+        // wait for our turn. If the device disconnected meanwhile, the agent is closed.
+        auto& bluetoothDeviceAgent = *agent;
+        auto opQueue = bluetoothDeviceAgent.opQueue;
+        try {
+            co_await WaitTurnAsync(opQueue, priority, operationId);
+            OpTurn turn{ opQueue };
+            if (opQueue->closed) {
+                if (result) {
+                    result->Error("writeCharacteristic", "Device is disconnected");
+                }
+                co_return;
+            }
+
+            auto gattCharacteristic = co_await Traced("GetCharacteristicAsync", TrackOperation(operationId, bluetoothDeviceAgent.GetCharacteristicAsync(service, characteristic)));
+            auto writeOption = bleOutputProperty == 0 ? GattWriteOption::WriteWithResponse : GattWriteOption::WriteWithoutResponse;
+
+            // check writeable
+            std::string errorString;
+            auto props = (unsigned int)gattCharacteristic.CharacteristicProperties();
+            if (writeOption == GattWriteOption::WriteWithResponse) {
+                if ((props & (unsigned int)GattCharacteristicProperties::WriteWithoutResponse) == 0) {
+                    errorString = "The WRITE property is not supported by this BLE characteristic";
+                }
+            } else {
+                if ((props & (unsigned int)GattCharacteristicProperties::Write) == 0) {
+                    errorString = "The WRITE_NO_RESPONSE property is not supported by this BLE characteristic";
+                }
+            }
+
+            if (errorString.size() > 0) {
+                std::vector<uint8_t> bytes;
+                SendResponse(std::move(result), "OnCharacteristicWritten", EncodableMap{
+                        {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                        {"service_uuid", EncodableValue(service)},
+                        {"secondary_service_uuid", EncodableValue()},
+                        {"characteristic_uuid", EncodableValue(characteristic)},
+                        {"value", EncodableValue(to_hexstring(bytes))},
+                        {"success", EncodableValue(0)},
+                        {"error_string", EncodableValue(errorString)},
+                        {"error_code", EncodableValue(438290)}
+                    });
+                co_return;
+            }
+
+            auto writeBuffer = writeBuffers.Acquire(value);
+            auto writeValueStatus = co_await Traced("WriteValueAsync", TrackOperation(operationId, gattCharacteristic.WriteValueAsync(writeBuffer, writeOption)));
+            writeBuffers.Release(writeBuffer);
+            trace.Record(TWRITE, bluetoothDeviceAgent.bluetoothAddress,
+                ((uint64_t)gattCharacteristic.AttributeHandle() << 32) | ((uint64_t)writeValueStatus << 16) | value.size());
+            FBP_LOG(LDEBUG, L"WriteValueAsync " + winrt::to_hstring(characteristic) + L", " + winrt::to_hstring(to_hexstring(value)) + L", " + winrt::to_hstring((int32_t)writeValueStatus));
+
+            SendResponse(std::move(result), "OnCharacteristicWritten", EncodableMap{
+                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                      {"service_uuid", EncodableValue(service)},
+                      {"secondary_service_uuid", EncodableValue()},
+                      {"characteristic_uuid", EncodableValue(characteristic)},
+                      {"value", EncodableValue(to_hexstring(value))},
+                      {"success", EncodableValue((int32_t)writeValueStatus == 0 ? 1 : 0)},
+                      {"error_string", EncodableValue((int32_t)writeValueStatus == 0 ? "success" : "Invalid Status")},
+                      {"error_code", EncodableValue((int32_t)writeValueStatus)}
+                });
+        } catch (winrt::hresult_canceled const& ex) {
+            FBP_LOG(LINFO, L"WriteValueAsync canceled");
+            SendResponse(std::move(result), "OnCharacteristicWritten", EncodableMap{
+                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress))},
+                      {"service_uuid", EncodableValue(service)},
+                      {"secondary_service_uuid", EncodableValue()},
+                      {"characteristic_uuid", EncodableValue(characteristic)},
+                      {"value", EncodableValue(to_hexstring(value))},
+                      {"success", EncodableValue(0)},
+                      {"error_string", EncodableValue("operation canceled")},
+                      {"error_code", EncodableValue((int32_t)ex.code())}
+                });
+        } catch(...) {
+            FBP_LOG(LERROR, L"Unexpected error in WriteValueAsync");
+            if (result) {
+                result->Error("writeCharacteristic", "Unexpected error in WriteValueAsync");
+            }
+        }
     }
 
-    winrt::fire_and_forget FlutterBluePlusPlugin::SendScanResultAsync(BluetoothLEAdvertisementReceivedEventArgs args) {
-        auto device = co_await BluetoothLEDevice::FromBluetoothAddressAsync(args.BluetoothAddress());
-        auto name = device ? device.Name() : args.Advertisement().LocalName();
-        FBPLog(LDEBUG, L"Received BluetoothAddress:" + winrt::to_hstring(args.BluetoothAddress())
-            + L", Name:" + name + L", LocalName:" + args.Advertisement().LocalName());
+    winrt::fire_and_forget FlutterBluePlusPlugin::PerformBatchAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::vector<BatchOperation> operations, int32_t priority, int32_t operationId, MethodResultPtr result) {
+        OperationScope scope{ this, operationId };
+        auto& bluetoothDeviceAgent = *agent;
+        auto remoteId = winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.bluetoothAddress));
+
+        // The whole batch is one turn of the device's queue, at the priority dart gave,
+        // so it neither overtakes nor runs alongside the device's other operations.
+        auto opQueue = bluetoothDeviceAgent.opQueue;
+        try {
+            co_await WaitTurnAsync(opQueue, priority, operationId);
+            OpTurn turn{ opQueue };
+            if (opQueue->closed) {
+                result->Error("performBatch", "Device is disconnected. remoteId:" + remoteId);
+                co_return;
+            }
+
+            // every operation has a result, in the same order as the operations
+            std::vector<EncodableMap> results;
+            for (auto& op : operations) {
+                results.push_back(EncodableMap{
+                    {"remote_id", remoteId},
+                    {"service_uuid", EncodableValue(op.service)},
+                    {"secondary_service_uuid", EncodableValue()},
+                    {"characteristic_uuid", EncodableValue(op.characteristic)},
+                    {"value", EncodableValue(std::string())},
+                    {"success", EncodableValue(0)},
+                    {"error_string", EncodableValue("characteristic not found")},
+                    {"error_code", EncodableValue(0)}
+                });
+            }
+
+            // Resolve each characteristic once, before anything runs in parallel.
+            // Operations on the same characteristic run in order, the others in parallel.
+            std::map<std::string, std::vector<size_t>> groups;
+            for (size_t i = 0; i < operations.size(); i++) {
+                auto& op = operations[i];
+                try {
+                    op.gattCharacteristic = co_await Traced("GetCharacteristicAsync", TrackOperation(operationId, bluetoothDeviceAgent.GetCharacteristicAsync(op.service, op.characteristic)));
+                } catch (...) {
+                    continue;
+                }
+                if (op.gattCharacteristic) {
+                    groups[op.service + "/" + op.characteristic].push_back(i);
+                }
+            }
+
+            // disconnected while resolving? the agent is closed & must not get new handlers
+            if (bluetoothDeviceAgent.opQueue->closed) {
+                result->Error("performBatch", "Device is disconnected. remoteId:" + remoteId);
+                co_return;
+            }
 
-        bool hasService = false;
-        if (targetServiceUuids.size() > 0) {
-            IVector<winrt::guid> services = args.Advertisement().ServiceUuids();
-            for (winrt::guid serviceUuid : services) {
-                for (flutter::EncodableValue targetServiceUuid : targetServiceUuids) {
-                    if (to_uuidstr(serviceUuid) == std::get<std::string>(targetServiceUuid)) {
-                        hasService = true;
-                        break;
+            // register before subscribing, so no notification is missed
+            for (auto& op : operations) {
+                if (op.type == 2 && op.enable && op.gattCharacteristic) {
+                    std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.gattMutex);
+                    if (bluetoothDeviceAgent.opQueue->closed) {
+                        break; // CleanConnection has collected the handlers already
+                    }
+                    if (op.channelId != 0) {
+                        bluetoothDeviceAgent.notifyChannelIds[op.gattCharacteristic.AttributeHandle()] = op.channelId;
+                    }
+                    if (!bluetoothDeviceAgent.valueChangedTokens[op.characteristic]) {
+                        bluetoothDeviceAgent.valueChangedTokens[op.characteristic] = op.gattCharacteristic.ValueChanged({ this, &FlutterBluePlusPlugin::GattCharacteristic_ValueChanged });
+                        op.registered = true;
                     }
                 }
             }
-        } else {
-            hasService = true;
-        }
-
-        EncodableMap manufacturerData;
-        for (auto const& data : args.Advertisement().ManufacturerData()) {
-            auto manufacturerId = data.CompanyId();
-            auto bytes = to_bytevc(data.Data());
 
-            manufacturerData[EncodableValue(manufacturerId)] = EncodableValue(to_hexstring(bytes));
-        }
+            std::vector<IAsyncAction> running;
+            for (auto& group : groups) {
+                running.push_back(RunBatchOperationsAsync(agent, operations, group.second, results, operationId));
+            }
+            for (auto& action : running) {
+                co_await action;
+            }
 
-        EncodableMap serviceData;
-        for (auto const& data : args.Advertisement().GetSectionsByType(0x16)) {
-            std::vector<uint8_t> bytes = to_bytevc(data.Data());
+            // unregister from characteristics that are no longer subscribed
+            for (size_t i = 0; i < operations.size(); i++) {
+                auto& op = operations[i];
+                bool success = std::get<int32_t>(results[i][EncodableValue("success")]) == 1;
+                bool unsubscribed = !op.enable && success;
+                bool subscribeFailed = op.enable && !success && op.registered;
+                if (op.type == 2 && op.gattCharacteristic && (unsubscribed || subscribeFailed)) {
+                    winrt::event_token token;
+                    {
+                        std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.gattMutex);
+                        bluetoothDeviceAgent.notifyChannelIds.erase(op.gattCharacteristic.AttributeHandle());
+                        token = std::exchange(bluetoothDeviceAgent.valueChangedTokens[op.characteristic], {});
+                    }
+                    if (token) {
+                        op.gattCharacteristic.ValueChanged(token);
+                    }
+                }
+            }
 
-            std::vector<uint8_t> uuidBytes;
-            std::vector<uint8_t> payloadBytes;
+            EncodableList list;
+            for (auto& r : results) {
+                list.push_back(EncodableValue(std::move(r)));
+            }
+            result->Success(EncodableValue(EncodableMap{
+                {"remote_id", remoteId},
+                {"results", EncodableValue(list)}
+            }));
+        } catch (winrt::hresult_canceled const&) {
+            FBP_LOG(LINFO, L"PerformBatchAsync canceled");
+            result->Error("performBatch", "operation canceled");
+        } catch (...) {
+            FBP_LOG(LERROR, L"Unexpected error in PerformBatchAsync");
+            result->Error("performBatch", "Unexpected error in PerformBatchAsync");
+        }
+    }
 
-            auto dataSize = data.Data().Length();
-            if (dataSize > 0) {
-                size_t uuidSize = 0;
+    IAsyncAction FlutterBluePlusPlugin::RunBatchOperationsAsync(std::shared_ptr<BluetoothDeviceAgent> agent, std::vector<BatchOperation>& operations, std::vector<size_t> indices, std::vector<EncodableMap>& results, int32_t operationId) {
+        auto& bluetoothDeviceAgent = *agent;
+        for (auto i : indices) {
+            auto& op = operations[i];
+            auto& response = results[i];
 
-                if (dataSize >= 128) {
-                    uuidSize = 16;
-                } else if (dataSize >= 32) {
-                    uuidSize = 4;
+            // disconnected during an earlier operation? the rest fail without touching the radio
+            if (bluetoothDeviceAgent.opQueue->closed) {
+                response[EncodableValue("error_string")] = EncodableValue("device is disconnected");
+                continue;
+            }
+            try {
+                GattCommunicationStatus status;
+                std::vector<uint8_t> value;
+                if (op.type == 0) {
+                    auto readValueResult = co_await Traced("ReadValueAsync", TrackOperation(operationId, op.gattCharacteristic.ReadValueAsync(BluetoothCacheMode::Uncached)));
+                    status = readValueResult.Status();
+                    if (status == GattCommunicationStatus::Success) {
+                        value = to_bytevc(readValueResult.Value());
+                        std::lock_guard<std::mutex> lock(bluetoothDeviceAgent.valuesMutex);
+                        bluetoothDeviceAgent.lastValues[op.gattCharacteristic.AttributeHandle()] = CachedValue{ value, std::chrono::steady_clock::now() };
+                    }
+                } else if (op.type == 1) {
+                    auto writeOption = op.writeType == 0 ? GattWriteOption::WriteWithResponse : GattWriteOption::WriteWithoutResponse;
+                    auto writeBuffer = writeBuffers.Acquire(op.value);
+                    status = co_await Traced("WriteValueAsync", TrackOperation(operationId, op.gattCharacteristic.WriteValueAsync(writeBuffer, writeOption)));
+                    writeBuffers.Release(writeBuffer);
+                    value = op.value;
                 } else {
-                    uuidSize = 2;
-                }
-
-                uuidBytes.resize(uuidSize);
-                for (size_t i=0; i<uuidSize; i++) {
-                    uuidBytes[i] = bytes[i];
+                    auto props = (unsigned int)op.gattCharacteristic.CharacteristicProperties();
+                    auto descriptorValue = !op.enable ? GattClientCharacteristicConfigurationDescriptorValue::None
+                                         : (props & (unsigned int)GattCharacteristicProperties::Notify) ? GattClientCharacteristicConfigurationDescriptorValue::Notify
+                                                                                                         : GattClientCharacteristicConfigurationDescriptorValue::Indicate;
+                    status = co_await Traced("WriteClientCharacteristicConfigurationDescriptorAsync", TrackOperation(operationId, op.gattCharacteristic.WriteClientCharacteristicConfigurationDescriptorAsync(descriptorValue)));
+                    value.push_back((uint8_t) descriptorValue);
+                    response[EncodableValue("descriptor_uuid")] = EncodableValue("2902");
                 }
 
-                payloadBytes.resize(dataSize - uuidSize);
-                for (size_t i=0; i<dataSize - uuidSize; i++) {
-                    payloadBytes[i] = bytes[i + uuidSize];
-                }
+                auto success = status == GattCommunicationStatus::Success;
+                response[EncodableValue("value")] = EncodableValue(to_hexstring(value));
+                response[EncodableValue("success")] = EncodableValue(success ? 1 : 0);
+                response[EncodableValue("error_string")] = EncodableValue(success ? "success" : getGattCommunicationStatusMessage(status));
+                response[EncodableValue("error_code")] = EncodableValue((int32_t) status);
+            } catch (winrt::hresult_canceled const& ex) {
+                response[EncodableValue("error_string")] = EncodableValue("operation canceled");
+                response[EncodableValue("error_code")] = EncodableValue((int32_t)ex.code());
+            } catch (...) {
+                FBP_LOG(LERROR, L"Unexpected error in RunBatchOperationsAsync");
+                response[EncodableValue("error_string")] = EncodableValue("unexpected error");
             }
-
-            // Convert Little Endian to Big Endian
-            std::reverse(uuidBytes.begin(), uuidBytes.end());
-            std::reverse(payloadBytes.begin(), payloadBytes.end());
-
-            serviceData[EncodableValue(to_hexstring(uuidBytes))] = EncodableValue(to_hexstring(payloadBytes));
         }
+    }
 
-        EncodableValue txPower;
-        if (args.TransmitPowerLevelInDBm()) {
-            txPower = EncodableValue((short)args.TransmitPowerLevelInDBm().Value());
+    void FlutterBluePlusPlugin::BeginOperation(const EncodableMap& args, int32_t& operationId) {
+        operationId = optionalInt32(args, "operation_id", 0);
+        if (operationId == 0) {
+            return;
         }
 
-        EncodableList serviceUuidList;
-        IVector<winrt::guid> serviceUuids = args.Advertisement().ServiceUuids();
-        for (winrt::guid uuid : serviceUuids) {
-            serviceUuidList.push_back(EncodableValue(to_uuidstr(uuid)));
+        {
+            std::lock_guard<std::mutex> lock(operationsMutex);
+            pendingOperations[operationId] = PendingOperation{};
         }
 
-        if (hasService) {
-            EncodableList advertisements;
-            advertisements.push_back(EncodableMap{
-                {"remote_id", EncodableValue(winrt::to_string(formatBluetoothAddress(args.BluetoothAddress())))},
-                {"platform_name", EncodableValue(winrt::to_string(name))},
-                {"adv_name", EncodableValue(winrt::to_string(args.Advertisement().LocalName()))},
-                {"connectable", EncodableValue(args.IsConnectable())},
-                {"tx_power_level", txPower},
-                {"manufacturer_data", EncodableValue(manufacturerData)},
-                {"service_uuids", EncodableValue(serviceUuidList)},
-                {"service_data", EncodableValue(serviceData)},
-                {"rssi", EncodableValue(args.RawSignalStrengthInDBm())}
-            });
-
-            method_channel_->InvokeMethod("OnScanResponse", std::make_unique<EncodableValue>(EncodableMap{
-                    {EncodableValue("advertisements"), advertisements},
-            }));
+        auto timeout = optionalInt32(args, "timeout", 0);
+        if (timeout > 0) {
+            OperationDeadlineAsync(operationId, std::chrono::milliseconds(timeout));
         }
     }
 
-    winrt::fire_and_forget FlutterBluePlusPlugin::ConnectAsync(uint64_t bluetoothAddress) {
-        auto device = co_await BluetoothLEDevice::FromBluetoothAddressAsync(bluetoothAddress);
-        auto servicesResult = co_await device.GetGattServicesAsync();
-        if (servicesResult.Status() != GattCommunicationStatus::Success) {
-            std::string errorMessage = getGattCommunicationStatusMessage(servicesResult.Status());
-            FBPLog(LERROR, L"GetGattServicesAsync error: " + winrt::to_hstring(errorMessage));
+    void FlutterBluePlusPlugin::EndOperation(int32_t operationId) {
+        if (operationId == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(operationsMutex);
+        pendingOperations.erase(operationId);
+    }
 
-            method_channel_->InvokeMethod("OnConnectionStateChanged",
-                std::make_unique<EncodableValue>(EncodableMap{
-                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
-                      {"connection_state", EncodableValue(0)},
-                      {"disconnect_reason_code", EncodableValue((int32_t)servicesResult.Status())},
-                      {"disconnect_reason_string", EncodableValue(errorMessage)}
-                }));
+    bool FlutterBluePlusPlugin::CancelOperation(int32_t operationId) {
+        std::lock_guard<std::mutex> lock(operationsMutex);
+        auto it = pendingOperations.find(operationId);
+        if (it == pendingOperations.end()) {
+            return false; // already finished
+        }
+        it->second.canceled = true;
+        trace.Record(TCANCELED, operationId);
+        for (auto& info : it->second.running) {
+            info.Cancel();
+        }
+        if (it->second.queue) {
+            it->second.queue->Cancel(it->second.waiter);
+        }
+        return true;
+    }
 
+    IAsyncAction FlutterBluePlusPlugin::WaitTurnAsync(std::shared_ptr<OpQueue> queue, int32_t priority, int32_t operationId) {
+        auto waiter = queue->Enter(priority);
+        if (!waiter) {
             co_return;
         }
-        auto connnectionStatusChangedToken = device.ConnectionStatusChanged({ this, &FlutterBluePlusPlugin::BluetoothLEDevice_ConnectionStatusChanged });
-        auto deviceAgent = std::make_unique<BluetoothDeviceAgent>(device, connnectionStatusChangedToken);
-        auto pair = std::make_pair(bluetoothAddress, std::move(deviceAgent));
-        connectedDevices.insert(std::move(pair));
 
-        method_channel_->InvokeMethod("OnConnectionStateChanged",
-            std::make_unique<EncodableValue>(EncodableMap{
-              {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
-              {"connection_state", EncodableValue(1)},
-              {"disconnect_reason_code", EncodableValue()},
-              {"disconnect_reason_string", EncodableValue()}
-            }));
-    }
+        // let CancelOperation find the waiter. Canceled before that? leave right away.
+        {
+            std::lock_guard<std::mutex> lock(operationsMutex);
+            auto it = pendingOperations.find(operationId);
+            if (it != pendingOperations.end()) {
+                it->second.queue = queue;
+                it->second.waiter = waiter;
+                if (it->second.canceled) {
+                    queue->Cancel(waiter);
+                }
+            }
+        }
 
-    void FlutterBluePlusPlugin::BluetoothLEDevice_ConnectionStatusChanged(BluetoothLEDevice sender, IInspectable args) {
-        FBPLog(LDEBUG, L"ConnectionStatusChanged " + winrt::to_hstring((int32_t)sender.ConnectionStatus()));
-        if (sender.ConnectionStatus() == BluetoothConnectionStatus::Disconnected) {
-            CleanConnection(sender.BluetoothAddress());
+        co_await winrt::resume_on_signal(waiter->signal.get());
 
-            method_channel_->InvokeMethod("OnConnectionStateChanged",
-                std::make_unique<EncodableValue>(EncodableMap{
-                      {"remote_id", winrt::to_string(formatBluetoothAddress(sender.BluetoothAddress()))},
-                      {"connection_state", EncodableValue(0)},
-                      {"disconnect_reason_code", EncodableValue()},
-                      {"disconnect_reason_string", EncodableValue()}
-                }));
+        {
+            std::lock_guard<std::mutex> lock(operationsMutex);
+            auto it = pendingOperations.find(operationId);
+            if (it != pendingOperations.end()) {
+                it->second.queue = nullptr;
+                it->second.waiter = nullptr;
+            }
+        }
+        if (waiter->canceled) {
+            throw winrt::hresult_canceled();
         }
     }
 
-    void FlutterBluePlusPlugin::CleanConnection(uint64_t bluetoothAddress) {
-        auto node = connectedDevices.extract(bluetoothAddress);
-        if (!node.empty()) {
-            auto deviceAgent = std::move(node.mapped());
-            deviceAgent->device.ConnectionStatusChanged(deviceAgent->connnectionStatusChangedToken);
-            for (auto& tokenPair : deviceAgent->valueChangedTokens) {
-                deviceAgent->gattCharacteristics.at(tokenPair.first).ValueChanged(tokenPair.second);
-            }
-
-            method_channel_->InvokeMethod("OnConnectionStateChanged",
-                std::make_unique<EncodableValue>(EncodableMap{
-                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
-                      {"connection_state", EncodableValue(0)},
-                      {"disconnect_reason_code", EncodableValue()},
-                      {"disconnect_reason_string", EncodableValue()}
-                }));
+    winrt::fire_and_forget FlutterBluePlusPlugin::OperationDeadlineAsync(int32_t operationId, std::chrono::milliseconds timeout) {
+        co_await winrt::resume_after(timeout);
+        if (CancelOperation(operationId)) {
+            FBP_LOG(LINFO, L"operation " + winrt::to_hstring(operationId) + L" canceled, deadline passed");
         }
     }
 
-    winrt::fire_and_forget FlutterBluePlusPlugin::DiscoverServicesAsync(BluetoothDeviceAgent& bluetoothDeviceAgent) {
-        auto serviceResult = co_await bluetoothDeviceAgent.device.GetGattServicesAsync();
-        if (serviceResult.Status() != GattCommunicationStatus::Success) {
-            EncodableList services;
-            method_channel_->InvokeMethod("OnDiscoveredServices",
-                std::make_unique<EncodableValue>(EncodableMap{
-                      {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.device.BluetoothAddress()))},
-                      {"services", EncodableValue(services)},
-                      {"success", EncodableValue(0)},
-                      {"error_string", EncodableValue("Invalid status")},
-                      {"error_code", EncodableValue(0)}
-                }));
-            co_return;
+    void FlutterBluePlusPlugin::SendResponse(MethodResultPtr result, const std::string& method, EncodableMap response) {
+        TraceSpan span(trace, "SendResponse");
+        if (result) {
+            result->Success(EncodableValue(std::move(response)));
+        } else {
+            method_channel_->InvokeMethod(method, std::make_unique<EncodableValue>(std::move(response)));
         }
+    }
 
-        auto bluetoothAddress = bluetoothDeviceAgent.device.BluetoothAddress();
-        EncodableList services;
-
-        for (auto s : serviceResult.Services()) {
-            EncodableList includedServices;
-            auto includedServiceResult = co_await s.GetIncludedServicesAsync();
-            if (includedServiceResult.Status() != GattCommunicationStatus::Success) {
-                //includedServices = co_await bmBluetoothService(includedServiceResult, bluetoothAddress);
+    void FlutterBluePlusPlugin::GattCharacteristic_ValueChanged(GattCharacteristic sender, GattValueChangedEventArgs args) {
+        auto timestamp = monotonicMicros();
+        TraceSpan span(trace, "ValueChanged");
+        auto characteristic_uuid = to_uuidstr(sender.Uuid());
+        auto service_uuid = to_uuidstr(sender.Service().Uuid());
+        auto bluetoothAddress = sender.Service().Device().BluetoothAddress();
+        auto bytes = to_bytevc(args.CharacteristicValue());
+        trace.Record(TNOTIFY, bluetoothAddress, ((uint64_t)sender.AttributeHandle() << 32) | bytes.size());
+        FBP_LOG(LVERBOSE, L"GattCharacteristic_ValueChanged " + winrt::to_hstring(characteristic_uuid) + L", " + winrt::to_hstring(service_uuid) + L", " + winrt::to_hstring(to_hexstring(bytes)));
+
+#if FBP_DART_API_DL
+        // subscribed with a SendPort: post from this thread, bypassing the platform thread
+        // and the method channel. The value is still cached for reads with a max age.
+        if (auto agent = FindAgent(bluetoothAddress)) {
+            auto route = agent->RouteOf(sender.AttributeHandle());
+            if (route.port != 0) {
+                nativeSnapshot.counters[COUNTER_NOTIFICATIONS]++;
+                {
+                    std::lock_guard<std::mutex> lock(agent->valuesMutex);
+                    agent->lastValues[sender.AttributeHandle()] = CachedValue{ bytes, std::chrono::steady_clock::now() };
+                }
+                if (route.channelId != 0) {
+                    nativeSnapshot.SetValue(route.channelId, bytes.data(), (int32_t)bytes.size());
+                }
+                bool posted;
+                if (!route.payloadLayout) {
+                    posted = postToPort(route.port, std::move(bytes), Dart_TypedData_kUint8);
+                } else if (route.payloadLayout->asInt32) {
+                    posted = postToPort(route.port, route.payloadLayout->DecodeAs<int32_t>(bytes), Dart_TypedData_kInt32);
+                } else {
+                    posted = postToPort(route.port, route.payloadLayout->DecodeAs<float>(bytes), Dart_TypedData_kFloat32);
+                }
+                if (!posted) {
+                    FBP_LOG(LWARNING, L"GattCharacteristic_ValueChanged: dart port is closed");
+                }
+                return;
             }
+        }
+#endif
 
-            auto service = EncodableMap{
-                    {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
-                    {"service_uuid", to_uuidstr(s.Uuid())},
-                    {"is_primary", EncodableValue(true)},
-                    {"included_services", EncodableValue(includedServices)}
+        auto response = EncodableMap{
+                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
+                  {"service_uuid", EncodableValue(service_uuid)},
+                  {"secondary_service_uuid", EncodableValue()},
+                  {"characteristic_uuid", EncodableValue(characteristic_uuid)},
+                  {"value", EncodableValue(to_hexstring(bytes))},
+                  {"timestamp", EncodableValue(timestamp)},
+                  {"success", EncodableValue(1)},
+                  {"error_string", EncodableValue("success")},
+                  {"error_code", EncodableValue(0)}
             };
 
-            auto characteristicResult = co_await s.GetCharacteristicsAsync();
-            if (characteristicResult.Status() == GattCommunicationStatus::Success) {
-                EncodableList characteristics;
-                for (auto c : characteristicResult.Characteristics()) {
-                    auto descriptorsResult = co_await c.GetDescriptorsAsync();
-                    EncodableList descriptors;
-                    for (auto d : descriptorsResult.Descriptors()) {
-                        descriptors.push_back(EncodableMap{
-                                {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
-                                {"service_uuid", EncodableValue(to_uuidstr(s.Uuid()))},
-                                {"secondary_service_uuid", EncodableValue()},
-                                {"characteristic_uuid", EncodableValue(to_uuidstr(c.Uuid()))},
-                                {"descriptor_uuid", EncodableValue(to_uuidstr(d.Uuid()))},
-                        });
-                    }
+        // tag with the routing id, so dart delivers it straight to the characteristic's listeners
+        nativeSnapshot.counters[COUNTER_NOTIFICATIONS]++;
+        auto agent = FindAgent(bluetoothAddress);
+        if (agent) {
+            {
+                std::lock_guard<std::mutex> lock(agent->valuesMutex);
+                agent->lastValues[sender.AttributeHandle()] = CachedValue{ bytes, std::chrono::steady_clock::now() };
+            }
 
-                    auto props = (unsigned int)c.CharacteristicProperties();
-                    auto propsMap = EncodableMap{
-                            {"broadcast", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Broadcast))},
-                            {"read", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Read))},
-                            {"write_without_response", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::WriteWithoutResponse))},
-                            {"write", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Write))},
-                            {"notify", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Notify))},
-                            {"indicate", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::Indicate))},
-                            {"authenticated_signed_writes", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::AuthenticatedSignedWrites))},
-                            {"extended_properties", EncodableValue((int32_t)(props & (unsigned int)GattCharacteristicProperties::ExtendedProperties))},
-                            {"notify_encryption_required", EncodableValue(false)},
-                            {"indicate_encryption_required", EncodableValue(false)}
-                    };
-
-                    characteristics.push_back(EncodableMap{
-                            {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothAddress))},
-                            {"service_uuid", to_uuidstr(c.Service().Uuid())},
-                            {"secondary_service_uuid", EncodableValue()},
-                            {"characteristic_uuid", to_uuidstr(c.Uuid())},
-                            {"descriptors", EncodableValue(descriptors)},
-                            {"properties", EncodableValue(propsMap)}
-                    });
-                }
-                service.insert({ "characteristics", characteristics });
+            auto route = agent->RouteOf(sender.AttributeHandle());
+            if (route.channelId != 0) {
+                response[EncodableValue("channel_id")] = EncodableValue(route.channelId);
+                nativeSnapshot.SetValue(route.channelId, bytes.data(), (int32_t)bytes.size());
             }
 
-            services.push_back(service);
+            // decoded here, so dart receives a typed list instead of parsing each sample
+            if (route.payloadLayout) {
+                response[EncodableValue("decoded")] = route.payloadLayout->Decode(bytes);
+            }
         }
 
-        method_channel_->InvokeMethod("OnDiscoveredServices",
-        std::make_unique<EncodableValue>(EncodableMap{
-              {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.device.BluetoothAddress()))},
-              {"services", EncodableValue(services)},
-              {"success", EncodableValue(1)},
-              {"error_string", EncodableValue("success")},
-              {"error_code", EncodableValue(0)}
-        }));
+        EmitNotification(std::move(response), (bluetoothAddress << 16) | sender.AttributeHandle(), timestamp);
     }
 
-    winrt::fire_and_forget FlutterBluePlusPlugin::SetNotifiableAsync(BluetoothDeviceAgent& bluetoothDeviceAgent, std::string service, std::string characteristic, int32_t bleInputProperty) {
-        FBPLog(LDEBUG, L"SetNotifiableAsync " + winrt::to_hstring((int32_t) bleInputProperty));
-
-        try {
-            auto gattCharacteristic = co_await bluetoothDeviceAgent.GetCharacteristicAsync(service, characteristic);
-
-            // check notify-able
-            auto props = (unsigned int)gattCharacteristic.CharacteristicProperties();
-            if ((props & (unsigned int)GattCharacteristicProperties::Notify) == 0 &&
-                (props & (unsigned int)GattCharacteristicProperties::Indicate) == 0) {
-                std::vector<uint8_t> bytes;
-                method_channel_->InvokeMethod("OnDescriptorWritten",
-                    std::make_unique<EncodableValue>(EncodableMap{
-                        {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.device.BluetoothAddress()))},
-                        {"service_uuid", EncodableValue(service)},
-                        {"secondary_service_uuid", EncodableValue()},
-                        {"characteristic_uuid", EncodableValue(characteristic)},
-                        {"descriptor_uuid", EncodableValue("2902")},
-                        {"value", EncodableValue(to_hexstring(bytes))},
-                        {"success", EncodableValue(0)},
-                        {"error_string", EncodableValue("neither NOTIFY nor INDICATE properties are supported by this BLE characteristic")},
-                        {"error_code", EncodableValue(587024)}
-                    }));
-                co_return;
+    void FlutterBluePlusPlugin::EmitNotification(EncodableMap event, uint64_t key, int64_t timestamp) {
+        bool overflowed = false;
+        {
+            std::lock_guard<std::mutex> lock(alignment.mutex);
+            if (alignment.window > 0) {
+                alignment.events.emplace_back(timestamp, std::move(event));
+                if (alignment.events.size() <= alignment.capacity) {
+                    return;
+                }
+                alignment.events.pop_front();
+                overflowed = true;
             }
+        }
+        if (overflowed) {
+            // counted with the stream's other drops
+            std::lock_guard<std::mutex> lock(notifyFlow.mutex);
+            notifyFlow.dropped++;
+            return;
+        }
+        EmitEvent(notifyFlow, 0, "OnCharacteristicReceived", std::move(event), key);
+    }
 
-            auto descriptorValue = bleInputProperty == 1 ? GattClientCharacteristicConfigurationDescriptorValue::Notify
-                                                         : bleInputProperty == 2 ? GattClientCharacteristicConfigurationDescriptorValue::Indicate
-                                                                                 : GattClientCharacteristicConfigurationDescriptorValue::None;
+    void FlutterBluePlusPlugin::HandleSetAlignment(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+        auto window = requiredArg<int32_t>(args, "window");
+        auto capacity = optionalInt32(args, "capacity", defaultAlignmentCapacity);
+        if (capacity < 1) {
+            throw ArgumentError{ "invalid alignment capacity: " + std::to_string(capacity) };
+        }
 
-            auto writeDescriptorStatus = co_await gattCharacteristic.WriteClientCharacteristicConfigurationDescriptorAsync(descriptorValue);
-            FBPLog(LDEBUG, L"WriteClientCharacteristicConfigurationDescriptorAsync " + winrt::to_hstring((int32_t) writeDescriptorStatus));
+        uint32_t generation;
+        {
+            std::lock_guard<std::mutex> lock(alignment.mutex);
+            alignment.window = window > 0 ? window : 0;
+            alignment.capacity = (size_t)capacity;
+            generation = ++alignment.generation;
+        }
 
-            std::vector<uint8_t> bytes;
-            bytes.push_back((uint8_t) descriptorValue);
+        if (window > 0) {
+            AlignmentFlushAsync(generation, window);
+        } else {
+            // turned off: send what is held back
+            FlushAlignment(generation, INT64_MAX);
+        }
+        result->Success(EncodableValue(true));
+    }
 
-            auto success = writeDescriptorStatus == GattCommunicationStatus::Success;
-            method_channel_->InvokeMethod("OnDescriptorWritten",
-                std::make_unique<EncodableValue>(EncodableMap{
-                    {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.device.BluetoothAddress()))},
-                    {"service_uuid", EncodableValue(service)},
-                    {"secondary_service_uuid", EncodableValue()},
-                    {"characteristic_uuid", EncodableValue(characteristic)},
-                    {"descriptor_uuid", EncodableValue("2902")},
-                    {"value", EncodableValue(to_hexstring(bytes))},
-                    {"success", EncodableValue(success ? 1 : 0)},
-                    {"error_string", EncodableValue(success ? "success" : "invalid status")},
-                    {"error_code", EncodableValue(success ? 0 : (int32_t) writeDescriptorStatus)}
-                }));
+    winrt::fire_and_forget FlutterBluePlusPlugin::AlignmentFlushAsync(uint32_t generation, int32_t window) {
+        while (true) {
+            co_await winrt::resume_after(std::chrono::milliseconds(window));
+            if (!FlushAlignment(generation, monotonicMicros() - (int64_t)window * 1000)) {
+                co_return;
+            }
+        }
+    }
 
-            if (bleInputProperty != 0) {
-                bluetoothDeviceAgent.valueChangedTokens[characteristic] = gattCharacteristic.ValueChanged({ this, &FlutterBluePlusPlugin::GattCharacteristic_ValueChanged });
+    // Sends the events stamped up to 'watermark' as one batch, in time order.
+    // Returns false once the alignment was changed, to end its flush loop.
+    bool FlutterBluePlusPlugin::FlushAlignment(uint32_t generation, int64_t watermark) {
+        EncodableList batch;
+        {
+            std::lock_guard<std::mutex> lock(alignment.mutex);
+            if (alignment.generation != generation) {
+                return false;
             }
-            else {
-                gattCharacteristic.ValueChanged(std::exchange(bluetoothDeviceAgent.valueChangedTokens[characteristic], {}));
+            auto& events = alignment.events;
+            std::stable_sort(events.begin(), events.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            size_t ready = 0;
+            while (ready < events.size() && events[ready].first <= watermark) {
+                batch.push_back(EncodableValue(std::move(events[ready].second)));
+                ready++;
             }
-        } catch(...) {
-            FBPLog(LERROR, L"Unexpected error in SetNotifiableAsync");
-            co_return;
+            events.erase(events.begin(), events.begin() + ready);
         }
+        // a batch spends one credit of the notifications, like a single notification would
+        if (!batch.empty()) {
+            EmitEvent(notifyFlow, 0, "OnCharacteristicBatch", EncodableMap{
+                {"events", EncodableValue(std::move(batch))}
+            }, alignedBatchKey);
+        }
+        return true;
     }
 
-    winrt::fire_and_forget FlutterBluePlusPlugin::ReadValueAsync(BluetoothDeviceAgent& bluetoothDeviceAgent, std::string service, std::string characteristic) {
-        auto gattCharacteristic = co_await bluetoothDeviceAgent.GetCharacteristicAsync(service, characteristic);
-
-        // check readable
-        auto props = (unsigned int)gattCharacteristic.CharacteristicProperties();
-        if ((props & (unsigned int)GattCharacteristicProperties::Read) == 0) {
-            std::vector<uint8_t> bytes;
-            method_channel_->InvokeMethod("OnCharacteristicReceived",
-                std::make_unique<EncodableValue>(EncodableMap{
-                    {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.device.BluetoothAddress()))},
-                    {"service_uuid", EncodableValue(service)},
-                    {"secondary_service_uuid", EncodableValue()},
-                    {"characteristic_uuid", EncodableValue(characteristic)},
-                    {"value", EncodableValue(to_hexstring(bytes))},
-                    {"success", EncodableValue(0)},
-                    {"error_string", EncodableValue("The READ property is not supported by this BLE characteristic")},
-                    {"error_code", EncodableValue(572824)}
-                }));
-            co_return;
+    FlowStream* FlutterBluePlusPlugin::FlowStreamAt(int32_t index) {
+        // 0 = notifications, 1 = scan results
+        if (index == 0) {
+            return &notifyFlow;
         }
+        if (index == 1) {
+            return &scanFlow;
+        }
+        throw ArgumentError{ "invalid flow stream: " + std::to_string(index) };
+    }
 
-        auto readValueResult = co_await gattCharacteristic.ReadValueAsync();
-        auto bytes = to_bytevc(readValueResult.Value());
-
-        FBPLog(LDEBUG, L"ReadValueAsync " + winrt::to_hstring(characteristic) + L", " + winrt::to_hstring(to_hexstring(bytes)));
+    void FlutterBluePlusPlugin::HandleSetFlowControl(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+        auto index = requiredArg<int32_t>(args, "stream");
+        auto policy = requiredArg<int32_t>(args, "policy");
+        auto credits = requiredArg<int32_t>(args, "credits");
+        auto backlog = optionalInt32(args, "backlog", 0);
+        if (policy < FLOW_NONE || policy > FLOW_BLOCK) {
+            throw ArgumentError{ "invalid flow policy: " + std::to_string(policy) };
+        }
 
-        method_channel_->InvokeMethod("OnCharacteristicReceived",
-            std::make_unique<EncodableValue>(EncodableMap{
-                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.device.BluetoothAddress()))},
-                  {"service_uuid", EncodableValue(service)},
-                  {"secondary_service_uuid", EncodableValue()},
-                  {"characteristic_uuid", EncodableValue(characteristic)},
-                  {"value", EncodableValue(to_hexstring(bytes))},
-                  {"success", EncodableValue(1)},
-                  {"error_string", EncodableValue("success")},
-                  {"error_code", EncodableValue(0)}
-            }));
+        auto& stream = *FlowStreamAt(index);
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        stream.policy = policy;
+        stream.credits = credits;
+        stream.backlogCapacity = backlog > 0 ? (size_t)backlog : 0;
+        if (policy == FLOW_NONE || policy == FLOW_DROP_NEWEST) {
+            stream.backlog.clear();
+        }
+        result->Success(EncodableValue(true));
     }
 
-    winrt::fire_and_forget FlutterBluePlusPlugin::WriteValueAsync(BluetoothDeviceAgent& bluetoothDeviceAgent, std::string service, std::string characteristic, std::vector<uint8_t> value, int32_t bleOutputProperty) {
-        auto gattCharacteristic = co_await bluetoothDeviceAgent.GetCharacteristicAsync(service, characteristic);
-        auto writeOption = bleOutputProperty == 0 ? GattWriteOption::WriteWithResponse : GattWriteOption::WriteWithoutResponse;
+    void FlutterBluePlusPlugin::HandleGrantCredits(const EncodableValue* arguments, MethodResultPtr& result) {
+        const auto& args = argumentAs<EncodableMap>(arguments, "arguments");
+        auto index = requiredArg<int32_t>(args, "stream");
+        auto credits = requiredArg<int32_t>(args, "credits");
+
+        auto& stream = *FlowStreamAt(index);
+        {
+            std::unique_lock<std::mutex> lock(stream.mutex);
+            stream.credits += credits;
+            FlushBacklog(stream);
+            SendOutbox(stream, lock);
+        }
+        result->Success(EncodableValue(true));
+    }
 
-        // check writeable
-        std::string errorString;
-        auto props = (unsigned int)gattCharacteristic.CharacteristicProperties();
-        if (writeOption == GattWriteOption::WriteWithResponse) {
-            if ((props & (unsigned int)GattCharacteristicProperties::WriteWithoutResponse) == 0) {
-                errorString = "The WRITE property is not supported by this BLE characteristic";
-            }
-        } else {
-            if ((props & (unsigned int)GattCharacteristicProperties::Write) == 0) {
-                errorString = "The WRITE_NO_RESPONSE property is not supported by this BLE characteristic";
+    // stream.mutex must be held. Moves the backlogged events that have a credit to the outbox.
+    void FlutterBluePlusPlugin::FlushBacklog(FlowStream& stream) {
+        if (stream.policy == FLOW_BLOCK) {
+            auto expired = std::chrono::steady_clock::now() - flowBlockTimeout;
+            while (!stream.backlog.empty() && stream.backlog.front().time < expired) {
+                stream.backlog.pop_front();
+                stream.dropped++;
             }
         }
-
-        if (errorString.size() > 0) {
-            std::vector<uint8_t> bytes;
-            method_channel_->InvokeMethod("OnCharacteristicWritten",
-                std::make_unique<EncodableValue>(EncodableMap{
-                    {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.device.BluetoothAddress()))},
-                    {"service_uuid", EncodableValue(service)},
-                    {"secondary_service_uuid", EncodableValue()},
-                    {"characteristic_uuid", EncodableValue(characteristic)},
-                    {"value", EncodableValue(to_hexstring(bytes))},
-                    {"success", EncodableValue(0)},
-                    {"error_string", EncodableValue(errorString)},
-                    {"error_code", EncodableValue(438290)}
-                }));
-            co_return;
+        while (!stream.backlog.empty() && stream.credits > 0) {
+            stream.credits--;
+            stream.sent++;
+            stream.outbox.push_back(std::move(stream.backlog.front()));
+            stream.backlog.pop_front();
         }
+    }
 
-        auto writeValueStatus = co_await gattCharacteristic.WriteValueAsync(from_bytevc(value), writeOption);
-        FBPLog(LDEBUG, L"WriteValueAsync " + winrt::to_hstring(characteristic) + L", " + winrt::to_hstring(to_hexstring(value)) + L", " + winrt::to_hstring((int32_t)writeValueStatus));
-
-        method_channel_->InvokeMethod("OnCharacteristicWritten",
-            std::make_unique<EncodableValue>(EncodableMap{
-                  {"remote_id", winrt::to_string(formatBluetoothAddress(bluetoothDeviceAgent.device.BluetoothAddress()))},
-                  {"service_uuid", EncodableValue(service)},
-                  {"secondary_service_uuid", EncodableValue()},
-                  {"characteristic_uuid", EncodableValue(characteristic)},
-                  {"value", EncodableValue(to_hexstring(value))},
-                  {"success", EncodableValue((int32_t)writeValueStatus == 0 ? 1 : 0)},
-                  {"error_string", EncodableValue((int32_t)writeValueStatus == 0 ? "success" : "Invalid Status")},
-                  {"error_code", EncodableValue((int32_t)writeValueStatus)}
-            }));
+    // Sends the outbox with the lock released. If another thread is already sending,
+    // it picks up the new events before it stops.
+    void FlutterBluePlusPlugin::SendOutbox(FlowStream& stream, std::unique_lock<std::mutex>& lock) {
+        if (stream.sending) {
+            return;
+        }
+        stream.sending = true;
+        while (!stream.outbox.empty()) {
+            std::vector<FlowEvent> events;
+            events.swap(stream.outbox);
+            lock.unlock();
+            for (auto& event : events) {
+                method_channel_->InvokeMethod(event.method, std::make_unique<EncodableValue>(std::move(event.event)));
+            }
+            lock.lock();
+        }
+        stream.sending = false;
     }
 
-    void FlutterBluePlusPlugin::GattCharacteristic_ValueChanged(GattCharacteristic sender, GattValueChangedEventArgs args) {
-        auto characteristic_uuid = to_uuidstr(sender.Uuid());
-        auto service_uuid = to_uuidstr(sender.Service().Uuid());
-        auto bytes = to_bytevc(args.CharacteristicValue());
-        //FBPLog(LDEBUG, L"GattCharacteristic_ValueChanged " + winrt::to_hstring(characteristic_uuid) + L", " + winrt::to_hstring(service_uuid) + L", " + winrt::to_hstring(to_hexstring(bytes))));
+    void FlutterBluePlusPlugin::EmitEvent(FlowStream& stream, int32_t index, const char* method, EncodableMap event, uint64_t key) {
+        std::unique_lock<std::mutex> lock(stream.mutex);
+        if (stream.policy == FLOW_NONE) {
+            lock.unlock();
+            method_channel_->InvokeMethod(method, std::make_unique<EncodableValue>(std::move(event)));
+            return;
+        }
 
-        method_channel_->InvokeMethod("OnCharacteristicReceived",
-            std::make_unique<EncodableValue>(EncodableMap{
-                  {"remote_id", winrt::to_string(formatBluetoothAddress(sender.Service().Device().BluetoothAddress()))},
-                  {"service_uuid", EncodableValue(service_uuid)},
-                  {"secondary_service_uuid", EncodableValue()},
-                  {"characteristic_uuid", EncodableValue(characteristic_uuid)},
-                  {"value", EncodableValue(to_hexstring(bytes))},
-                  {"success", EncodableValue(1)},
-                  {"error_string", EncodableValue("success")},
-                  {"error_code", EncodableValue(0)}
-            }));
+        // dart counts the events of each stream, to grant credits back
+        event[EncodableValue("flow_stream")] = EncodableValue(index);
+
+        // send now, behind anything already backlogged
+        FlushBacklog(stream);
+        auto backlogged = stream.policy != FLOW_CONFLATE ? stream.backlog.end()
+            : std::find_if(stream.backlog.begin(), stream.backlog.end(), [key](const FlowEvent& e) { return e.key == key; });
+        if (stream.credits > 0 && stream.backlog.empty()) {
+            stream.credits--;
+            stream.sent++;
+            stream.outbox.push_back(FlowEvent{ key, method, std::move(event), std::chrono::steady_clock::now() });
+        } else if (stream.policy == FLOW_DROP_NEWEST) {
+            stream.dropped++;
+        } else if (backlogged != stream.backlog.end()) {
+            backlogged->event = std::move(event);
+            stream.conflated++;
+        } else if (stream.policy == FLOW_BLOCK && stream.backlog.size() >= stream.backlogCapacity) {
+            // block keeps the events it already holds, they are older
+            stream.dropped++;
+        } else {
+            stream.backlog.push_back(FlowEvent{ key, method, std::move(event), std::chrono::steady_clock::now() });
+            if (stream.backlog.size() > stream.backlogCapacity) {
+                stream.backlog.pop_front();
+                stream.dropped++;
+            }
+        }
+        SendOutbox(stream, lock);
     }
 
     void FlutterBluePlusPlugin::FBPLog(LogLevel level, winrt::hstring message) {
@@ -928,4 +4304,51 @@ void FlutterBluePlusPluginRegisterWithRegistrar(
     FlutterBluePlusPlugin::RegisterWithRegistrar(
         flutter::PluginRegistrarManager::GetInstance()
         ->GetRegistrar<flutter::PluginRegistrarWindows>(registrar));
-}
\ No newline at end of file
+}
+
+int32_t FlutterBluePlusAdapterState(void) {
+    return nativeSnapshot.adapterState.load();
+}
+
+int32_t FlutterBluePlusConnectedCount(void) {
+    return nativeSnapshot.connectedCount.load();
+}
+
+int32_t FlutterBluePlusIsConnected(uint64_t remote_id) {
+    if (!nativeSnapshot.Knows(remote_id)) {
+        return snapshotOverflow;
+    }
+    auto device = nativeSnapshot.FindDevice(remote_id);
+    return device && device->connected.load() ? 1 : 0;
+}
+
+int32_t FlutterBluePlusMtu(uint64_t remote_id) {
+    if (!nativeSnapshot.Knows(remote_id)) {
+        return snapshotOverflow;
+    }
+    auto device = nativeSnapshot.FindDevice(remote_id);
+    return device ? device->mtu.load() : 0;
+}
+
+int32_t FlutterBluePlusLastValue(int32_t channel_id, uint8_t* out, int32_t capacity) {
+    if (!out || capacity < 0) {
+        return -1;
+    }
+    return nativeSnapshot.ReadValue(channel_id, out, (size_t)capacity);
+}
+
+int64_t FlutterBluePlusCounter(int32_t counter) {
+    if (counter < 0 || counter >= COUNTER_COUNT) {
+        return -1;
+    }
+    return nativeSnapshot.counters[counter].load();
+}
+
+intptr_t FlutterBluePlusInitDartApiDL(void* data) {
+#if FBP_DART_API_DL
+    return Dart_InitializeApiDL(data);
+#else
+    (void)data;
+    return -1;
+#endif
+}
@@ -2,6 +2,8 @@
 #define FLUTTER_PLUGIN_FLUTTER_BLUE_PLUS_PLUGIN_C_API_H_
 
 #include <flutter_plugin_registrar.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 #ifdef FLUTTER_PLUGIN_IMPL
 #define FLUTTER_PLUGIN_EXPORT __declspec(dllexport)
@@ -16,6 +18,33 @@ extern "C" {
 FLUTTER_PLUGIN_EXPORT void FlutterBluePlusPluginRegisterWithRegistrar(
     FlutterDesktopPluginRegistrarRef registrar);
 
+// Snapshots of native state, for dart to read synchronously over FFI.
+// They take no lock, and are safe to call from any thread.
+//   - remote_id: the 48-bit bluetooth address
+//   - channel_id: the routing id dart gave in setNotifyValue / startPolling
+//   - the snapshot tracks 32 devices and channel ids below 128. Beyond that,
+//     the functions below return -2 rather than a wrong answer.
+
+// BmAdapterStateEnum index
+FLUTTER_PLUGIN_EXPORT int32_t FlutterBluePlusAdapterState(void);
+FLUTTER_PLUGIN_EXPORT int32_t FlutterBluePlusConnectedCount(void);
+// 1 if connected, 0 if not, -2 if the device is not in the snapshot
+FLUTTER_PLUGIN_EXPORT int32_t FlutterBluePlusIsConnected(uint64_t remote_id);
+// 0 if not connected, -2 if the device is not in the snapshot
+FLUTTER_PLUGIN_EXPORT int32_t FlutterBluePlusMtu(uint64_t remote_id);
+// Copies the last notified or polled value into the caller's buffer 'out', of
+// 'capacity' bytes, and returns the value's full length. -1 = no value,
+// -2 = channel_id is beyond the snapshot.
+// At most 512 bytes are kept natively, so longer values are truncated.
+FLUTTER_PLUGIN_EXPORT int32_t FlutterBluePlusLastValue(int32_t channel_id, uint8_t* out, int32_t capacity);
+// 0 = notifications, 1 = scan results, 2 = connects, 3 = disconnects. -1 if unknown.
+FLUTTER_PLUGIN_EXPORT int64_t FlutterBluePlusCounter(int32_t counter);
+
+// Called by dart over FFI with NativeApi.initializeApiDLData, before it
+// subscribes with a SendPort. Returns 0 on success, -1 if the plugin was
+// built without dart_api_dl.
+FLUTTER_PLUGIN_EXPORT intptr_t FlutterBluePlusInitDartApiDL(void* data);
+
 #if defined(__cplusplus)
 }  // extern "C"
 #endif